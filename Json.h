@@ -6,27 +6,147 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cfloat>
 #include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <exception>
+#include <filesystem>
 #include <forward_list>
 #include <iostream>
 #include <initializer_list>
+#include <limits>
 #include <list>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <sstream>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utf8.h>
 #include <utility>
 #include <vector>
 #include <variant>
 
+enum class JsonErrorCode : uint8_t
+{
+    None,
+    EmptyInput,
+    UnexpectedEndOfInput,
+    UnexpectedInput,
+    UnexpectedToken,
+    InvalidNumber,
+    ExpectedBoolean,
+    ExpectedNull,
+    InvalidUnicodeEscape,
+    InvalidCodePoint,
+    InvalidUtf8,
+    ExpectedString,
+    ExpectedColon,
+    ExpectedValue,
+    ExpectedObjectEnd,
+    ExpectedArrayEnd,
+    DepthExceeded
+};
+
+// Why and where parsing failed. 'offset' counts bytes from the start of the
+// input, while 'line' and 'column' count from 1, with columns counted in
+// characters. Like std::error_code, it converts to true when it holds an error.
+struct JsonError
+{
+    JsonErrorCode code = JsonErrorCode::None;
+    size_t offset = 0;
+    size_t line = 0;
+    size_t column = 0;
+
+    explicit operator bool() const {
+        return code != JsonErrorCode::None;
+    }
+
+    // Locates 'offset' in 'text'. This only runs once parsing has failed,
+    // so the lexer doesn't have to count lines as it goes.
+    static JsonError At(JsonErrorCode code, std::string_view text, size_t offset)
+    {
+        JsonError error;
+        error.code = code;
+        error.offset = offset;
+        error.line = 1;
+        error.column = 1;
+
+        for (size_t i = 0, n = std::min(offset, text.size()); i != n; ++i)
+        {
+            if (text[i] == '\n') {
+                ++error.line;
+                error.column = 1;
+            }
+            else if (((unsigned char)text[i] & 0xC0) != 0x80) {
+                ++error.column;
+            }
+        }
+
+        return error;
+    }
+
+    const char* GetMessage() const
+    {
+        switch (code)
+        {
+        case JsonErrorCode::None: return "no error";
+        case JsonErrorCode::EmptyInput: return "input is empty";
+        case JsonErrorCode::UnexpectedEndOfInput: return "unexpected end of input";
+        case JsonErrorCode::UnexpectedInput: return "found unexpected input";
+        case JsonErrorCode::UnexpectedToken: return "unexpected token";
+        case JsonErrorCode::InvalidNumber: return "invalid number";
+        case JsonErrorCode::ExpectedBoolean: return "expected boolean literal";
+        case JsonErrorCode::ExpectedNull: return "expected null literal";
+        case JsonErrorCode::InvalidUnicodeEscape: return "invalid unicode escape sequence";
+        case JsonErrorCode::InvalidCodePoint: return "invalid code point";
+        case JsonErrorCode::InvalidUtf8: return "invalid utf-8";
+        case JsonErrorCode::ExpectedString: return "expected string";
+        case JsonErrorCode::ExpectedColon: return "expected colon";
+        case JsonErrorCode::ExpectedValue: return "expected a value";
+        case JsonErrorCode::ExpectedObjectEnd: return "expected '}'";
+        case JsonErrorCode::ExpectedArrayEnd: return "expected ']'";
+        case JsonErrorCode::DepthExceeded: return "maximum nesting depth exceeded";
+        }
+
+        return "unknown error";
+    }
+};
+
+// Thrown by the parsing functions that don't report errors through a
+// JsonError, with the same details available from GetError().
+class JsonParseError : public std::runtime_error
+{
+    JsonError error;
+public:
+    explicit JsonParseError(const JsonError& error)
+        : std::runtime_error(error.GetMessage()), error(error) {}
+
+    JsonParseError(const JsonError& error, const std::string& message)
+        : std::runtime_error(message), error(error) {}
+
+    const JsonError& GetError() const {
+        return error;
+    }
+};
+
 enum class JsonTokenType
 {
     EndOfFile,
@@ -40,38 +160,43 @@ enum class JsonTokenType
     Integer,
     Float,
     Boolean,
-    Null
+    Null,
+    Error
 };
 
 struct JsonToken
 {
-    typedef std::variant<std::nullptr_t, int64_t, double, bool, char, std::string> DataStorageType;
+    typedef std::variant<std::nullptr_t, int64_t, double, bool, char, std::string, std::string_view> DataStorageType;
 
     DataStorageType data;
     JsonTokenType type = JsonTokenType::EndOfFile;
-    std::string::iterator pos;
+    size_t pos{};
 
     JsonToken(){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, const std::string& value)
+    JsonToken(JsonTokenType type, size_t pos, const std::string& value)
         : data(value), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, std::string&& value)
+    JsonToken(JsonTokenType type, size_t pos, std::string&& value)
         : data(std::move(value)), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, int64_t value)
+    // A string decoded in place, which refers to the lexer's input.
+    JsonToken(JsonTokenType type, size_t pos, std::string_view value)
+        : data(value), type(type), pos(pos){}
+
+    JsonToken(JsonTokenType type, size_t pos, int64_t value)
         : data(value), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, double value)
+    JsonToken(JsonTokenType type, size_t pos, double value)
         : data(value), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, bool value)
+    JsonToken(JsonTokenType type, size_t pos, bool value)
         : data(value), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, char value)
+    JsonToken(JsonTokenType type, size_t pos, char value)
         : data(value), type(type), pos(pos){}
 
-    JsonToken(JsonTokenType type, std::string::iterator pos, std::nullptr_t value)
+    JsonToken(JsonTokenType type, size_t pos, std::nullptr_t value)
         : data(value), type(type), pos(pos){}
 
     int64_t GetInteger() const {
@@ -90,7 +215,11 @@ struct JsonToken
         return std::get<char>(data);
     }
 
-    const std::string& GetString() const {
+    std::string_view GetString() const
+    {
+        if (auto view = std::get_if<std::string_view>(&data))
+            return *view;
+
         return std::get<std::string>(data);
     }
 
@@ -108,1491 +237,8781 @@ struct JsonToken
             { JsonTokenType::Integer, "Integer" },
             { JsonTokenType::Float, "Float" },
             { JsonTokenType::Boolean, "Boolean" },
-            { JsonTokenType::Null, "Null" }
+            { JsonTokenType::Null, "Null" },
+            { JsonTokenType::Error, "Error" }
         };
 
         return typeNames[type];
     }
 };
 
-class JsonLexer
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define JSON_SIMD_SSE2 1
+    #if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+        #define JSON_SIMD_AVX2 1
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define JSON_SIMD_NEON 1
+#endif
+
+#if defined(JSON_SIMD_SSE2)
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#elif defined(JSON_SIMD_NEON)
+    #include <arm_neon.h>
+#endif
+
+#if defined(_WIN32)
+    // The few Win32 functions that JsonMappedFile needs, declared exactly as
+    // the Windows headers declare them, so this header doesn't pull in
+    // <windows.h> and its macros, but can still be included alongside it.
+    extern "C"
+    {
+        struct _SECURITY_ATTRIBUTES;
+
+        __declspec(dllimport) void* __stdcall CreateFileW(const wchar_t* fileName, unsigned long desiredAccess,
+            unsigned long shareMode, _SECURITY_ATTRIBUTES* securityAttributes, unsigned long creationDisposition,
+            unsigned long flagsAndAttributes, void* templateFile);
+
+        __declspec(dllimport) unsigned long __stdcall GetFileSize(void* file, unsigned long* fileSizeHigh);
+        __declspec(dllimport) unsigned long __stdcall GetLastError();
+
+        __declspec(dllimport) void* __stdcall CreateFileMappingW(void* file, _SECURITY_ATTRIBUTES* attributes,
+            unsigned long protect, unsigned long maximumSizeHigh, unsigned long maximumSizeLow, const wchar_t* name);
+
+    #if defined(_WIN64)
+        __declspec(dllimport) void* __stdcall MapViewOfFile(void* fileMappingObject, unsigned long desiredAccess,
+            unsigned long fileOffsetHigh, unsigned long fileOffsetLow, unsigned long long numberOfBytesToMap);
+    #else
+        __declspec(dllimport) void* __stdcall MapViewOfFile(void* fileMappingObject, unsigned long desiredAccess,
+            unsigned long fileOffsetHigh, unsigned long fileOffsetLow, unsigned long numberOfBytesToMap);
+    #endif
+
+        __declspec(dllimport) int __stdcall UnmapViewOfFile(const void* baseAddress);
+        __declspec(dllimport) int __stdcall CloseHandle(void* object);
+    }
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if defined(JSON_SIMD_AVX2) && !defined(_MSC_VER)
+    #define JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define JSON_TARGET_AVX2
+#endif
+
+// Byte-scanning kernels used by JsonLexer. Each exists as a scalar
+// version and as SSE2/AVX2 or NEON versions; the widest one the
+// CPU supports is selected at runtime the first time it's needed.
+class JsonScanner
 {
-    size_t line{};
-    size_t column{};
-    std::string::iterator pos;
-    std::string::iterator next;
-    char32_t value{};
-    std::string chars;
-    int tabLength = 4;
 public:
-
-    bool IsEndOfFile() const {
-        return pos == chars.end();
+    // Returns the first byte in [p, end) that is a '"' or '\\', or a byte >= 0x80
+    // if 'stopAtNonAscii' is set. Returns 'end' if there is none.
+    static const char* FindStringSpecial(const char* p, const char* end, bool stopAtNonAscii) {
+        return GetKernels().findStringSpecial(p, end, stopAtNonAscii);
     }
 
-    char32_t GetValue() const {
-        return value;
+    // Returns the first byte in [p, end) that isn't JSON whitespace, or 'end'.
+    static const char* SkipWhitespace(const char* p, const char* end)
+    {
+        // minified input rarely has whitespace between tokens, so
+        // check the first byte before paying for a kernel call
+        if (p != end && !IsWhitespace(*p))
+            return p;
+
+        return GetKernels().skipWhitespace(p, end);
     }
 
-    size_t GetOffset() const {
-        return pos - chars.begin();
+    static bool IsWhitespace(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
     }
 
-    JsonLexer(const std::string& text)
+    static const char* FindStringSpecialScalar(const char* p, const char* end, bool stopAtNonAscii)
     {
-        chars = text;
+        for (; p != end; ++p)
+        {
+            auto c = (unsigned char)*p;
+            if (c == '\"' || c == '\\' || (c >= 0x80 && stopAtNonAscii))
+                break;
+        }
 
-        pos = chars.begin();
-        next = pos;
-        value = utf8::next(next, chars.end());
-        line = 0;
-        column = 0;
+        return p;
     }
 
-    static std::vector<JsonToken> Tokenize(const std::string& text)
+    static const char* SkipWhitespaceScalar(const char* p, const char* end)
     {
-        std::vector<JsonToken> tokens;
-        JsonLexer lexer(text);
+        while (p != end && IsWhitespace(*p))
+            ++p;
 
-        do {
-            tokens.push_back(lexer.GetNextToken());
-        } while (!lexer.IsEndOfFile());
+        return p;
+    }
 
-        return tokens;
+    // One bit per byte of a 64-byte block, for each class of character
+    // the structural indexer cares about.
+    struct BlockMasks
+    {
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t op; // one of {}[]:,
+        uint64_t whitespace;
+    };
+
+    // Classifies the 64 bytes starting at 'p', which must all be readable.
+    static BlockMasks ClassifyBlock(const char* p) {
+        return GetKernels().classifyBlock(p);
     }
 
-    JsonToken GetNextToken()
+    static BlockMasks ClassifyBlockScalar(const char* p)
     {
-        SkipWhitespace();
+        BlockMasks masks{};
 
-        if (pos == chars.end()) {
-            return JsonToken(JsonTokenType::EndOfFile, pos, (char)EOF);
-        }
-        else if (value == '{') {
-            SkipChar();
-            return JsonToken(JsonTokenType::ObjectStart, pos, '{');
-        }
-        else if (value == '}') {
-            SkipChar();
-            return JsonToken(JsonTokenType::ObjectEnd, pos, '}');
-        }
-        else if (value == '[') {
-            SkipChar();
-            return JsonToken(JsonTokenType::ArrayStart, pos, '[');
-        }
-        else if (value == ']') {
-            SkipChar();
-            return JsonToken(JsonTokenType::ArrayEnd, pos, ']');
-        }
-        else if (value == ':') {
-            SkipChar();
-            return JsonToken(JsonTokenType::Colon, pos, ':');
-        }
-        else if (value == ',') {
-            SkipChar();
-            return JsonToken(JsonTokenType::Comma, pos, ',');
-        }
-        else if (value == '\"') {
-            return GetStringToken();
-        }
-        else if ((value >= '0' && value <= '9') || value == '-' || value == '+') {
-            return GetNumberToken();
-        }
-        else if (value == 't' || value == 'f') {
-            return GetBooleanToken();
-        }
-        else if (value == 'n') {
-            return GetNullToken();
-        }
-        else {
-            throw std::runtime_error(std::string("found unexpected input: ") + (char)value);
+        for (int i = 0; i != 64; ++i)
+        {
+            char c = p[i];
+            uint64_t bit = uint64_t(1) << i;
+
+            if (c == '\"')
+                masks.quote |= bit;
+            else if (c == '\\')
+                masks.backslash |= bit;
+            else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
+                masks.op |= bit;
+            else if (IsWhitespace(c))
+                masks.whitespace |= bit;
         }
-    }
 
-private:
+        return masks;
+    }
 
-    void SkipWhitespace()
+#if defined(JSON_SIMD_SSE2)
+    static const char* FindStringSpecialSSE2(const char* p, const char* end, bool stopAtNonAscii)
     {
-        while (pos != chars.end())
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+
+        for (; end - p >= 16; p += 16)
         {
-            if (value == ' ') // spaces
-            {
-                ++column;
-            }
-            else if (value == '\t')
-            {
-                column += tabLength;
-            }
-            else if (value == '\n') // new line
-            {
-                ++line;
-                column = 0;
-            }
-            else if (value == '\v' || value == '\f' || value == '\r')
-            {
-                // ignore
-            }
-            else
-            {
-                // found non-whitespace character
-                break;
-            }
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
 
-            SkipChar();
+            unsigned mask = (unsigned)_mm_movemask_epi8(special);
+            if (stopAtNonAscii)
+                mask |= (unsigned)_mm_movemask_epi8(v);
+
+            if (mask)
+                return p + std::countr_zero(mask);
         }
-    }
 
-    void SkipChar()
-    {
-        assert(pos != next);
-        pos = next;
-        value = (next != chars.end()) ?
-            utf8::next(next, chars.end()) : 0;
+        return FindStringSpecialScalar(p, end, stopAtNonAscii);
     }
 
-    void SkipChars(ptrdiff_t count)
+    static const char* SkipWhitespaceSSE2(const char* p, const char* end)
     {
-        assert(pos != next);
-        utf8::advance(pos, count, chars.end());
-        next = pos;
-        value = (next != chars.end()) ?
-            utf8::next(next, chars.end()) : 0;
-    }
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i rangeMax = _mm_set1_epi8('\r' - '\t');
 
-    bool IsStartOfNumber(char32_t c) {
-        return (c >= '0' && c <= '9') || c == '-' || c == '+';
-    }
+        for (; end - p >= 16; p += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
 
-    bool IsStartOf(char32_t c) {
-        return (c >= '0' && c <= '9') || c == '-' || c == '+';
+            // '\t'..'\r' are contiguous, so shift them down to 0..4 and do an unsigned range check
+            __m128i shifted = _mm_sub_epi8(v, tab);
+            __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(shifted, rangeMax), shifted);
+            __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), inRange);
+
+            unsigned mask = ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFFu;
+            if (mask)
+                return p + std::countr_zero(mask);
+        }
+
+        return SkipWhitespaceScalar(p, end);
     }
 
-    JsonToken GetStringToken()
+    static BlockMasks ClassifyBlockSSE2(const char* p)
     {
-        assert(value == U'\"');
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i lowerCase = _mm_set1_epi8(0x20);
+        const __m128i openBrace = _mm_set1_epi8('{');
+        const __m128i closeBrace = _mm_set1_epi8('}');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i rangeMax = _mm_set1_epi8('\r' - '\t');
+
+        BlockMasks masks{};
+
+        for (int i = 0; i != 4; ++i)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 16));
+
+            // '[' and ']' differ from '{' and '}' only by bit 0x20
+            __m128i folded = _mm_or_si128(v, lowerCase);
+            __m128i op = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(folded, openBrace), _mm_cmpeq_epi8(folded, closeBrace)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+
+            __m128i shifted = _mm_sub_epi8(v, tab);
+            __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(shifted, rangeMax), shifted);
+            __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), inRange);
+
+            int shift = i * 16;
+            masks.quote |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << shift;
+            masks.backslash |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << shift;
+            masks.op |= (uint64_t)(unsigned)_mm_movemask_epi8(op) << shift;
+            masks.whitespace |= (uint64_t)(unsigned)_mm_movemask_epi8(ws) << shift;
+        }
 
-        auto start = pos;
-        SkipChar();
+        return masks;
+    }
+#endif
 
-        std::string str;
+#if defined(JSON_SIMD_AVX2)
+    JSON_TARGET_AVX2
+    static const char* FindStringSpecialAVX2(const char* p, const char* end, bool stopAtNonAscii)
+    {
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
 
-        while (pos != chars.end())
+        for (; end - p >= 32; p += 32)
         {
-            if (value == U'\"')
-            {
-                SkipChar();
-                return JsonToken(JsonTokenType::String, start, str);
-            }
-            else if (value == U'\\')
-            {
-                SkipChar();
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
 
-                if (pos == chars.end())
-                    throw std::runtime_error("unexpected end of input");
+            unsigned mask = (unsigned)_mm256_movemask_epi8(special);
+            if (stopAtNonAscii)
+                mask |= (unsigned)_mm256_movemask_epi8(v);
 
-                if (value == U'\"') {
-                    SkipChar();
-                    utf8::append(U'\"', std::back_inserter(str));
-                }
-                else if (value == U'\\') {
-                    SkipChar();
-                    utf8::append(U'\\', std::back_inserter(str));
-                }
-                else if (value == U'r') {
-                    SkipChar();
-                    utf8::append(U'\r', std::back_inserter(str));
-                }
-                else if (value == U'n') {
-                    SkipChar();
-                    utf8::append(U'\n', std::back_inserter(str));
-                }
-                else if (value == U't') {
-                    SkipChar();
-                    utf8::append(U'\t', std::back_inserter(str));
-                }
-                else if (value == U'b') {
-                    SkipChar();
-                    utf8::append(U'\b', std::back_inserter(str));
-                }
-                else if (value == U'f') {
-                    SkipChar();
-                    utf8::append(U'\f', std::back_inserter(str));
-                }
-                else if (value == U'u')
-                {
-                    SkipChar();
+            if (mask)
+                return p + std::countr_zero(mask);
+        }
 
-                    if ((chars.end() - pos) < 4)
-                        throw std::runtime_error("unexpected end of input");
+        return FindStringSpecialSSE2(p, end, stopAtNonAscii);
+    }
 
-                    char hex[4];
+    JSON_TARGET_AVX2
+    static const char* SkipWhitespaceAVX2(const char* p, const char* end)
+    {
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i rangeMax = _mm256_set1_epi8('\r' - '\t');
 
-                    for (int i = 0; i < 4; ++i)
-                    {
-                        if (!isxdigit(value))
-                            throw std::runtime_error("invalid unicode escape sequence");
+        for (; end - p >= 32; p += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
 
-                        hex[i] = (char)value;
-                        SkipChar();
-                    }
+            __m256i shifted = _mm256_sub_epi8(v, tab);
+            __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, rangeMax), shifted);
+            __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), inRange);
 
-                    char32_t charValue = (char32_t)std::strtoul(hex, nullptr, 16);
-                    utf8::append(charValue, std::back_inserter(str));
-                }
-                else
-                {
-                    utf8::append(value, std::back_inserter(str));
-                    SkipChar();
-                }
-            }
-            else
-            {
-                utf8::append(value, std::back_inserter(str));
-                SkipChar();
-            }
+            unsigned mask = ~(unsigned)_mm256_movemask_epi8(ws);
+            if (mask)
+                return p + std::countr_zero(mask);
         }
 
-        assert(pos == chars.end());
-        throw std::runtime_error("unexpected end of input");
+        return SkipWhitespaceSSE2(p, end);
     }
 
-    JsonToken GetNumberToken()
+    JSON_TARGET_AVX2
+    static BlockMasks ClassifyBlockAVX2(const char* p)
     {
-        auto start = pos;
-        auto beg = chars.data() + (pos - chars.begin());
-        auto end = chars.data() + chars.size();
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i colon = _mm256_set1_epi8(':');
+        const __m256i comma = _mm256_set1_epi8(',');
+        const __m256i lowerCase = _mm256_set1_epi8(0x20);
+        const __m256i openBrace = _mm256_set1_epi8('{');
+        const __m256i closeBrace = _mm256_set1_epi8('}');
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i rangeMax = _mm256_set1_epi8('\r' - '\t');
+
+        BlockMasks masks{};
+
+        for (int i = 0; i != 2; ++i)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 32));
+
+            __m256i folded = _mm256_or_si256(v, lowerCase);
+            __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, openBrace), _mm256_cmpeq_epi8(folded, closeBrace)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+
+            __m256i shifted = _mm256_sub_epi8(v, tab);
+            __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, rangeMax), shifted);
+            __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), inRange);
+
+            int shift = i * 32;
+            masks.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << shift;
+            masks.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << shift;
+            masks.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+            masks.whitespace |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << shift;
+        }
 
-        double value;
-        std::from_chars_result ret = std::from_chars(beg, end, value);
-        if(ret.ec != std::errc())
-            throw std::runtime_error("invalid number");
+        return masks;
+    }
+#endif
 
-        auto len = ret.ptr - &start[0];
-        std::string_view number(beg, beg + len);
+#if defined(JSON_SIMD_NEON)
+    // NEON has no movemask, so narrow each byte of the compare result
+    // to a nibble and find the first set nibble in the 64-bit result.
+    static uint64_t NibbleMask(uint8x16_t cmp) {
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+    }
 
-        SkipChars(len);
+    static const char* FindStringSpecialNEON(const char* p, const char* end, bool stopAtNonAscii)
+    {
+        const uint8x16_t quote = vdupq_n_u8('\"');
+        const uint8x16_t backslash = vdupq_n_u8('\\');
+        const uint8x16_t highBit = vdupq_n_u8(stopAtNonAscii ? 0x80 : 0x00);
 
-        if(number.find('.') != std::string_view::npos)
-        {
-            return JsonToken(JsonTokenType::Float, start, value);
-        }
-        else
+        for (; end - p >= 16; p += 16)
         {
-            int64_t intValue;
-            ret = std::from_chars(beg, end, intValue);
-            if(ret.ec != std::errc())
-                throw std::runtime_error("invalid number");
+            uint8x16_t v = vld1q_u8((const uint8_t*)p);
+            uint8x16_t special = vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash));
+            special = vorrq_u8(special, vtstq_u8(v, highBit));
 
-            return JsonToken(JsonTokenType::Integer, start, intValue);
+            uint64_t mask = NibbleMask(special);
+            if (mask)
+                return p + (std::countr_zero(mask) >> 2);
         }
+
+        return FindStringSpecialScalar(p, end, stopAtNonAscii);
     }
 
-    JsonToken GetBooleanToken()
+    static const char* SkipWhitespaceNEON(const char* p, const char* end)
     {
-        auto start = pos;
-        auto p = &*pos;
+        const uint8x16_t space = vdupq_n_u8(' ');
+        const uint8x16_t tab = vdupq_n_u8('\t');
+        const uint8x16_t rangeMax = vdupq_n_u8('\r' - '\t');
 
-        bool val;
+        for (; end - p >= 16; p += 16)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t*)p);
+            uint8x16_t ws = vorrq_u8(vceqq_u8(v, space), vcleq_u8(vsubq_u8(v, tab), rangeMax));
 
-        if (std::equal(p, p + 4, "true")) {
-            val = true;
-            SkipChars(4);
-        }
-        else if (std::equal(p, p + 5, "false")) {
-            val = false;
-            SkipChars(5);
-        }
-        else {
-            throw std::runtime_error("expected boolean literal");
+            uint64_t mask = ~NibbleMask(ws);
+            if (mask)
+                return p + (std::countr_zero(mask) >> 2);
         }
 
-        return JsonToken(JsonTokenType::Boolean, start, val);
+        return SkipWhitespaceScalar(p, end);
     }
 
-    JsonToken GetNullToken()
+    // Packs four 16-byte compare results into one bit per byte.
+    static uint64_t BitMask(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3)
     {
-        auto start = pos;
-        auto p = &*pos;
-
-        if (std::equal(p, p + 4, "null"))
-            SkipChars(4);
-        else
-            throw std::runtime_error("expected null literal");
+        const uint8x16_t weights = {
+            0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+            0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+        };
 
-        return JsonToken(JsonTokenType::Null, start, nullptr);
+        uint8x16_t sum0 = vpaddq_u8(vandq_u8(m0, weights), vandq_u8(m1, weights));
+        uint8x16_t sum1 = vpaddq_u8(vandq_u8(m2, weights), vandq_u8(m3, weights));
+        sum0 = vpaddq_u8(sum0, sum1);
+        sum0 = vpaddq_u8(sum0, sum0);
+        return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
     }
-};
 
-class Json;
+    static BlockMasks ClassifyBlockNEON(const char* p)
+    {
+        const uint8x16_t quote = vdupq_n_u8('\"');
+        const uint8x16_t backslash = vdupq_n_u8('\\');
+        const uint8x16_t colon = vdupq_n_u8(':');
+        const uint8x16_t comma = vdupq_n_u8(',');
+        const uint8x16_t lowerCase = vdupq_n_u8(0x20);
+        const uint8x16_t openBrace = vdupq_n_u8('{');
+        const uint8x16_t closeBrace = vdupq_n_u8('}');
+        const uint8x16_t space = vdupq_n_u8(' ');
+        const uint8x16_t tab = vdupq_n_u8('\t');
+        const uint8x16_t rangeMax = vdupq_n_u8('\r' - '\t');
+
+        uint8x16_t q[4], b[4], o[4], w[4];
+
+        for (int i = 0; i != 4; ++i)
+        {
+            uint8x16_t v = vld1q_u8((const uint8_t*)(p + i * 16));
+            uint8x16_t folded = vorrq_u8(v, lowerCase);
+
+            q[i] = vceqq_u8(v, quote);
+            b[i] = vceqq_u8(v, backslash);
+            o[i] = vorrq_u8(
+                vorrq_u8(vceqq_u8(folded, openBrace), vceqq_u8(folded, closeBrace)),
+                vorrq_u8(vceqq_u8(v, colon), vceqq_u8(v, comma)));
+            w[i] = vorrq_u8(vceqq_u8(v, space), vcleq_u8(vsubq_u8(v, tab), rangeMax));
+        }
 
-class JsonParser
-{
-    JsonLexer lexer;
-    JsonToken token;
-public:
-    JsonParser(const std::string& text);
-    Json Parse();
+        BlockMasks masks;
+        masks.quote = BitMask(q[0], q[1], q[2], q[3]);
+        masks.backslash = BitMask(b[0], b[1], b[2], b[3]);
+        masks.op = BitMask(o[0], o[1], o[2], o[3]);
+        masks.whitespace = BitMask(w[0], w[1], w[2], w[3]);
+        return masks;
+    }
+#endif
 
 private:
-    bool NextToken(bool thrownOnEOF = true);
-    Json ParseValue();
-    Json ParseString();
-    Json ParseInteger();
-    Json ParseFloat();
-    Json ParseBoolean();
-    Json ParseNull();
-    Json ParseObject();
-    Json ParseArray();
-};
+    struct Kernels
+    {
+        const char* (*findStringSpecial)(const char*, const char*, bool);
+        const char* (*skipWhitespace)(const char*, const char*);
+        BlockMasks (*classifyBlock)(const char*);
+    };
 
-class JsonPrinter
-{
-    int indentWidth;
-    bool pretty;
+    static bool HasAVX2()
+    {
+#if defined(JSON_SIMD_AVX2) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
 
-    void Indent(std::ostream& stream, int indent);
-    void WriteEscaped(std::ostream& stream, const std::string& val);
-public:
+        // AVX2 also needs the OS to save the upper halves of the ymm registers
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+            return false;
 
-    JsonPrinter(int indentWidth);
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif defined(JSON_SIMD_AVX2)
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
 
-    std::string ToString(const Json& val);
-    void ToStream(std::ostream& stream, int indent, const Json& val);
-};
+    static Kernels SelectKernels()
+    {
+#if defined(JSON_SIMD_AVX2)
+        if (HasAVX2())
+            return { &FindStringSpecialAVX2, &SkipWhitespaceAVX2, &ClassifyBlockAVX2 };
+#endif
+#if defined(JSON_SIMD_SSE2)
+        return { &FindStringSpecialSSE2, &SkipWhitespaceSSE2, &ClassifyBlockSSE2 };
+#elif defined(JSON_SIMD_NEON)
+        return { &FindStringSpecialNEON, &SkipWhitespaceNEON, &ClassifyBlockNEON };
+#else
+        return { &FindStringSpecialScalar, &SkipWhitespaceScalar, &ClassifyBlockScalar };
+#endif
+    }
 
-template <typename T>
-class has_to_string
-{
-    template <typename C, typename = decltype(to_string(std::declval<std::string&>(), std::declval<const T>()))>
-    static std::true_type test(int);
-
-    template <typename C>
-    static std::false_type test(...);
-
-public:
-    static constexpr bool value = decltype(test<T>(0))::value;
+    static const Kernels& GetKernels()
+    {
+        static const Kernels kernels = SelectKernels();
+        return kernels;
+    }
 };
 
-template <typename T>
-class has_from_string
+// Stage 1 of the indexed parse engine. Records the starting offset of every
+// token in a document by classifying it 64 bytes at a time, tracking which
+// bytes are inside strings with bit arithmetic instead of branching per byte.
+class JsonStructuralIndexer
 {
-    template <typename C, typename = decltype(from_string(std::declval<const std::string>(), std::declval<T&>()))>
-    static std::true_type test(int);
+public:
+    static void Build(std::string_view text, std::vector<uint32_t>& index)
+    {
+        assert(text.size() <= UINT32_MAX);
 
-    template <typename C>
-    static std::false_type test(...);
+        index.clear();
+        index.reserve(text.size() / 4);
 
-public:
-    static constexpr bool value = decltype(test<T>(0))::value;
-};
+        State state{};
+        const char* data = text.data();
+        size_t size = text.size();
+        size_t offset = 0;
 
-template<class T>
-inline constexpr bool has_from_string_v = has_from_string<T>::value;
+        for (; size - offset >= 64; offset += 64)
+            AppendBlock(state, JsonScanner::ClassifyBlock(data + offset), (uint32_t)offset, index);
 
-template<class T>
-inline constexpr bool has_to_string_v = has_to_string<T>::value;
+        if (offset != size)
+        {
+            // pad the last partial block with whitespace, which never produces an index entry
+            char block[64];
+            std::memset(block, ' ', sizeof(block));
+            std::memcpy(block, data + offset, size - offset);
+            AppendBlock(state, JsonScanner::ClassifyBlock(block), (uint32_t)offset, index);
+        }
+    }
 
-template<class>
-inline constexpr bool is_initializer_list = false;
+private:
+    struct State
+    {
+        uint64_t prevEndsOddBackslash;
+        uint64_t prevInString;
+        uint64_t prevScalar;
+    };
 
-template<class T>
-inline constexpr bool is_initializer_list<std::initializer_list<T>> = true;
+    // Returns a mask of the characters preceded by an odd-length run of backslashes.
+    static uint64_t FindEscaped(uint64_t backslash, uint64_t& prevEndsOddBackslash)
+    {
+        const uint64_t evenBits = 0x5555555555555555ULL;
+        const uint64_t oddBits = ~evenBits;
 
-enum class JsonDataType
-{
-    Null,
-    Object,
-    Array,
-    String,
-    Integer,
-    Float,
-    Boolean
-};
+        uint64_t startEdges = backslash & ~(backslash << 1);
 
-class Json
-{
-public:
-    using NullType = std::nullptr_t;
-    using ObjectType = std::unordered_map<std::string, Json>;
-    using ArrayType = std::vector<Json>;
-    using StringType = std::string;
-    using IntegerType = int64_t;
-    using FloatType = double;
-    using BooleanType = bool;
+        // a run carried over from the previous block with odd length flips the parity of bit 0
+        uint64_t evenStartMask = evenBits ^ prevEndsOddBackslash;
+        uint64_t evenStarts = startEdges & evenStartMask;
+        uint64_t oddStarts = startEdges & ~evenStartMask;
 
-    friend class JsonParser;
+        uint64_t evenCarries = backslash + evenStarts;
+        uint64_t oddCarries = backslash + oddStarts;
+        bool endsOddBackslash = oddCarries < backslash;
 
-private:
-    typedef std::variant<NullType, ObjectType, ArrayType, StringType, IntegerType, FloatType, BooleanType> DataStorageType;
-    DataStorageType data;
+        oddCarries |= prevEndsOddBackslash;
+        prevEndsOddBackslash = endsOddBackslash ? 1 : 0;
 
-public:
-    Json(nullptr_t = nullptr)
-        : data(nullptr) {}
+        uint64_t evenCarryEnds = evenCarries & ~backslash;
+        uint64_t oddCarryEnds = oddCarries & ~backslash;
+        return (evenCarryEnds & oddBits) | (oddCarryEnds & evenBits);
+    }
 
-    Json(const ObjectType& obj)
-        : data(obj) {}
+    // Bit i of the result is the XOR of bits 0..i of 'x'.
+    static uint64_t PrefixXor(uint64_t x)
+    {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return x;
+    }
+
+    static void AppendBlock(State& state, const JsonScanner::BlockMasks& masks, uint32_t base, std::vector<uint32_t>& index)
+    {
+        uint64_t escaped = FindEscaped(masks.backslash, state.prevEndsOddBackslash);
+        uint64_t quotes = masks.quote & ~escaped;
 
-    Json(ObjectType&& obj)
-        : data(std::move(obj)) {}
+        // covers each opening quote and the string contents, but not the closing quote
+        uint64_t inString = PrefixXor(quotes) ^ state.prevInString;
+        state.prevInString = (uint64_t)((int64_t)inString >> 63);
 
-    Json(const ArrayType& arr)
-        : data(arr) {}
+        // anything else outside a string is part of a number, a literal, or invalid input
+        uint64_t scalar = ~(masks.op | masks.whitespace | quotes | inString);
+        uint64_t scalarStarts = scalar & ~((scalar << 1) | state.prevScalar);
+        state.prevScalar = scalar >> 63;
 
-    Json(ArrayType&& arr)
-        : data(std::move(arr)) {}
+        uint64_t structurals = (masks.op & ~inString) | (quotes & inString) | scalarStarts;
 
-    Json(const StringType& str)
-        : data(str) {}
+        while (structurals)
+        {
+            index.push_back(base + (uint32_t)std::countr_zero(structurals));
+            structurals &= structurals - 1;
+        }
+    }
+};
 
-    Json(StringType&& str)
-        : data(std::move(str)) {}
+enum class JsonParseEngine
+{
+    // Pulls tokens from JsonLexer one at a time as the parser needs them.
+    Streaming,
 
-    template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
-    Json(const T& integer)
-        : data((IntegerType)integer) {}
+    // Indexes the start of every token with JsonStructuralIndexer first, then
+    // lexes each value directly from its index entry. Inputs of 4 GB or
+    // more fall back to the streaming engine.
+    Indexed
+};
 
-    template<class T> requires std::is_floating_point_v<T>
-    Json(T floating)
-        : data((FloatType)floating) {}
+// Forwards to another resource and counts what's allocated through it.
+// Parsing with one, or with an arena on top of one, fills in the
+// allocation counts of JsonParseStats. Like any resource that parsed
+// values are allocated from, it must outlive them.
+class JsonCountingResource : public std::pmr::memory_resource
+{
+    std::pmr::memory_resource* upstream;
+    std::atomic<size_t> allocations{ 0 };
+    std::atomic<size_t> allocatedBytes{ 0 };
 
-    template<class T> requires std::is_same_v<T, BooleanType>
-    Json(T boolean)
-        : data(boolean) {}
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        void* p = upstream->allocate(bytes, alignment);
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        return p;
+    }
 
-    template<class T, class S = std::decay_t<T>> requires (
-        !std::is_same_v<S, Json> &&
-        !std::is_integral_v<S> &&
-        !std::is_same_v<S, BooleanType> &&
-        !std::is_floating_point_v<S>)
-    Json(T&& val) : Json() {
-        to_json(*this, std::forward<T>(val));
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        upstream->deallocate(p, bytes, alignment);
     }
 
-    static Json Object() {
-        Json ret;
-        ret.data.emplace<ObjectType>();
-        return ret;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
     }
 
-    static Json Array() {
-        Json ret;
-        ret.data.emplace<ArrayType>();
-        return ret;
+public:
+    explicit JsonCountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream(upstream) {}
+
+    size_t GetAllocationCount() const {
+        return allocations.load(std::memory_order_relaxed);
     }
 
-    static Json String() {
-        Json ret;
-        ret.data.emplace<StringType>();
-        return ret;
+    size_t GetAllocatedBytes() const {
+        return allocatedBytes.load(std::memory_order_relaxed);
     }
 
-    template<class T> requires (!std::is_same_v<std::decay_t<T>, Json>)
-    Json& operator=(T&& val) {
-        to_json(*this, std::forward<T>(val));
-        return *this;
+    void ResetCounts()
+    {
+        allocations = 0;
+        allocatedBytes = 0;
     }
+};
 
-    using StringValueType = StringType::value_type;
+// What JsonParser did, for monitoring. Point JsonParseOptions::stats at
+// one to collect them. The counts add up over every parse that uses the
+// same stats, and maxDepth is the deepest of them, so reset with
+// 'stats = {}' to start over. Without stats, parsing only pays for a
+// null test at each token.
+struct JsonParseStats
+{
+    // input bytes, counted once per parse
+    size_t bytes = 0;
 
-    template<class T> requires (
-        !std::is_same_v<T, Json>
-        && !std::is_void_v<T>
-        && !std::is_pointer_v<T>
-        && !std::is_same_v<T, std::nullptr_t>
-        && !std::is_same_v<T, StringValueType>
-        && !is_initializer_list<T>
-        && !std::is_same_v<T, std::string_view>
-        )
-    operator T() const {
-        return Get<T>();
-    }
+    // tokens read, by JsonTokenType
+    std::array<size_t, (size_t)JsonTokenType::Error + 1> tokens{};
 
-    static Json Parse(const std::string& text) {
-        JsonParser parser(text);
-        return parser.Parse();
+    size_t maxDepth = 0;
+
+    // string values and keys decoded, and the escape sequences in them
+    size_t strings = 0;
+    size_t escapes = 0;
+
+    // allocations made for the parsed value, when it's allocated from a
+    // JsonCountingResource, or from a monotonic_buffer_resource on top of
+    // one, as JsonDocument does. With an arena, this counts the blocks the
+    // arena takes, not each string and container in it.
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+
+    // time spent building the structural index (for the indexed engine
+    // and for parallel parsing) and parsing
+    std::chrono::nanoseconds indexTime{};
+    std::chrono::nanoseconds parseTime{};
+
+    size_t GetTokenCount(JsonTokenType type) const {
+        return tokens[(size_t)type];
     }
+};
 
-    std::string Dump(int indent = -1)
+// Adds the time until it's destroyed to 'total', unless that's null.
+class JsonStatsTimer
+{
+    std::chrono::nanoseconds* total;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit JsonStatsTimer(std::chrono::nanoseconds* total)
+        : total(total)
     {
-        JsonPrinter printer(indent);
-        return printer.ToString(*this);
+        if (total)
+            start = std::chrono::steady_clock::now();
     }
 
-    JsonDataType GetType() const
+    ~JsonStatsTimer()
     {
-        std::array<JsonDataType, 7> types {
-            JsonDataType::Null,
-            JsonDataType::Object,
-            JsonDataType::Array,
-            JsonDataType::String,
-            JsonDataType::Integer,
-            JsonDataType::Float,
-            JsonDataType::Boolean
-        };
-        
-        return types[data.index()];
+        if (total)
+            *total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
     }
 
-    bool IsNull() const {
-        return std::holds_alternative<NullType>(data);
-    }
+    JsonStatsTimer(const JsonStatsTimer&) = delete;
+    JsonStatsTimer& operator=(const JsonStatsTimer&) = delete;
+};
 
-    bool IsObject() const {
-        return std::holds_alternative<ObjectType>(data);
-    }
+class JsonKeyTable;
 
-    bool IsArray() const {
-        return std::holds_alternative<ArrayType>(data);
-    }
+struct JsonParseOptions
+{
+    // When enabled, multi-byte UTF-8 sequences are decoded and validated,
+    // and malformed input is rejected. When disabled, bytes >= 0x80 are
+    // passed through to string values untouched.
+    bool validateUtf8 = true;
+
+    JsonParseEngine engine = JsonParseEngine::Streaming;
+
+    // Memory resource that the parsed strings and containers are allocated
+    // from, such as an arena (see JsonDocument). The parsed value refers to
+    // this memory, so the resource must outlive it. Null selects the
+    // default resource.
+    std::pmr::memory_resource* resource = nullptr;
+
+    // Number of threads that Json::Parse uses for a top-level array. When
+    // this isn't 1, the array's element boundaries are found with
+    // JsonStructuralIndexer and the elements are parsed concurrently. Zero
+    // selects std::thread::hardware_concurrency(). Allocations then come
+    // from several threads at once, so 'resource' must be thread-safe, as
+    // the default resource is. JsonDocument always parses on one thread.
+    unsigned threadCount = 1;
+
+    // When set, object keys too long to be stored inline are interned in
+    // this table, and every copy of a key in the parsed value refers to the
+    // same storage instead of allocating its own. The table must outlive the
+    // parsed value. Tables aren't thread-safe, so the elements of an array
+    // that's parsed on several threads don't use it.
+    JsonKeyTable* keyTable = nullptr;
+
+    // Maximum nesting depth of arrays and objects. Deeper input is rejected
+    // with an error, which also bounds the recursion of code that walks the
+    // parsed value, such as its destructor.
+    size_t maxDepth = 1024;
+
+    // When set, the parser adds what it does to these (see JsonParseStats).
+    // Stats aren't thread-safe, so don't share them between parsers running
+    // at the same time. A single parse on several threads is fine.
+    JsonParseStats* stats = nullptr;
+};
 
-    bool IsString() const {
-        return std::holds_alternative<StringType>(data);
-    }
+// Runs work() on 'threadCount' threads, this one included, and waits for
+// them to finish. If the system can't start that many threads, the work is
+// shared by the ones that did start.
+template<class Func>
+inline void JsonRunOnThreads(unsigned threadCount, Func&& work)
+{
+    std::vector<std::thread> threads;
 
-    bool IsInteger() const {
-        return std::holds_alternative<IntegerType>(data);
-    }
+    // reserved up front, so that only starting a thread can fail below,
+    // and the threads that did start are never left unjoined
+    threads.reserve(threadCount > 0 ? threadCount - 1 : 0);
 
-    bool IsFloat() const {
-        return std::holds_alternative<FloatType>(data);
+    try {
+        for (unsigned i = 1; i < threadCount; ++i)
+            threads.emplace_back(work);
+    }
+    catch (...) {
+        // std::system_error, or std::bad_alloc for the thread's state
     }
 
-    bool IsBoolean() const {
-        return std::holds_alternative<BooleanType>(data);
+    try {
+        work();
+    }
+    catch (...)
+    {
+        for (auto& thread : threads)
+            thread.join();
+        throw;
     }
 
-    Json& GetAt(size_t index) {
-        return GetArray().at(index);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Read-only memory mapping of a whole file, used to parse files in place
+// without reading them into a buffer first. The pages are only loaded as
+// they're touched, and the OS is told that they'll be read sequentially.
+// Anything that refers to GetText() without copying it, like JsonLazyValue
+// or a string view, must not outlive the mapping.
+class JsonMappedFile
+{
+    const char* data{};
+    size_t size{};
+
+#if defined(_WIN32)
+    // values of the Win32 constants used, since <windows.h> isn't included
+    static constexpr unsigned long GenericRead = 0x80000000;
+    static constexpr unsigned long FileShareRead = 0x1;
+    static constexpr unsigned long OpenExisting = 3;
+    static constexpr unsigned long FileAttributeNormal = 0x80;
+    static constexpr unsigned long FileFlagSequentialScan = 0x08000000;
+    static constexpr unsigned long PageReadOnly = 0x02;
+    static constexpr unsigned long FileMapRead = 0x4;
+    static constexpr unsigned long InvalidFileSize = 0xFFFFFFFF;
+#endif
+
+    void Close();
+public:
+    JsonMappedFile() = default;
+    explicit JsonMappedFile(const std::filesystem::path& path);
+
+    JsonMappedFile(JsonMappedFile&& other) noexcept
+        : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)) {}
+
+    JsonMappedFile& operator=(JsonMappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            data = std::exchange(other.data, nullptr);
+            size = std::exchange(other.size, 0);
+        }
+
+        return *this;
     }
 
-    const Json& GetAt(size_t index) const {
-        return GetArray().at(index);
+    JsonMappedFile(const JsonMappedFile&) = delete;
+    JsonMappedFile& operator=(const JsonMappedFile&) = delete;
+
+    ~JsonMappedFile() {
+        Close();
     }
 
-    Json& GetAt(const ObjectType::key_type& key) {
-        return GetObject().at(key);
+    std::string_view GetText() const {
+        return std::string_view(data, size);
     }
 
-    const Json& GetAt(const ObjectType::key_type& key) const {
-        return GetObject().at(key);
+    size_t GetSize() const {
+        return size;
     }
-    
-    Json& operator[](size_t index)
-    {
-        if (IsNull())
-            data.emplace<ArrayType>();
+};
 
-        if (index >= GetArray().size())
-            GetArray().resize(index + 1);
+#if defined(_WIN32)
 
-        return GetArray()[index];
+inline JsonMappedFile::JsonMappedFile(const std::filesystem::path& path)
+{
+    void* file = CreateFileW(path.c_str(), GenericRead, FileShareRead, nullptr,
+        OpenExisting, FileAttributeNormal | FileFlagSequentialScan, nullptr);
+
+    // INVALID_HANDLE_VALUE
+    if (file == (void*)(intptr_t)-1)
+        throw std::runtime_error("failed to open file");
+
+    unsigned long sizeHigh = 0;
+    unsigned long sizeLow = GetFileSize(file, &sizeHigh);
+    uint64_t fileSize = ((uint64_t)sizeHigh << 32) | sizeLow;
+
+    if ((sizeLow == InvalidFileSize && GetLastError() != 0) || fileSize > SIZE_MAX)
+    {
+        CloseHandle(file);
+        throw std::runtime_error("failed to map file");
     }
 
-    const Json& operator[](size_t index) const {
-        return GetArray().at(index);
+    // empty files can't be mapped, and don't need to be
+    if (fileSize == 0)
+    {
+        CloseHandle(file);
+        return;
     }
 
-    Json& operator[](const ObjectType::key_type& key)
+    // the view keeps the file and mapping open after their handles are closed
+    void* mapping = CreateFileMappingW(file, nullptr, PageReadOnly, 0, 0, nullptr);
+    CloseHandle(file);
+
+    if (!mapping)
+        throw std::runtime_error("failed to map file");
+
+    void* view = MapViewOfFile(mapping, FileMapRead, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (!view)
+        throw std::runtime_error("failed to map file");
+
+    data = (const char*)view;
+    size = (size_t)fileSize;
+}
+
+inline void JsonMappedFile::Close()
+{
+    if (data)
+        UnmapViewOfFile(data);
+
+    data = nullptr;
+    size = 0;
+}
+
+#else
+
+inline JsonMappedFile::JsonMappedFile(const std::filesystem::path& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("failed to open file");
+
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || (uint64_t)info.st_size > SIZE_MAX)
     {
-        if (IsNull())
-            data.emplace<ObjectType>();
+        ::close(fd);
+        throw std::runtime_error("failed to map file");
+    }
 
-        return GetObject()[key];
+    // empty files can't be mapped, and don't need to be
+    if (info.st_size == 0)
+    {
+        ::close(fd);
+        return;
     }
 
-    Json& operator[](const char* key)
+    // the mapping keeps the file open after the descriptor is closed
+    void* view = ::mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+        throw std::runtime_error("failed to map file");
+
+    ::madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    data = (const char*)view;
+    size = (size_t)info.st_size;
+}
+
+inline void JsonMappedFile::Close()
+{
+    if (data)
+        ::munmap((void*)data, size);
+
+    data = nullptr;
+    size = 0;
+}
+
+#endif
+
+class JsonLexer
+{
+    // Stands for a malformed UTF-8 sequence, which is never valid input.
+    static constexpr char32_t InvalidChar = 0xFFFFFFFF;
+
+    JsonParseOptions options;
+    const char* pos{};
+    const char* next{};
+    const char* end{};
+    char32_t value{};
+    std::string_view chars;
+    std::string scratch;
+    char* inSitu{};
+    JsonError error;
+    bool throwErrors = true;
+
+    // Where strings are decoded to when lexing in place. A string's decoded
+    // form is never longer than its escaped form, so writing over the input
+    // from the start of the string never overtakes the read position.
+    struct InSituString
     {
-        if (IsNull())
-            data.emplace<ObjectType>();
+        using value_type = char;
 
-        return GetObject()[key];
-    }
+        char* first;
+        char* last;
 
-    const Json& operator[](const ObjectType::key_type& key) const {
-        return GetObject().at(key);
-    }
+        void append(const char* begin, const char* end)
+        {
+            if (begin != last)
+                std::memmove(last, begin, end - begin);
 
-    const Json& operator[](const char* key) const {
-        return GetObject().at(key);
-    }
-    
-    ObjectType& GetObject() {
-        return std::get<ObjectType>(data);
-    }
+            last += end - begin;
+        }
 
-    const ObjectType& GetObject() const {
-        return std::get<ObjectType>(data);
-    }
+        void push_back(char c) {
+            *last++ = c;
+        }
 
-    ArrayType& GetArray() {
-        return std::get<ArrayType>(data);
-    }
+        std::string_view view() const {
+            return std::string_view(first, last - first);
+        }
+    };
+public:
 
-    const ArrayType& GetArray() const {
-        return std::get<ArrayType>(data);
+    bool IsEndOfFile() const {
+        return pos == end;
     }
 
-    StringType& GetString() {
-        return std::get<StringType>(data);
+    char32_t GetValue() const {
+        return value;
     }
 
-    const StringType& GetString() const {
-        return std::get<StringType>(data);
+    size_t GetOffset() const {
+        return pos - chars.data();
     }
 
-    IntegerType& GetInteger() {
-        return std::get<IntegerType>(data);
+    // The lexer reads directly from the caller's buffer, which must
+    // remain valid and unmodified for as long as the lexer is in use.
+    JsonLexer(std::string_view text, const JsonParseOptions& options = {})
+        : options(options)
+    {
+        Reset(text);
     }
 
-    const IntegerType& GetInteger() const {
-        return std::get<IntegerType>(data);
+    // Starts over on new input, keeping the scratch space for strings.
+    void Reset(std::string_view text)
+    {
+        chars = text;
+        pos = chars.data();
+        next = pos;
+        end = chars.data() + chars.size();
+        value = ReadChar();
+        inSitu = nullptr;
+        error = JsonError();
     }
 
-    FloatType& GetFloat() {
-        return std::get<FloatType>(data);
+    void Reset(std::string_view text, const JsonParseOptions& options)
+    {
+        this->options = options;
+        Reset(text);
     }
 
-    const FloatType& GetFloat() const {
-        return std::get<FloatType>(data);
+    // Starts over on input that may be overwritten. Strings are decoded into
+    // 'text' itself, and string tokens refer to it instead of owning a copy.
+    void ResetInSitu(char* text, size_t length)
+    {
+        Reset(std::string_view(text, length));
+        inSitu = text;
     }
 
-    BooleanType& GetBoolean() {
-        return std::get<BooleanType>(data);
+    // When disabled, malformed input produces a token of type Error instead
+    // of throwing a JsonParseError, and GetError() says what was wrong.
+    void SetThrowErrors(bool enable) {
+        throwErrors = enable;
     }
 
-    const BooleanType& GetBoolean() const {
-        return std::get<BooleanType>(data);
+    const JsonError& GetError() const {
+        return error;
     }
 
-    template<class T>
-    T Get() const
+    // Takes back the string of a token that's no longer needed, so that
+    // the next string token can reuse its capacity.
+    void Recycle(JsonToken& token)
     {
-        T val;
-        from_json(*this, val);
-        return val;
+        if (auto str = std::get_if<std::string>(&token.data))
+            scratch = std::move(*str);
     }
 
-    template<class T>
-    T Get(T defaultValue) const
+    JsonLexer(const char* text, size_t length, const JsonParseOptions& options = {})
+        : JsonLexer(std::string_view(text, length), options) {}
+
+    static std::vector<JsonToken> Tokenize(std::string_view text, const JsonParseOptions& options = {})
     {
-        T val;
-        
-        if (!IsNull())
-            from_json(*this, val);
-        else
-            val = defaultValue;
+        std::vector<JsonToken> tokens;
+        JsonLexer lexer(text, options);
 
-        return val;
+        do {
+            tokens.push_back(lexer.GetNextToken());
+        } while (!lexer.IsEndOfFile());
+
+        return tokens;
     }
 
-    template<>
-    Json Get<Json>() const {
-        return *this;
+    // Lexes the token starting exactly at 'offset'.
+    JsonToken GetTokenAt(size_t offset)
+    {
+        SkipTo(chars.data() + offset);
+        return GetNextToken();
     }
 
-    template<class T>
-    T GetValue(const ObjectType::key_type& key, T defaultValue) const
+    // Skips whitespace after the last token and returns true if the next token starts at 'offset'.
+    bool IsNextTokenAt(size_t offset)
+    {
+        SkipWhitespace();
+        return GetOffset() == offset;
+    }
+
+    JsonToken GetNextToken()
+    {
+        SkipWhitespace();
+
+        if (pos == end) {
+            return JsonToken(JsonTokenType::EndOfFile, GetOffset(), (char)EOF);
+        }
+        else if (value == '{') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::ObjectStart, start, '{');
+        }
+        else if (value == '}') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::ObjectEnd, start, '}');
+        }
+        else if (value == '[') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::ArrayStart, start, '[');
+        }
+        else if (value == ']') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::ArrayEnd, start, ']');
+        }
+        else if (value == ':') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::Colon, start, ':');
+        }
+        else if (value == ',') {
+            auto start = GetOffset();
+            SkipChar();
+            return JsonToken(JsonTokenType::Comma, start, ',');
+        }
+        else if (value == '\"') {
+            return GetStringToken();
+        }
+        else if ((value >= '0' && value <= '9') || value == '-' || value == '+') {
+            return GetNumberToken();
+        }
+        else if (value == 't' || value == 'f') {
+            return GetBooleanToken();
+        }
+        else if (value == 'n') {
+            return GetNullToken();
+        }
+        else if (value == InvalidChar) {
+            return Fail(JsonErrorCode::InvalidUtf8);
+        }
+        else {
+            return Fail(JsonErrorCode::UnexpectedInput);
+        }
+    }
+
+private:
+
+    JsonToken Fail(JsonErrorCode code)
+    {
+        error = JsonError::At(code, chars, GetOffset());
+
+        if (throwErrors)
+        {
+            if (code == JsonErrorCode::UnexpectedInput)
+                throw JsonParseError(error, std::string("found unexpected input: ") + (char)value);
+
+            throw JsonParseError(error);
+        }
+
+        return JsonToken(JsonTokenType::Error, error.offset, nullptr);
+    }
+
+    void SkipWhitespace()
+    {
+        auto stop = JsonScanner::SkipWhitespace(pos, end);
+        if (stop != pos)
+            SkipTo(stop);
+    }
+
+    // Reads the character at 'next' and advances 'next' past it. Everything
+    // JSON treats as structural is ASCII, so only bytes >= 0x80 pay for
+    // UTF-8 decoding, and only when validation is enabled.
+    char32_t ReadChar()
+    {
+        if (next == end)
+            return 0;
+
+        auto c = (unsigned char)*next;
+
+        if (c < 0x80 || !options.validateUtf8) {
+            ++next;
+            return c;
+        }
+
+        // validate_next leaves 'next' where it was when the sequence is malformed
+        uint32_t cp;
+        if (utf8::internal::validate_next(next, end, cp) != utf8::internal::UTF8_OK) {
+            ++next;
+            return InvalidChar;
+        }
+
+        return cp;
+    }
+
+    void SkipChar()
+    {
+        assert(pos != next);
+        pos = next;
+        value = ReadChar();
+    }
+
+    void SkipTo(const char* p)
+    {
+        assert(p >= pos && p <= end);
+        pos = p;
+        next = p;
+        value = ReadChar();
+    }
+
+    // Skips 'count' bytes of ASCII input, such as a number or literal.
+    void SkipChars(ptrdiff_t count)
+    {
+        assert(pos != next);
+        assert(count <= end - pos);
+        pos += count;
+        next = pos;
+        value = ReadChar();
+    }
+
+    // Appends the raw bytes of the current character, which are
+    // already valid UTF-8 if validation is enabled.
+    template<class Str>
+    void AppendChar(Str& str) const
+    {
+        if (next - pos == 1)
+            str.push_back(*pos);
+        else
+            str.append(pos, next);
+    }
+
+    bool IsStartOfNumber(char32_t c) {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+';
+    }
+
+    bool IsStartOf(char32_t c) {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+';
+    }
+
+    JsonToken GetStringToken()
+    {
+        if (inSitu)
+        {
+            char* first = inSitu + GetOffset() + 1;
+            InSituString str{ first, first };
+            return ReadString(str);
+        }
+
+        std::string str = std::move(scratch);
+        str.clear();
+        return ReadString(str);
+    }
+
+    template<class Str>
+    JsonToken ReadString(Str& str)
+    {
+        assert(value == U'\"');
+
+        auto start = GetOffset();
+        SkipChar();
+
+        while (pos != end)
+        {
+            // copy everything up to the next character that needs attention in one go
+            auto run = JsonScanner::FindStringSpecial(pos, end, options.validateUtf8);
+            if (run != pos)
+            {
+                str.append(pos, run);
+                SkipTo(run);
+
+                if (pos == end)
+                    break;
+            }
+
+            if (value == U'\"')
+            {
+                SkipChar();
+
+                if (options.stats)
+                    ++options.stats->strings;
+
+                if constexpr (std::is_same_v<Str, InSituString>)
+                    return JsonToken(JsonTokenType::String, start, str.view());
+                else
+                    return JsonToken(JsonTokenType::String, start, std::move(str));
+            }
+            else if (value == U'\\')
+            {
+                SkipChar();
+
+                if (options.stats)
+                    ++options.stats->escapes;
+
+                if (pos == end)
+                    return Fail(JsonErrorCode::UnexpectedEndOfInput);
+
+                if (value == U'\"') {
+                    SkipChar();
+                    str.push_back('\"');
+                }
+                else if (value == U'\\') {
+                    SkipChar();
+                    str.push_back('\\');
+                }
+                else if (value == U'r') {
+                    SkipChar();
+                    str.push_back('\r');
+                }
+                else if (value == U'n') {
+                    SkipChar();
+                    str.push_back('\n');
+                }
+                else if (value == U't') {
+                    SkipChar();
+                    str.push_back('\t');
+                }
+                else if (value == U'b') {
+                    SkipChar();
+                    str.push_back('\b');
+                }
+                else if (value == U'f') {
+                    SkipChar();
+                    str.push_back('\f');
+                }
+                else if (value == U'u')
+                {
+                    SkipChar();
+
+                    char hex[5]{};
+
+                    // a bad digit is reported as such even near the end of the input
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        if (pos == end)
+                            return Fail(JsonErrorCode::UnexpectedEndOfInput);
+
+                        if (value >= 0x80 || !isxdigit((int)value))
+                            return Fail(JsonErrorCode::InvalidUnicodeEscape);
+
+                        hex[i] = (char)value;
+                        SkipChar();
+                    }
+
+                    char32_t charValue = (char32_t)std::strtoul(hex, nullptr, 16);
+
+                    if (!utf8::internal::is_code_point_valid(charValue))
+                        return Fail(JsonErrorCode::InvalidCodePoint);
+
+                    utf8::append(charValue, std::back_inserter(str));
+                }
+                else
+                {
+                    if (value == InvalidChar)
+                        return Fail(JsonErrorCode::InvalidUtf8);
+
+                    AppendChar(str);
+                    SkipChar();
+                }
+            }
+            else
+            {
+                if (value == InvalidChar)
+                    return Fail(JsonErrorCode::InvalidUtf8);
+
+                AppendChar(str);
+                SkipChar();
+            }
+        }
+
+        assert(pos == end);
+        return Fail(JsonErrorCode::UnexpectedEndOfInput);
+    }
+
+    static bool IsDigit(char c) {
+        return (unsigned char)(c - '0') < 10;
+    }
+
+    // True if all eight bytes of 'chunk' are ASCII digits.
+    static bool IsEightDigits(uint64_t chunk) {
+        return ((chunk & 0xF0F0F0F0F0F0F0F0) |
+            (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+    }
+
+    // Converts eight ASCII digits loaded little-endian into their value,
+    // combining pairs, then quads, then both halves with multiplies.
+    static uint32_t ParseEightDigits(uint64_t chunk)
+    {
+        constexpr uint64_t mask = 0x000000FF000000FF;
+        constexpr uint64_t mul1 = 100 + (1000000ULL << 32);
+        constexpr uint64_t mul2 = 1 + (10000ULL << 32);
+
+        chunk -= 0x3030303030303030;
+        chunk = (chunk * 10) + (chunk >> 8);
+        return (uint32_t)((((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32);
+    }
+
+    // Accumulates the digits starting at 'p' into 'value' and returns the end
+    // of the run. 'value' wraps if there are more than 19 digits in total, so
+    // callers have to check the digit count.
+    static const char* ParseDigits(const char* p, const char* end, uint64_t& value)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            while (end - p >= 8)
+            {
+                uint64_t chunk;
+                std::memcpy(&chunk, p, sizeof(chunk));
+
+                if (!IsEightDigits(chunk))
+                    break;
+
+                value = value * 100000000 + ParseEightDigits(chunk);
+                p += 8;
+            }
+        }
+
+        while (p != end && IsDigit(*p))
+            value = value * 10 + (*p++ - '0');
+
+        return p;
+    }
+
+    // Lexes a number according to the JSON grammar in a single pass. The
+    // digits are converted while they're validated, so an integer that fits
+    // in an int64_t never needs a second parse. Numbers with a fraction or
+    // exponent, and integers too large for an int64_t, become doubles.
+    JsonToken GetNumberToken()
+    {
+        auto start = GetOffset();
+        const char* p = pos;
+
+        bool negative = (*p == '-');
+        if (negative)
+            ++p;
+
+        uint64_t mantissa = 0;
+        const char* intStart = p;
+        p = ParseDigits(p, end, mantissa);
+
+        size_t digits = p - intStart;
+        if (digits == 0 || (*intStart == '0' && digits > 1))
+            return Fail(JsonErrorCode::InvalidNumber);
+
+        bool isFloat = false;
+        int64_t exponent = 0;
+
+        if (p != end && *p == '.')
+        {
+            const char* fracStart = ++p;
+            p = ParseDigits(p, end, mantissa);
+
+            if (p == fracStart)
+                return Fail(JsonErrorCode::InvalidNumber);
+
+            digits += p - fracStart;
+            exponent = -(p - fracStart);
+            isFloat = true;
+        }
+
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+
+            bool negativeExponent = false;
+            if (p != end && (*p == '+' || *p == '-'))
+                negativeExponent = (*p++ == '-');
+
+            const char* expStart = p;
+            int64_t exp = 0;
+
+            for (; p != end && IsDigit(*p); ++p)
+            {
+                // large enough to overflow or underflow any double
+                if (exp < 100000)
+                    exp = exp * 10 + (*p - '0');
+            }
+
+            if (p == expStart)
+                return Fail(JsonErrorCode::InvalidNumber);
+
+            exponent += negativeExponent ? -exp : exp;
+            isFloat = true;
+        }
+
+        const char* numberEnd = p;
+        SkipChars(numberEnd - pos);
+
+        // 19 digits always fit in a uint64_t
+        bool exact = digits <= 19;
+
+        if (!isFloat && exact)
+        {
+            if (!negative && mantissa <= (uint64_t)INT64_MAX)
+                return JsonToken(JsonTokenType::Integer, start, (int64_t)mantissa);
+
+            if (negative && mantissa <= (uint64_t)INT64_MAX + 1)
+                return JsonToken(JsonTokenType::Integer, start, (int64_t)(0 - mantissa));
+        }
+
+        // Clinger's fast path: both the mantissa and the power of ten are
+        // exactly representable, so a single multiply or divide is correctly rounded.
+        static constexpr double powersOf10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        if (FLT_EVAL_METHOD == 0 && exact && mantissa <= (uint64_t(1) << 53) &&
+            exponent >= -22 && exponent <= 22)
+        {
+            double value = (double)mantissa;
+
+            if (exponent < 0)
+                value /= powersOf10[-exponent];
+            else
+                value *= powersOf10[exponent];
+
+            return JsonToken(JsonTokenType::Float, start, negative ? -value : value);
+        }
+
+        // everything else goes to the standard library, which rounds correctly
+        double value;
+        auto ret = std::from_chars(chars.data() + start, numberEnd, value);
+        if (ret.ec != std::errc() || ret.ptr != numberEnd)
+            return Fail(JsonErrorCode::InvalidNumber);
+
+        return JsonToken(JsonTokenType::Float, start, value);
+    }
+
+    bool StartsWith(std::string_view literal) const {
+        return (size_t)(end - pos) >= literal.size() &&
+            std::equal(literal.begin(), literal.end(), pos);
+    }
+
+    JsonToken GetBooleanToken()
+    {
+        auto start = GetOffset();
+
+        bool val;
+
+        if (StartsWith("true")) {
+            val = true;
+            SkipChars(4);
+        }
+        else if (StartsWith("false")) {
+            val = false;
+            SkipChars(5);
+        }
+        else {
+            return Fail(JsonErrorCode::ExpectedBoolean);
+        }
+
+        return JsonToken(JsonTokenType::Boolean, start, val);
+    }
+
+    JsonToken GetNullToken()
+    {
+        auto start = GetOffset();
+
+        if (StartsWith("null"))
+            SkipChars(4);
+        else
+            return Fail(JsonErrorCode::ExpectedNull);
+
+        return JsonToken(JsonTokenType::Null, start, nullptr);
+    }
+};
+
+// Describes one member of a struct declared with JSON_FIELDS.
+template<class T, class M>
+struct JsonField
+{
+    std::string_view name;
+    M T::* member;
+};
+
+// Declares which members of a struct are read and written as JSON, using the
+// member names as keys:
+//
+//     JSON_FIELDS(Parent, name, number)
+//
+// This must appear at namespace scope, in the struct's namespace, after the
+// struct is defined. It generates constexpr field descriptors along with
+// to_json/from_json, so the struct works with Json like any other
+// convertible type. It also lets JsonSerialize and JsonDeserialize convert
+// the struct straight to and from text without building a Json tree.
+#define JSON_FIELDS(Type, ...) \
+    constexpr auto JsonGetFields(const Type*) { \
+        return std::make_tuple(JSON_FOR_EACH(JSON_FIELD, Type, __VA_ARGS__)); \
+    } \
+    inline void to_json(Json& obj, const Type& value) { JsonFieldsToJson(obj, value); } \
+    inline void from_json(const Json& obj, Type& value) { JsonFieldsFromJson(obj, value); } \
+    inline void from_json(Json&& obj, Type& value) { JsonFieldsFromJson(std::move(obj), value); }
+
+#define JSON_FIELD(Type, field) JsonField<Type, decltype(Type::field)>{ #field, &Type::field }
+
+// Applies m(t, arg) to each of up to 32 arguments. This counts the arguments
+// instead of using __VA_OPT__ so that it works with MSVC's traditional preprocessor.
+#define JSON_EXPAND(x) x
+#define JSON_CONCAT_(a, b) a##b
+#define JSON_CONCAT(a, b) JSON_CONCAT_(a, b)
+#define JSON_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define JSON_COUNT(...) JSON_EXPAND(JSON_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define JSON_FOR_EACH(m, t, ...) JSON_EXPAND(JSON_CONCAT(JSON_FOR_EACH_, JSON_COUNT(__VA_ARGS__))(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_1(m, t, a) m(t, a)
+#define JSON_FOR_EACH_2(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_1(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_3(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_2(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_4(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_3(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_5(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_4(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_6(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_5(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_7(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_6(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_8(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_7(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_9(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_8(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_10(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_9(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_11(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_10(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_12(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_11(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_13(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_12(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_14(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_13(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_15(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_14(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_16(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_15(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_17(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_16(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_18(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_17(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_19(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_18(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_20(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_19(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_21(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_20(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_22(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_21(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_23(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_22(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_24(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_23(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_25(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_24(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_26(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_25(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_27(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_26(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_28(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_27(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_29(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_28(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_30(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_29(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_31(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_30(m, t, __VA_ARGS__))
+#define JSON_FOR_EACH_32(m, t, a, ...) m(t, a), JSON_EXPAND(JSON_FOR_EACH_31(m, t, __VA_ARGS__))
+
+template<class T>
+concept JsonReflected = requires { JsonGetFields(static_cast<const T*>(nullptr)); };
+
+// Maps field names to field indices with a perfect hash that's found at
+// compile time, so matching a key costs one hash and one comparison.
+template<JsonReflected T>
+class JsonFieldTable
+{
+public:
+    static constexpr auto Fields = JsonGetFields(static_cast<const T*>(nullptr));
+    static constexpr size_t Count = std::tuple_size_v<decltype(Fields)>;
+
+private:
+    static constexpr auto Names = std::apply([](auto... fields) {
+        return std::array<std::string_view, sizeof...(fields)>{ fields.name... };
+    }, Fields);
+
+    // With at least Count^2 slots, a seed that has no collisions is found within a few tries.
+    static constexpr size_t TableSize = std::bit_ceil(Count * Count);
+
+    static constexpr uint64_t Hash(std::string_view key, uint64_t seed)
+    {
+        uint64_t hash = 14695981039346656037ull ^ seed;
+
+        for (char c : key) {
+            hash ^= (unsigned char)c;
+            hash *= 1099511628211ull;
+        }
+
+        return hash ^ (hash >> 29);
+    }
+
+    static constexpr bool HasDuplicates()
+    {
+        for (size_t i = 0; i != Count; ++i)
+            for (size_t j = i + 1; j != Count; ++j)
+                if (Names[i] == Names[j])
+                    return true;
+
+        return false;
+    }
+
+    static_assert(Count < 256, "too many fields in JSON_FIELDS");
+    static_assert(!HasDuplicates(), "duplicate field in JSON_FIELDS");
+
+    static constexpr uint64_t FindSeed()
+    {
+        for (uint64_t seed = 0; ; ++seed)
+        {
+            std::array<bool, TableSize> used{};
+            bool collision = false;
+
+            for (auto name : Names)
+            {
+                size_t slot = Hash(name, seed) & (TableSize - 1);
+                collision |= used[slot];
+                used[slot] = true;
+            }
+
+            if (!collision)
+                return seed;
+        }
+    }
+
+    static constexpr uint64_t Seed = FindSeed();
+
+    // field index + 1 for each slot, or 0 if it's empty
+    static constexpr auto Slots = [] {
+        std::array<uint8_t, TableSize> slots{};
+
+        for (size_t i = 0; i != Count; ++i)
+            slots[Hash(Names[i], Seed) & (TableSize - 1)] = (uint8_t)(i + 1);
+
+        return slots;
+    }();
+
+public:
+    // Returns the index of the field named 'key', or Count if there isn't one.
+    static size_t Find(std::string_view key)
+    {
+        size_t slot = Slots[Hash(key, Seed) & (TableSize - 1)];
+        return (slot && Names[slot - 1] == key) ? slot - 1 : Count;
+    }
+
+    // Calls func(name, member) for each field of 'value'.
+    template<class Value, class Func>
+    static void ForEach(Value& value, Func&& func)
+    {
+        std::apply([&](const auto&... fields) {
+            (func(fields.name, value.*(fields.member)), ...);
+        }, Fields);
+    }
+
+    // Calls func(name, member) for the field at 'index'.
+    template<class Value, class Func>
+    static void Visit(Value& value, size_t index, Func&& func)
+    {
+        std::apply([&](const auto&... fields) {
+            size_t i = 0;
+            ((i++ == index ? (func(fields.name, value.*(fields.member)), true) : false) || ...);
+        }, Fields);
+    }
+};
+
+template<class T>
+inline constexpr bool is_json_sequence = false;
+
+template<class T, class A>
+inline constexpr bool is_json_sequence<std::vector<T, A>> = true;
+
+template<class T, class A>
+inline constexpr bool is_json_sequence<std::list<T, A>> = true;
+
+template<class T, class A>
+inline constexpr bool is_json_sequence<std::forward_list<T, A>> = true;
+
+template<class T, size_t N>
+inline constexpr bool is_json_sequence<std::array<T, N>> = true;
+
+template<class T>
+inline constexpr bool is_json_fixed_sequence = false;
+
+template<class T, size_t N>
+inline constexpr bool is_json_fixed_sequence<std::array<T, N>> = true;
+
+template<class T>
+inline constexpr bool is_json_string_map = false;
+
+template<class T, class C, class A>
+inline constexpr bool is_json_string_map<std::map<std::string, T, C, A>> = true;
+
+template<class T, class H, class E, class A>
+inline constexpr bool is_json_string_map<std::unordered_map<std::string, T, H, E, A>> = true;
+
+class Json;
+struct JsonParseResult;
+class JsonString;
+class JsonPointer;
+
+// Receives parse events from JsonParser::Parse(handler). String and key
+// views are only valid for the duration of the call, so copy them if they
+// need to be kept. Object members are reported as OnKey followed by the
+// member's value.
+template<class T>
+concept JsonHandler = requires(T handler, std::string_view str, int64_t i, double d, bool b)
+{
+    handler.OnNull();
+    handler.OnBoolean(b);
+    handler.OnInteger(i);
+    handler.OnFloat(d);
+    handler.OnString(str);
+    handler.OnKey(str);
+    handler.OnObjectStart();
+    handler.OnObjectEnd();
+    handler.OnArrayStart();
+    handler.OnArrayEnd();
+};
+
+// Convenience base for handlers that only care about some events.
+struct JsonHandlerBase
+{
+    void OnNull() {}
+    void OnBoolean(bool) {}
+    void OnInteger(int64_t) {}
+    void OnFloat(double) {}
+    void OnString(std::string_view) {}
+    void OnKey(std::string_view) {}
+    void OnObjectStart() {}
+    void OnObjectEnd() {}
+    void OnArrayStart() {}
+    void OnArrayEnd() {}
+};
+
+class JsonParser
+{
+    JsonLexer lexer;
+    JsonToken token;
+    JsonParseOptions options;
+    JsonParseEngine engine;
+    std::pmr::memory_resource* resource;
+    std::vector<uint32_t> structurals;
+    size_t nextStructural = 0;
+    const char* text;
+    size_t length;
+    bool resumeLexer = false;
+    std::vector<Json> containers;
+    std::vector<JsonString> keys;
+    std::vector<JsonTokenType> nesting;
+    size_t depth = 0;
+    char* inSitu{};
+    JsonError error;
+    bool throwErrors = true;
+
+    // Accounts for one parse in options.stats, if it's set.
+    class StatsScope
+    {
+        JsonParseStats* stats;
+        JsonCountingResource* counter = nullptr;
+        size_t allocations = 0;
+        size_t allocatedBytes = 0;
+        JsonStatsTimer timer;
+    public:
+        explicit StatsScope(JsonParser& parser)
+            : stats(parser.options.stats), timer(stats ? &stats->parseTime : nullptr)
+        {
+            if (!stats)
+                return;
+
+            stats->bytes += parser.length;
+            counter = dynamic_cast<JsonCountingResource*>(parser.resource);
+
+            if (auto arena = dynamic_cast<std::pmr::monotonic_buffer_resource*>(parser.resource))
+                counter = dynamic_cast<JsonCountingResource*>(arena->upstream_resource());
+
+            if (counter)
+            {
+                allocations = counter->GetAllocationCount();
+                allocatedBytes = counter->GetAllocatedBytes();
+            }
+        }
+
+        ~StatsScope()
+        {
+            if (counter)
+            {
+                stats->allocations += counter->GetAllocationCount() - allocations;
+                stats->allocatedBytes += counter->GetAllocatedBytes() - allocatedBytes;
+            }
+        }
+    };
+
+public:
+    // Creates a parser without input, to be given some with Reset.
+    explicit JsonParser(const JsonParseOptions& options = {});
+    JsonParser(std::string_view text, const JsonParseOptions& options = {});
+    JsonParser(const char* text, size_t length, const JsonParseOptions& options = {});
+
+    // Starts over on new input. A parser that's reused this way keeps its
+    // scratch space, so parsing similar input again doesn't allocate
+    // anything but the parsed value itself (see JsonDocument).
+    void Reset(std::string_view text);
+    void Reset(std::string_view text, const JsonParseOptions& options);
+
+    // Starts over on a buffer that may be overwritten, decoding strings in
+    // place so that the parsed value refers to them (see Json::ParseInSitu).
+    void ResetInSitu(char* text, size_t length);
+    void ResetInSitu(char* text, size_t length, const JsonParseOptions& options);
+
+    Json Parse();
+
+    // Like Parse, but reports malformed input by returning false instead of
+    // throwing, with the details in GetError(), so rejecting input costs
+    // about as much as accepting it. This always parses on one thread.
+    bool TryParse(Json& value);
+
+    const JsonError& GetError() const {
+        return error;
+    }
+
+    // Reports the input to 'handler' as it's read instead of building a tree,
+    // so memory use is bounded by nesting depth rather than document size.
+    // The streaming engine is preferable here, since the indexed engine
+    // allocates an index proportional to the input.
+    template<JsonHandler Handler>
+    void Parse(Handler& handler);
+
+    // True when nothing but whitespace follows the value that was parsed.
+    bool IsAtEnd() const {
+        return token.type == JsonTokenType::EndOfFile;
+    }
+
+    // Parses the input straight into 'value' without building a tree. This
+    // works for types declared with JSON_FIELDS, standard containers and
+    // string-keyed maps of them, and scalars. Other types are read through
+    // a Json and their from_json.
+    template<class T>
+    void ParseInto(T& value);
+
+private:
+    bool NextToken(bool thrownOnEOF = true);
+    JsonToken NextIndexedToken();
+
+    // Records an error at the current token, and throws it unless this is TryParse.
+    bool Fail(JsonErrorCode code);
+
+    // Moves to the next token, failing if the lexer rejected it.
+    bool Advance();
+
+    template<class Handler>
+    bool ParseRoot(Handler& handler);
+
+    bool FindArrayElements(std::vector<uint32_t>& bounds);
+    Json ParseArrayParallel(const std::vector<uint32_t>& bounds, unsigned threadCount);
+
+    void ExpectToken(JsonTokenType type, const char* expected);
+    void SkipValue();
+
+    template<class T>
+    void ReadValue(T& value);
+
+    template<class Func>
+    void ReadObject(Func&& readMember);
+
+    template<class Func>
+    void ReadArray(Func&& readElement);
+
+    bool EnterContainer();
+
+    template<class Handler>
+    bool ParseKey(Handler& handler);
+
+    template<class Handler>
+    bool ParseValue(Handler& handler);
+};
+
+// Output target for JsonPrinter::Write.
+template<class T>
+concept JsonSink = requires(T sink, const char* data, size_t size, char c)
+{
+    sink.Write(data, size);
+    sink.Put(c);
+};
+
+// Appends output to a string.
+class JsonStringSink
+{
+    std::string& str;
+public:
+    JsonStringSink(std::string& str)
+        : str(str) {}
+
+    void Write(const char* data, size_t size) {
+        str.append(data, size);
+    }
+
+    void Put(char c) {
+        str.push_back(c);
+    }
+};
+
+// Buffers output and writes it to a stream in large blocks.
+class JsonStreamSink
+{
+    std::ostream& stream;
+    size_t used = 0;
+    char buffer[4096];
+public:
+    JsonStreamSink(std::ostream& stream)
+        : stream(stream) {}
+
+    ~JsonStreamSink() {
+        Flush();
+    }
+
+    JsonStreamSink(const JsonStreamSink&) = delete;
+    JsonStreamSink& operator=(const JsonStreamSink&) = delete;
+
+    void Write(const char* data, size_t size)
+    {
+        if (size > sizeof(buffer) - used)
+        {
+            Flush();
+
+            if (size > sizeof(buffer)) {
+                stream.write(data, size);
+                return;
+            }
+        }
+
+        std::memcpy(buffer + used, data, size);
+        used += size;
+    }
+
+    void Put(char c)
+    {
+        if (used == sizeof(buffer))
+            Flush();
+
+        buffer[used++] = c;
+    }
+
+    void Flush()
+    {
+        if (used) {
+            stream.write(buffer, used);
+            used = 0;
+        }
+    }
+};
+
+// Writes output into a caller-provided buffer. Output past the end of the
+// buffer is dropped, and IsTruncated() reports whether that happened.
+class JsonBufferSink
+{
+    char* buffer;
+    size_t capacity;
+    size_t size = 0;
+    bool truncated = false;
+public:
+    JsonBufferSink(char* buffer, size_t capacity)
+        : buffer(buffer), capacity(capacity) {}
+
+    void Write(const char* data, size_t count)
+    {
+        if (count > capacity - size) {
+            count = capacity - size;
+            truncated = true;
+        }
+
+        std::memcpy(buffer + size, data, count);
+        size += count;
+    }
+
+    void Put(char c)
+    {
+        if (size == capacity)
+            truncated = true;
+        else
+            buffer[size++] = c;
+    }
+
+    size_t GetSize() const {
+        return size;
+    }
+
+    bool IsTruncated() const {
+        return truncated;
+    }
+};
+
+struct JsonDumpStats;
+
+class JsonPrinter
+{
+    int indentWidth;
+    bool pretty;
+    unsigned threadCount;
+    JsonDumpStats* stats = nullptr;
+
+    // Arrays and objects that are at least this large are split across
+    // threads when printing in parallel.
+    static constexpr size_t ParallelThreshold = 4096;
+
+    // Containers nested deeper than this are printed on one thread, which
+    // bounds the recursion of WriteParallel.
+    static constexpr int ParallelMaxDepth = 64;
+
+    template<JsonSink Sink>
+    void Indent(Sink& sink, int indent);
+
+    template<JsonSink Sink>
+    void WriteEscaped(Sink& sink, std::string_view val);
+
+    template<JsonSink Sink, class T>
+    void WriteInteger(Sink& sink, T val);
+
+    template<JsonSink Sink>
+    void WriteFloat(Sink& sink, double val);
+
+    template<JsonSink Sink>
+    void WriteSeparator(Sink& sink, int indent, size_t index);
+
+    template<JsonSink Sink>
+    void EndContainer(Sink& sink, int indent, char close, bool empty);
+
+    template<JsonSink Sink>
+    void WriteMember(Sink& sink, int indent, size_t index, const Json& container);
+
+    template<JsonSink Sink>
+    void WriteParallel(Sink& sink, int indent, const Json& val);
+
+    template<JsonSink Sink>
+    void WriteChunked(Sink& sink, int indent, const Json& val);
+
+    template<JsonSink Sink>
+    void WriteTree(Sink& sink, int indent, const Json& val);
+
+    // Writes 'val' on one thread or several, counting the output in 'stats'.
+    template<JsonSink Sink>
+    void Print(Sink& sink, int indent, const Json& val, bool parallel);
+
+    void CountValue(const Json& val);
+public:
+
+    // With a 'threadCount' other than 1, ToString and ToStream print large
+    // arrays and objects on that many threads (zero selects
+    // std::thread::hardware_concurrency()). Each thread prints a range of
+    // elements into its own buffer, and the buffers are joined in order,
+    // so the output is identical to printing on one thread.
+    JsonPrinter(int indentWidth, unsigned threadCount = 1);
+
+    std::string ToString(const Json& val);
+
+    // Replaces the contents of 'str' with 'val', reusing the string's
+    // capacity, so printing into the same string repeatedly stops
+    // allocating once it's large enough.
+    void ToString(const Json& val, std::string& str);
+
+    void ToStream(std::ostream& stream, int indent, const Json& val);
+
+    template<JsonSink Sink>
+    void Write(Sink& sink, int indent, const Json& val);
+
+    // When set, printing adds what's written to these (see JsonDumpStats).
+    // Only Json values are counted, so WriteValue just counts the Json
+    // values inside what it writes.
+    void SetStats(JsonDumpStats* stats) {
+        this->stats = stats;
+    }
+
+    // Writes any value that WriteValue supports without converting it to a
+    // Json first. See JsonParser::ParseInto for the supported types.
+    template<JsonSink Sink, class T>
+    void WriteValue(Sink& sink, int indent, const T& val);
+};
+
+// Encodes Json values as CBOR (RFC 8949), a binary format with the same
+// data model as JSON. Strings, arrays and objects are written with their
+// lengths up front, integers use the shortest encoding, and floats are
+// written as single precision when that's exact and double precision
+// otherwise. Integers and floats stay distinct, so the encoding decodes to
+// exactly the value that was written.
+class JsonCborWriter
+{
+    template<JsonSink Sink>
+    static void WriteHead(Sink& sink, uint8_t major, uint64_t value);
+public:
+    std::string ToString(const Json& val);
+
+    template<JsonSink Sink>
+    void Write(Sink& sink, const Json& val);
+};
+
+// Decodes CBOR written by JsonCborWriter, or by any encoder that sticks to
+// what JSON can represent. Byte strings, tags, indefinite lengths, non-string
+// keys and simple values other than false, true and null are rejected.
+class JsonCborReader
+{
+    const uint8_t* pos;
+    const uint8_t* end;
+    JsonParseOptions options;
+    std::pmr::memory_resource* resource;
+    size_t depth = 0;
+
+    void Require(uint64_t count);
+    uint64_t ReadBigEndian(size_t count);
+    uint64_t ReadArgument(uint8_t info);
+    std::string_view ReadText(uint64_t length);
+    JsonString ReadString(uint64_t length);
+    Json ReadValue();
+public:
+    JsonCborReader(std::string_view data, const JsonParseOptions& options = {});
+
+    Json Read();
+};
+
+template <typename T>
+class has_to_string
+{
+    template <typename C, typename = decltype(to_string(std::declval<std::string&>(), std::declval<const T>()))>
+    static std::true_type test(int);
+
+    template <typename C>
+    static std::false_type test(...);
+
+public:
+    static constexpr bool value = decltype(test<T>(0))::value;
+};
+
+template <typename T>
+class has_from_string
+{
+    template <typename C, typename = decltype(from_string(std::declval<const std::string>(), std::declval<T&>()))>
+    static std::true_type test(int);
+
+    template <typename C>
+    static std::false_type test(...);
+
+public:
+    static constexpr bool value = decltype(test<T>(0))::value;
+};
+
+template<class T>
+inline constexpr bool has_from_string_v = has_from_string<T>::value;
+
+template<class T>
+inline constexpr bool has_to_string_v = has_to_string<T>::value;
+
+template<class>
+inline constexpr bool is_initializer_list = false;
+
+template<class T>
+inline constexpr bool is_initializer_list<std::initializer_list<T>> = true;
+
+enum class JsonDataType : uint8_t
+{
+    Null,
+    Object,
+    Array,
+    String,
+    Integer,
+    Float,
+    Boolean
+};
+
+// What JsonPrinter wrote, for monitoring (see JsonPrinter::SetStats). Like
+// JsonParseStats, the counts add up over every call that uses the same
+// stats. Allocations are the output's own, so they aren't counted here.
+struct JsonDumpStats
+{
+    // output bytes
+    size_t bytes = 0;
+
+    // values written, by JsonDataType
+    std::array<size_t, (size_t)JsonDataType::Boolean + 1> values{};
+
+    // strings and keys written, and the characters in them that were escaped
+    size_t strings = 0;
+    size_t escapes = 0;
+
+    std::chrono::nanoseconds time{};
+
+    size_t GetValueCount(JsonDataType type) const {
+        return values[(size_t)type];
+    }
+};
+
+// Passes output through to another sink, counting its size.
+template<JsonSink Sink>
+class JsonCountingSink
+{
+    Sink& sink;
+    size_t& count;
+public:
+    JsonCountingSink(Sink& sink, size_t& count)
+        : sink(sink), count(count) {}
+
+    void Write(const char* data, size_t size)
+    {
+        count += size;
+        sink.Write(data, size);
+    }
+
+    void Put(char c)
+    {
+        ++count;
+        sink.Put(c);
+    }
+};
+
+// String type used for Json string values and object keys. Strings of up to
+// InlineCapacity bytes are stored inline without allocating; longer ones live
+// in a heap block allocated from a std::pmr::memory_resource. The whole
+// string fits in 15 bytes, so a Json node can hold one next to its type tag.
+// Inline strings have no room to remember a resource, so an inline string
+// that grows past InlineCapacity allocates from the default resource.
+//
+// Strings are not null-terminated. Use the std::string_view conversion or
+// str() to work with APIs that expect standard strings.
+class JsonString
+{
+public:
+    using value_type = char;
+    using size_type = size_t;
+    using iterator = char*;
+    using const_iterator = const char*;
+
+    static constexpr size_t InlineCapacity = 14;
+
+private:
+    struct HeapHeader
+    {
+        std::pmr::memory_resource* resource;
+        size_t capacity;
+    };
+
+    // bytes[14] holds either the size of an inline string, HeapFlag, or
+    // SharedFlag. For heap and shared strings, bytes[0..7] hold the data
+    // pointer and bytes[8..13] hold the size as a 48-bit little-endian
+    // integer. Shared strings point at storage they don't own (see Shared).
+    static constexpr unsigned char HeapFlag = 0x80;
+    static constexpr unsigned char SharedFlag = 0x81;
+    static constexpr size_t ModeByte = 14;
+
+    unsigned char bytes[15];
+
+    bool IsHeap() const {
+        return bytes[ModeByte] == HeapFlag;
+    }
+
+    bool IsShared() const {
+        return bytes[ModeByte] == SharedFlag;
+    }
+
+    bool IsExternal() const {
+        return bytes[ModeByte] >= HeapFlag;
+    }
+
+    // Gives a shared string its own copy before it's modified.
+    void Unshare()
+    {
+        if (IsShared())
+        {
+            JsonString tmp(HeapData(), HeapSize());
+            std::memcpy(bytes, tmp.bytes, sizeof(bytes));
+            tmp.bytes[ModeByte] = 0;
+        }
+    }
+
+    char* HeapData() const
+    {
+        char* p;
+        std::memcpy(&p, bytes, sizeof(p));
+        return p;
+    }
+
+    HeapHeader* Header() const {
+        return reinterpret_cast<HeapHeader*>(HeapData()) - 1;
+    }
+
+    size_t HeapSize() const
+    {
+        size_t size = 0;
+
+        for (int i = 0; i != 6; ++i)
+            size |= (size_t)bytes[8 + i] << (i * 8);
+
+        return size;
+    }
+
+    void SetSize(size_t size)
+    {
+        Unshare();
+
+        if (IsHeap())
+        {
+            for (int i = 0; i != 6; ++i)
+                bytes[8 + i] = (unsigned char)(size >> (i * 8));
+        }
+        else
+        {
+            assert(size <= InlineCapacity);
+            bytes[ModeByte] = (unsigned char)size;
+        }
+    }
+
+    static char* Allocate(size_t capacity, std::pmr::memory_resource* resource)
+    {
+        if (capacity >= (size_t(1) << 48))
+            throw std::length_error("string is too long");
+
+        void* block = resource->allocate(sizeof(HeapHeader) + capacity, alignof(HeapHeader));
+        auto header = new (block) HeapHeader{ resource, capacity };
+        return reinterpret_cast<char*>(header + 1);
+    }
+
+    void Free()
+    {
+        if (IsHeap())
+        {
+            HeapHeader* header = Header();
+            header->resource->deallocate(header, sizeof(HeapHeader) + header->capacity, alignof(HeapHeader));
+        }
+    }
+
+    // Moves the contents into a new heap block of at least 'capacity' bytes and
+    // appends 'tail', which may point into the old contents. Capacity grows
+    // geometrically so that repeated appends stay amortized O(1).
+    void Grow(size_t capacity, std::string_view tail = {})
+    {
+        size_t oldSize = size();
+        capacity = std::max(capacity, this->capacity() * 2);
+
+        char* p = Allocate(capacity, GetResource());
+        std::memcpy(p, std::as_const(*this).data(), oldSize);
+
+        if (!tail.empty())
+            std::memcpy(p + oldSize, tail.data(), tail.size());
+
+        Free();
+        SetExternal(p, oldSize + tail.size(), HeapFlag);
+    }
+
+    void SetExternal(const char* p, size_t size, unsigned char mode)
+    {
+        std::memcpy(bytes, &p, sizeof(p));
+        bytes[ModeByte] = mode;
+
+        for (int i = 0; i != 6; ++i)
+            bytes[8 + i] = (unsigned char)(size >> (i * 8));
+    }
+
+    void Init(const char* str, size_t size, std::pmr::memory_resource* resource)
+    {
+        if (size <= InlineCapacity)
+        {
+            bytes[ModeByte] = (unsigned char)size;
+
+            if (size)
+                std::memcpy(bytes, str, size);
+        }
+        else
+        {
+            char* p = Allocate(size, resource);
+            std::memcpy(p, str, size);
+            SetExternal(p, size, HeapFlag);
+        }
+    }
+
+public:
+    JsonString() noexcept {
+        bytes[ModeByte] = 0;
+    }
+
+    template<class T> requires (
+        std::is_convertible_v<const T&, std::string_view> &&
+        !std::is_same_v<T, JsonString>)
+    JsonString(const T& str, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        std::string_view view = str;
+        Init(view.data(), view.size(), resource);
+    }
+
+    JsonString(const char* str, size_t size, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        Init(str, size, resource);
+    }
+
+    JsonString(const JsonString& other, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        Init(other.data(), other.size(), resource);
+    }
+
+    JsonString(JsonString&& other) noexcept
+    {
+        std::memcpy(bytes, other.bytes, sizeof(bytes));
+        other.bytes[ModeByte] = 0;
+    }
+
+    ~JsonString() {
+        Free();
+    }
+
+    // Returns a string that refers to 'str' instead of copying it, unless
+    // it's short enough to be stored inline anyway. 'str' must outlive the
+    // returned string and any string it's moved to, and must not change.
+    // Copies of a shared string get their own storage, as does a shared
+    // string that's modified.
+    static JsonString Shared(std::string_view str)
+    {
+        if (str.size() <= InlineCapacity)
+            return JsonString(str);
+
+        if (str.size() >= (size_t(1) << 48))
+            throw std::length_error("string is too long");
+
+        JsonString ret;
+        ret.SetExternal(str.data(), str.size(), SharedFlag);
+        return ret;
+    }
+
+    JsonString& operator=(const JsonString& other) {
+        return assign(other);
+    }
+
+    JsonString& operator=(JsonString&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Free();
+            std::memcpy(bytes, other.bytes, sizeof(bytes));
+            other.bytes[ModeByte] = 0;
+        }
+
+        return *this;
+    }
+
+    JsonString& operator=(std::string_view str) {
+        return assign(str);
+    }
+
+    // The resource that a heap block would be allocated from. Inline
+    // strings don't remember theirs, so they grow into the default resource.
+    std::pmr::memory_resource* GetResource() const {
+        return IsHeap() ? Header()->resource : std::pmr::get_default_resource();
+    }
+
+    size_t size() const {
+        return IsExternal() ? HeapSize() : bytes[ModeByte];
+    }
+
+    size_t length() const {
+        return size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const
+    {
+        if (IsHeap())
+            return Header()->capacity;
+
+        return IsShared() ? HeapSize() : InlineCapacity;
+    }
+
+    char* data()
+    {
+        Unshare();
+        return IsHeap() ? HeapData() : reinterpret_cast<char*>(bytes);
+    }
+
+    const char* data() const {
+        return IsExternal() ? HeapData() : reinterpret_cast<const char*>(bytes);
+    }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + size(); }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size(); }
+    const_iterator cbegin() const { return data(); }
+    const_iterator cend() const { return data() + size(); }
+
+    char& operator[](size_t index) {
+        return data()[index];
+    }
+
+    const char& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    operator std::string_view() const {
+        return std::string_view(data(), size());
+    }
+
+    operator std::string() const {
+        return std::string(data(), size());
+    }
+
+    std::string str() const {
+        return std::string(data(), size());
+    }
+
+    void clear() {
+        SetSize(0);
+    }
+
+    void reserve(size_t capacity)
+    {
+        if (capacity > this->capacity())
+            Grow(capacity);
+    }
+
+    void resize(size_t size, char c = '\0')
+    {
+        size_t oldSize = this->size();
+        reserve(size);
+
+        if (size > oldSize)
+            std::memset(data() + oldSize, c, size - oldSize);
+
+        SetSize(size);
+    }
+
+    JsonString& assign(std::string_view str)
+    {
+        if (str.size() <= capacity())
+        {
+            // 'str' may point into this string, so it has to be memmove
+            if (!str.empty())
+                std::memmove(data(), str.data(), str.size());
+
+            SetSize(str.size());
+        }
+        else
+        {
+            JsonString tmp(str, GetResource());
+            *this = std::move(tmp);
+        }
+
+        return *this;
+    }
+
+    JsonString& append(std::string_view str)
+    {
+        size_t oldSize = size();
+        size_t newSize = oldSize + str.size();
+
+        if (newSize > capacity())
+        {
+            Grow(newSize, str);
+        }
+        else
+        {
+            if (!str.empty())
+                std::memmove(data() + oldSize, str.data(), str.size());
+
+            SetSize(newSize);
+        }
+
+        return *this;
+    }
+
+    JsonString& append(const char* first, const char* last) {
+        return append(std::string_view(first, last - first));
+    }
+
+    void push_back(char c)
+    {
+        size_t oldSize = size();
+
+        if (oldSize == capacity())
+            Grow(oldSize + 1);
+
+        data()[oldSize] = c;
+        SetSize(oldSize + 1);
+    }
+
+    JsonString& operator+=(std::string_view str) {
+        return append(str);
+    }
+
+    JsonString& operator+=(char c)
+    {
+        push_back(c);
+        return *this;
+    }
+
+    friend bool operator==(const JsonString& a, std::string_view b) {
+        return std::string_view(a) == b;
+    }
+
+    friend auto operator<=>(const JsonString& a, std::string_view b) {
+        return std::string_view(a) <=> b;
+    }
+
+    friend std::ostream& operator<<(std::ostream& stream, const JsonString& str) {
+        return stream << std::string_view(str);
+    }
+};
+
+static_assert(sizeof(JsonString) == 15 && alignof(JsonString) == 1);
+
+// Lets JsonString keys be looked up by std::string_view without a temporary.
+struct JsonKeyHash
+{
+    using is_transparent = void;
+
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>()(key);
+    }
+};
+
+// Immutable storage for the object keys of one or more parsed documents, so
+// that the records of a large homogeneous array share a single copy of each
+// key (see JsonParseOptions::keyTable). Interned keys are only freed with the
+// table. Not thread-safe.
+class JsonKeyTable
+{
+    std::pmr::monotonic_buffer_resource arena;
+    std::unordered_set<std::string_view, JsonKeyHash, std::equal_to<>> keys;
+public:
+    JsonKeyTable() = default;
+    JsonKeyTable(const JsonKeyTable&) = delete;
+    JsonKeyTable& operator=(const JsonKeyTable&) = delete;
+
+    // Returns a copy of 'key' that stays valid for the table's lifetime.
+    std::string_view Intern(std::string_view key)
+    {
+        auto it = keys.find(key);
+
+        if (it != keys.end())
+            return *it;
+
+        char* p = (char*)arena.allocate(std::max<size_t>(key.size(), 1), 1);
+
+        if (!key.empty())
+            std::memcpy(p, key.data(), key.size());
+
+        return *keys.emplace(p, key.size()).first;
+    }
+
+    // Returns a key whose storage is shared with the table, unless it's short
+    // enough to be stored inline.
+    JsonString MakeKey(std::string_view key) {
+        return JsonString::Shared(key.size() > JsonString::InlineCapacity ? Intern(key) : key);
+    }
+
+    size_t GetSize() const {
+        return keys.size();
+    }
+};
+
+// An object key with its hash computed once, for looking the same key up in
+// many objects. Members whose keys share storage with it through a
+// JsonKeyTable are matched by pointer, without comparing characters.
+class JsonKey
+{
+    std::string_view name;
+    uint32_t hash;
+public:
+    explicit JsonKey(std::string_view name)
+        : name(name), hash((uint32_t)JsonKeyHash()(name)) {}
+
+    std::string_view GetName() const {
+        return name;
+    }
+
+    uint32_t GetHash() const {
+        return hash;
+    }
+};
+
+// Insertion-ordered object storage. Members are kept in a contiguous vector
+// of key/value pairs, so small objects cost a single allocation and iterate
+// in the order they were added. Lookups scan linearly until the object grows
+// past IndexThreshold members, at which point an open-addressing hash index
+// over the vector is built and kept up to date by later insertions.
+//
+// Keys must not be modified through iterators. Erasing shifts the following
+// members down and invalidates iterators past the erased position.
+class JsonObject
+{
+public:
+    using key_type = JsonString;
+    using mapped_type = Json;
+    using value_type = std::pair<JsonString, Json>;
+    using size_type = size_t;
+    using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+    using iterator = std::pmr::vector<value_type>::iterator;
+    using const_iterator = std::pmr::vector<value_type>::const_iterator;
+
+    static constexpr size_t IndexThreshold = 16;
+
+private:
+    // 'pos' is the member's position plus one, so that zero marks an empty slot.
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t pos;
+    };
+
+    std::pmr::vector<value_type> members;
+    std::pmr::vector<Slot> index;
+
+    static uint32_t Hash(std::string_view key) {
+        return (uint32_t)JsonKeyHash()(key);
+    }
+
+    static bool KeyEquals(const JsonString& a, std::string_view b) {
+        return a.size() == b.size() && (a.data() == b.data() || std::memcmp(a.data(), b.data(), b.size()) == 0);
+    }
+
+    size_t FindPos(std::string_view key) const;
+    size_t FindPos(std::string_view key, uint32_t hash) const;
+    void IndexMember(size_t pos, uint32_t hash);
+    void RebuildIndex();
+    void OnInsert();
+
+    template<class K, class... Args>
+    std::pair<iterator, bool> TryEmplace(K&& key, Args&&... args);
+
+public:
+    JsonObject(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : members(resource), index(resource) {}
+
+    JsonObject(const JsonObject& other, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : members(other.members, resource), index(other.index, resource) {}
+
+    JsonObject(JsonObject&& other) noexcept = default;
+
+    JsonObject(JsonObject&& other, std::pmr::memory_resource* resource)
+        : members(std::move(other.members), resource), index(std::move(other.index), resource) {}
+
+    JsonObject& operator=(const JsonObject& other) = default;
+    JsonObject& operator=(JsonObject&& other) = default;
+
+    allocator_type get_allocator() const {
+        return members.get_allocator();
+    }
+
+    iterator begin() { return members.begin(); }
+    iterator end() { return members.end(); }
+    const_iterator begin() const { return members.begin(); }
+    const_iterator end() const { return members.end(); }
+    const_iterator cbegin() const { return members.cbegin(); }
+    const_iterator cend() const { return members.cend(); }
+
+    size_t size() const {
+        return members.size();
+    }
+
+    bool empty() const {
+        return members.empty();
+    }
+
+    void reserve(size_t count) {
+        members.reserve(count);
+    }
+
+    void clear()
+    {
+        members.clear();
+        index.clear();
+    }
+
+    iterator find(std::string_view key);
+    const_iterator find(std::string_view key) const;
+
+    iterator find(const JsonKey& key);
+    const_iterator find(const JsonKey& key) const;
+
+    bool contains(std::string_view key) const {
+        return FindPos(key) != members.size();
+    }
+
+    bool contains(const JsonKey& key) const {
+        return FindPos(key.GetName(), key.GetHash()) != members.size();
+    }
+
+    size_t count(std::string_view key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    Json& at(std::string_view key);
+    const Json& at(std::string_view key) const;
+
+    Json& operator[](std::string_view key);
+    Json& operator[](JsonString&& key);
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(std::string_view key, Args&&... args) {
+        return TryEmplace(key, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(JsonString&& key, Args&&... args) {
+        return TryEmplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<class V>
+    std::pair<iterator, bool> insert_or_assign(std::string_view key, V&& value);
+
+    template<class V>
+    std::pair<iterator, bool> insert_or_assign(JsonString&& key, V&& value);
+
+    iterator erase(const_iterator it);
+    size_t erase(std::string_view key);
+};
+
+// A Json value is a 16-byte tagged node. Numbers, booleans and strings of up
+// to JsonString::InlineCapacity bytes are stored in the node itself, while
+// objects, arrays and longer strings are stored out of line. That keeps
+// arrays of numbers and small objects dense in memory.
+//
+// Strings and containers are allocator-aware through std::pmr, so a whole
+// tree can be placed in a single arena (see JsonDocument). Copying a Json
+// always copies into the default resource; moving keeps the source's
+// memory resource.
+class Json
+{
+public:
+    using NullType = std::nullptr_t;
+    using StringType = JsonString;
+    using ObjectType = JsonObject;
+    using ArrayType = std::pmr::vector<Json>;
+    using IntegerType = int64_t;
+    using FloatType = double;
+    using BooleanType = bool;
+
+    friend class JsonParser;
+
+private:
+    // Holds an IntegerType, FloatType, BooleanType or StringType, or a
+    // pointer to an ObjectType or ArrayType, depending on 'type'. For
+    // containers, storage[SharedFlag] is set when the container is shared
+    // (see Share), in which case its reference count precedes it in memory.
+    alignas(8) unsigned char storage[15];
+    JsonDataType type = JsonDataType::Null;
+
+    static constexpr size_t SharedFlag = sizeof(void*);
+
+    template<class T>
+    static constexpr size_t SharedOffset = (sizeof(std::atomic<size_t>) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+    template<class T>
+    T* Storage() {
+        return std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    template<class T>
+    const T* Storage() const {
+        return std::launder(reinterpret_cast<const T*>(storage));
+    }
+
+    template<class T, class... Args>
+    void Construct(JsonDataType t, Args&&... args)
+    {
+        assert(type == JsonDataType::Null);
+        new (storage) T(std::forward<Args>(args)...);
+        type = t;
+    }
+
+    // Allocates a container from 'resource', which must be the same resource
+    // the container is constructed with so that it can be freed later.
+    template<class T, class... Args>
+    void ConstructBox(JsonDataType t, std::pmr::memory_resource* resource, Args&&... args)
+    {
+        assert(type == JsonDataType::Null);
+        void* mem = resource->allocate(sizeof(T), alignof(T));
+
+        try {
+            Construct<T*>(t, new (mem) T(std::forward<Args>(args)..., resource));
+            storage[SharedFlag] = 0;
+        }
+        catch (...) {
+            resource->deallocate(mem, sizeof(T), alignof(T));
+            throw;
+        }
+    }
+
+    template<class T>
+    static void DestroyBox(T* box)
+    {
+        auto resource = box->get_allocator().resource();
+        box->~T();
+        resource->deallocate(box, sizeof(T), alignof(T));
+    }
+
+    bool IsSharedBox() const {
+        return (type == JsonDataType::Object || type == JsonDataType::Array) && storage[SharedFlag];
+    }
+
+    // True when both values refer to the same shared container, which
+    // means they're equal without looking at their contents.
+    bool SharesBoxWith(const Json& other) const {
+        return IsSharedBox() && other.type == type && other.IsSharedBox()
+            && std::memcmp(storage, other.storage, sizeof(void*)) == 0;
+    }
+
+    // Finds the value selected by the first 'count' steps of 'path', taking
+    // each step literally, or returns nullptr if there isn't one.
+    template<class Value>
+    static Value* FindPatchTarget(Value& root, const JsonPointer& path, size_t count);
+
+    // With 'numeric', integers and floats compare by value like JSON Patch's
+    // "test". Without it, they're never equal, as Diff needs so that
+    // changing one into the other isn't lost.
+    bool Equals(const Json& other, bool numeric) const;
+
+    static void Diff(const Json& from, const Json& to, std::string& path, ArrayType& patch);
+    void ApplyPatchOperation(const Json& operation);
+    void AddAt(const JsonPointer& path, Json&& value);
+    Json RemoveAt(const JsonPointer& path);
+
+    template<class T>
+    static std::atomic<size_t>& SharedRefs(T* box) {
+        return *std::launder(reinterpret_cast<std::atomic<size_t>*>(reinterpret_cast<char*>(box) - SharedOffset<T>));
+    }
+
+    // Moves this value's container into a block with a reference count.
+    template<class T>
+    void ShareBox()
+    {
+        T* box = *Storage<T*>();
+        auto resource = box->get_allocator().resource();
+        char* mem = (char*)resource->allocate(SharedOffset<T> + sizeof(T), alignof(T));
+        new (mem) std::atomic<size_t>(1);
+        T* shared = new (mem + SharedOffset<T>) T(std::move(*box), resource);
+
+        DestroyBox(box);
+        *Storage<T*>() = shared;
+        storage[SharedFlag] = 1;
+    }
+
+    template<class T>
+    static void ReleaseSharedBox(T* box)
+    {
+        auto& refs = SharedRefs(box);
+
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            auto resource = box->get_allocator().resource();
+            box->~T();
+            refs.~atomic();
+            resource->deallocate(&refs, SharedOffset<T> + sizeof(T), alignof(T));
+        }
+    }
+
+    // Gives this value a container of its own before it's modified. The
+    // elements of a copy are still shared, so this only copies one level.
+    template<class T>
+    void UnshareBox()
+    {
+        T* box = *Storage<T*>();
+        Json tmp;
+
+        if (SharedRefs(box).load(std::memory_order_acquire) == 1)
+            tmp.ConstructBox<T>(type, box->get_allocator().resource(), std::move(*box));
+        else
+            tmp.ConstructBox<T>(type, std::pmr::get_default_resource(), std::as_const(*box));
+
+        Destroy();
+        MoveFrom(tmp);
+    }
+
+    void Destroy()
+    {
+        if (type == JsonDataType::Object)
+        {
+            if (storage[SharedFlag])
+                ReleaseSharedBox(*Storage<ObjectType*>());
+            else
+                DestroyBox(*Storage<ObjectType*>());
+        }
+        else if (type == JsonDataType::Array)
+        {
+            if (storage[SharedFlag])
+                ReleaseSharedBox(*Storage<ArrayType*>());
+            else
+                DestroyBox(*Storage<ArrayType*>());
+        }
+        else if (type == JsonDataType::String)
+        {
+            Storage<StringType>()->~StringType();
+        }
+
+        type = JsonDataType::Null;
+    }
+
+    void CopyFrom(const Json& other)
+    {
+        auto resource = std::pmr::get_default_resource();
+
+        if (other.IsSharedBox())
+        {
+            if (other.type == JsonDataType::Object)
+                SharedRefs(*other.Storage<ObjectType*>()).fetch_add(1, std::memory_order_relaxed);
+            else
+                SharedRefs(*other.Storage<ArrayType*>()).fetch_add(1, std::memory_order_relaxed);
+
+            std::memcpy(storage, other.storage, sizeof(storage));
+            type = other.type;
+            return;
+        }
+
+        switch (other.type)
+        {
+        case JsonDataType::Object:
+            ConstructBox<ObjectType>(other.type, resource, other.GetObject());
+            break;
+        case JsonDataType::Array:
+            ConstructBox<ArrayType>(other.type, resource, other.GetArray());
+            break;
+        case JsonDataType::String:
+            Construct<StringType>(other.type, other.GetString());
+            break;
+        default:
+            std::memcpy(storage, other.storage, sizeof(storage));
+            type = other.type;
+            break;
+        }
+    }
+
+    void MoveFrom(Json& other) noexcept
+    {
+        if (other.type == JsonDataType::String)
+        {
+            Construct<StringType>(other.type, std::move(other.GetString()));
+            other.Destroy();
+        }
+        else
+        {
+            // everything else is a scalar or a pointer to a container
+            std::memcpy(storage, other.storage, sizeof(storage));
+            type = other.type;
+            other.type = JsonDataType::Null;
+        }
+    }
+
+    [[noreturn]] static void ThrowTypeError(const char* expected) {
+        throw std::runtime_error(std::string("json value is not ") + expected);
+    }
+
+    template<class Obj, class Key>
+    static auto FindOrThrow(Obj& obj, const Key& key)
+    {
+        auto it = obj.find(key);
+        if (it == obj.end())
+            throw std::out_of_range("key not found");
+
+        return it;
+    }
+
+public:
+    Json(nullptr_t = nullptr) {}
+
+    Json(const ObjectType& obj) {
+        ConstructBox<ObjectType>(JsonDataType::Object, std::pmr::get_default_resource(), obj);
+    }
+
+    Json(ObjectType&& obj) {
+        ConstructBox<ObjectType>(JsonDataType::Object, obj.get_allocator().resource(), std::move(obj));
+    }
+
+    Json(const ArrayType& arr) {
+        ConstructBox<ArrayType>(JsonDataType::Array, std::pmr::get_default_resource(), arr);
+    }
+
+    Json(ArrayType&& arr) {
+        ConstructBox<ArrayType>(JsonDataType::Array, arr.get_allocator().resource(), std::move(arr));
+    }
+
+    Json(const StringType& str) {
+        Construct<StringType>(JsonDataType::String, str);
+    }
+
+    Json(StringType&& str) {
+        Construct<StringType>(JsonDataType::String, std::move(str));
+    }
+
+    template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    Json(const T& integer) {
+        Construct<IntegerType>(JsonDataType::Integer, (IntegerType)integer);
+    }
+
+    template<class T> requires std::is_floating_point_v<T>
+    Json(T floating) {
+        Construct<FloatType>(JsonDataType::Float, (FloatType)floating);
+    }
+
+    template<class T> requires std::is_same_v<T, BooleanType>
+    Json(T boolean) {
+        Construct<BooleanType>(JsonDataType::Boolean, boolean);
+    }
+
+    Json(const Json& other) {
+        CopyFrom(other);
+    }
+
+    Json(Json&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    ~Json() {
+        Destroy();
+    }
+
+    Json& operator=(const Json& other)
+    {
+        if (this != &other)
+        {
+            Json tmp(other);
+            *this = std::move(tmp);
+        }
+
+        return *this;
+    }
+
+    Json& operator=(Json&& other) noexcept
+    {
+        if (this != &other)
+        {
+            // 'other' may be a child of this value, so detach it before destroying anything
+            Json tmp(std::move(other));
+            Destroy();
+            MoveFrom(tmp);
+        }
+
+        return *this;
+    }
+
+    template<class T, class S = std::decay_t<T>> requires (
+        !std::is_same_v<S, Json> &&
+        !std::is_integral_v<S> &&
+        !std::is_same_v<S, BooleanType> &&
+        !std::is_floating_point_v<S>)
+    Json(T&& val) : Json() {
+        to_json(*this, std::forward<T>(val));
+    }
+
+    static Json Object(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        Json ret;
+        ret.ConstructBox<ObjectType>(JsonDataType::Object, resource);
+        return ret;
+    }
+
+    static Json Array(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        Json ret;
+        ret.ConstructBox<ArrayType>(JsonDataType::Array, resource);
+        return ret;
+    }
+
+    static Json String() {
+        Json ret;
+        ret.Construct<StringType>(JsonDataType::String);
+        return ret;
+    }
+
+    template<class T> requires (!std::is_same_v<std::decay_t<T>, Json>)
+    Json& operator=(T&& val) {
+        to_json(*this, std::forward<T>(val));
+        return *this;
+    }
+
+    using StringValueType = StringType::value_type;
+
+    template<class T> requires (
+        !std::is_same_v<T, Json>
+        && !std::is_void_v<T>
+        && !std::is_pointer_v<T>
+        && !std::is_same_v<T, std::nullptr_t>
+        && !std::is_same_v<T, StringValueType>
+        && !is_initializer_list<T>
+        && !std::is_same_v<T, std::string_view>
+        )
+    operator T() const {
+        return Get<T>();
+    }
+
+    static Json Parse(std::string_view text, const JsonParseOptions& options = {}) {
+        JsonParser parser(text, options);
+        return parser.Parse();
+    }
+
+    // Parses without throwing on malformed input. Check the result before
+    // using its value.
+    static JsonParseResult TryParse(std::string_view text, const JsonParseOptions& options = {});
+
+    // Parses a file through a memory mapping instead of reading it into a
+    // buffer first. Strings are decoded into the returned value, so it
+    // doesn't refer to the file once this returns.
+    static Json ParseFile(const std::filesystem::path& path, const JsonParseOptions& options = {}) {
+        JsonMappedFile file(path);
+        return Parse(file.GetText(), options);
+    }
+
+    static Json Parse(const char* text, size_t length, const JsonParseOptions& options = {}) {
+        JsonParser parser(text, length, options);
+        return parser.Parse();
+    }
+
+    // Parses a buffer that the caller is done with, like RapidJSON's in situ
+    // parsing. Strings are unescaped into the buffer over their own text,
+    // and strings and keys too long to store inline refer to it instead of
+    // being allocated. This overwrites the buffer, which must then outlive
+    // the returned value, and any string moved out of it, without being
+    // modified. Copying a value or modifying a string gives it its own storage.
+    static Json ParseInSitu(char* text, size_t length, const JsonParseOptions& options = {}) {
+        JsonParser parser(options);
+        parser.ResetInSitu(text, length);
+        return parser.Parse();
+    }
+
+    // See JsonPrinter for 'threadCount'.
+    std::string Dump(int indent = -1, unsigned threadCount = 1) const
+    {
+        JsonPrinter printer(indent, threadCount);
+        return printer.ToString(*this);
+    }
+
+    // Prints into 'str', replacing its contents but keeping its capacity.
+    void Dump(std::string& str, int indent = -1) const
+    {
+        JsonPrinter printer(indent);
+        printer.ToString(*this, str);
+    }
+
+    // Encodes this value as CBOR. See JsonCborWriter.
+    std::string ToCbor() const
+    {
+        JsonCborWriter writer;
+        return writer.ToString(*this);
+    }
+
+    // Decodes a value from CBOR. See JsonCborReader.
+    static Json FromCbor(std::string_view data, const JsonParseOptions& options = {})
+    {
+        JsonCborReader reader(data, options);
+        return reader.Read();
+    }
+
+    JsonDataType GetType() const {
+        return type;
+    }
+
+    bool IsNull() const {
+        return type == JsonDataType::Null;
+    }
+
+    bool IsObject() const {
+        return type == JsonDataType::Object;
+    }
+
+    bool IsArray() const {
+        return type == JsonDataType::Array;
+    }
+
+    bool IsString() const {
+        return type == JsonDataType::String;
+    }
+
+    bool IsInteger() const {
+        return type == JsonDataType::Integer;
+    }
+
+    bool IsFloat() const {
+        return type == JsonDataType::Float;
+    }
+
+    bool IsBoolean() const {
+        return type == JsonDataType::Boolean;
+    }
+
+    // Makes the objects and arrays in this value immutable and reference
+    // counted, so that copying it or anything in it takes constant time and
+    // the copies can be read on several threads at once without locking.
+    // A shared container is copied the first time it's accessed through a
+    // non-const accessor of a value (copy-on-write), but only that one level
+    // is copied, since the elements of the copy are still shared. Read
+    // shared values through const references to avoid unsharing them.
+    Json& Share()
+    {
+        // the elements of a shared container are already shared
+        if (type == JsonDataType::Object && !storage[SharedFlag])
+        {
+            for (auto& member : **Storage<ObjectType*>())
+                member.second.Share();
+
+            ShareBox<ObjectType>();
+        }
+        else if (type == JsonDataType::Array && !storage[SharedFlag])
+        {
+            for (auto& element : **Storage<ArrayType*>())
+                element.Share();
+
+            ShareBox<ArrayType>();
+        }
+
+        return *this;
+    }
+
+    // True when this value is an object or array shared by Share().
+    bool IsShared() const {
+        return IsSharedBox();
+    }
+
+    // Compares values deeply. Objects are equal when they have the same
+    // members in any order, and integers and floats compare numerically.
+    bool Equals(const Json& other) const;
+
+    // Returns a JSON Patch (RFC 6902) that turns 'from' into 'to', as an
+    // array of operations. Integers and floats are kept distinct, so 1 and
+    // 1.0 differ here even though Equals considers them equal. Containers that 'from' and 'to' share (see
+    // Share) are skipped without comparing their contents, so diffing two
+    // versions of a shared document only visits the parts that changed.
+    static Json Diff(const Json& from, const Json& to);
+
+    // Applies a JSON Patch (RFC 6902) to this value in place. The patch is
+    // all or nothing: if an operation fails, this throws and leaves the
+    // value as it was. The operations are applied to a copy that shares
+    // this value (see Share), so only the containers along the patched
+    // paths are copied, and this value is left shared.
+    void ApplyPatch(const Json& patch);
+
+    // Applies a JSON Merge Patch (RFC 7386) to this value in place.
+    void MergePatch(const Json& patch);
+
+    Json& GetAt(size_t index) {
+        return GetArray().at(index);
+    }
+
+    const Json& GetAt(size_t index) const {
+        return GetArray().at(index);
+    }
+
+    Json& GetAt(std::string_view key) {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+
+    const Json& GetAt(std::string_view key) const {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+
+    Json& GetAt(const JsonKey& key) {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+
+    const Json& GetAt(const JsonKey& key) const {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+    
+    Json& operator[](size_t index)
+    {
+        if (IsNull())
+            *this = Array();
+
+        if (index >= GetArray().size())
+            GetArray().resize(index + 1);
+
+        return GetArray()[index];
+    }
+
+    const Json& operator[](size_t index) const {
+        return GetArray().at(index);
+    }
+
+    Json& operator[](std::string_view key)
+    {
+        if (IsNull())
+            *this = Object();
+
+        return GetObject()[key];
+    }
+
+    Json& operator[](const char* key) {
+        return (*this)[std::string_view(key)];
+    }
+
+    const Json& operator[](std::string_view key) const {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+
+    const Json& operator[](const char* key) const {
+        return FindOrThrow(GetObject(), key)->second;
+    }
+    
+    ObjectType& GetObject()
+    {
+        if (type != JsonDataType::Object)
+            ThrowTypeError("an object");
+
+        if (storage[SharedFlag])
+            UnshareBox<ObjectType>();
+
+        return **Storage<ObjectType*>();
+    }
+
+    const ObjectType& GetObject() const
+    {
+        if (type != JsonDataType::Object)
+            ThrowTypeError("an object");
+
+        return **Storage<ObjectType*>();
+    }
+
+    ArrayType& GetArray()
+    {
+        if (type != JsonDataType::Array)
+            ThrowTypeError("an array");
+
+        if (storage[SharedFlag])
+            UnshareBox<ArrayType>();
+
+        return **Storage<ArrayType*>();
+    }
+
+    const ArrayType& GetArray() const
+    {
+        if (type != JsonDataType::Array)
+            ThrowTypeError("an array");
+
+        return **Storage<ArrayType*>();
+    }
+
+    StringType& GetString()
+    {
+        if (type != JsonDataType::String)
+            ThrowTypeError("a string");
+
+        return *Storage<StringType>();
+    }
+
+    const StringType& GetString() const
+    {
+        if (type != JsonDataType::String)
+            ThrowTypeError("a string");
+
+        return *Storage<StringType>();
+    }
+
+    IntegerType& GetInteger()
+    {
+        if (type != JsonDataType::Integer)
+            ThrowTypeError("an integer");
+
+        return *Storage<IntegerType>();
+    }
+
+    const IntegerType& GetInteger() const
+    {
+        if (type != JsonDataType::Integer)
+            ThrowTypeError("an integer");
+
+        return *Storage<IntegerType>();
+    }
+
+    FloatType& GetFloat()
+    {
+        if (type != JsonDataType::Float)
+            ThrowTypeError("a float");
+
+        return *Storage<FloatType>();
+    }
+
+    const FloatType& GetFloat() const
+    {
+        if (type != JsonDataType::Float)
+            ThrowTypeError("a float");
+
+        return *Storage<FloatType>();
+    }
+
+    BooleanType& GetBoolean()
+    {
+        if (type != JsonDataType::Boolean)
+            ThrowTypeError("a boolean");
+
+        return *Storage<BooleanType>();
+    }
+
+    const BooleanType& GetBoolean() const
+    {
+        if (type != JsonDataType::Boolean)
+            ThrowTypeError("a boolean");
+
+        return *Storage<BooleanType>();
+    }
+
+    template<class T>
+    T Get() const
+    {
+        if constexpr (std::is_same_v<T, Json>)
+        {
+            return *this;
+        }
+        else
+        {
+            T val;
+            from_json(*this, val);
+            return val;
+        }
+    }
+
+    template<class T>
+    T Get(T defaultValue) const
+    {
+        T val;
+        
+        if (!IsNull())
+            from_json(*this, val);
+        else
+            val = defaultValue;
+
+        return val;
+    }
+
+    // Like Get<T>(), but moves strings, containers and their elements out
+    // of this value instead of copying them. Afterwards this value is still
+    // valid, but its contents are unspecified.
+    template<class T>
+    T Take()
+    {
+        if constexpr (std::is_same_v<T, Json>)
+        {
+            return std::move(*this);
+        }
+        else
+        {
+            T val;
+            from_json(std::move(*this), val);
+            return val;
+        }
+    }
+
+    template<class T>
+    T GetValue(std::string_view key, T defaultValue) const
     {
         T ret;
 
-        auto it = GetObject().find(key);
-        if (it != GetObject().end()) {
-            ret = it->second.Get<T>();
-        }
-        else {
-            ret = std::move(defaultValue);
+        auto it = GetObject().find(key);
+        if (it != GetObject().end()) {
+            ret = it->second.Get<T>();
+        }
+        else {
+            ret = std::move(defaultValue);
+        }
+
+        return ret;
+    }
+
+    bool IsEmpty() const
+    {
+        if (IsObject())
+            return GetObject().empty();
+        else if (IsArray())
+            return GetArray().empty();
+        else if (IsString())
+            return GetString().empty();
+        else if (IsNull())
+            return true;
+        else // IsInteger() || IsFloat() || IsBoolean()
+            return false;
+    }
+
+    size_t GetSize() const
+    {
+        if (IsObject())
+            return GetObject().size();
+        else if (IsArray())
+            return GetArray().size();
+        else if (IsString())
+            return GetString().size();
+        else if (IsNull())
+            return 0;
+        else // IsInteger() || IsFloat() || IsBoolean()
+            return 1;
+    }
+
+    void Clear()
+    {
+        if (IsObject())
+            GetObject().clear();
+        else if (IsArray())
+            GetArray().clear();
+        else if (IsString())
+            GetString().clear();
+        else if (IsInteger())
+            GetInteger() = 0;
+        else if (IsFloat())
+            GetFloat() = 0;
+        else if (IsBoolean())
+            GetBoolean() = false;
+    }
+    
+    void PushBack(const Json& val)
+    {
+        if (IsNull())
+            *this = Array();
+
+        GetArray().push_back(val);
+    }
+
+    void PushBack(Json&& val)
+    {
+        if (IsNull())
+            *this = Array();
+
+        GetArray().push_back(std::move(val));
+    }
+    
+    template<class ObjectIter, class ArrayIter, class NullIter = std::nullptr_t>
+    class base_const_iterator
+    {
+        std::variant<NullIter, ObjectIter, ArrayIter> var;
+    public:
+        base_const_iterator() : var(NullIter{}){}
+        base_const_iterator(ObjectIter it) : var(it){}
+        base_const_iterator(ArrayIter it) : var(it){}
+
+        bool IsNullIter() const {
+            return std::holds_alternative<NullIter>(var);
+        }
+
+        bool IsObjectIter() const {
+            return std::holds_alternative<ObjectIter>(var);
+        }
+
+        bool IsArrayIter() const {
+            return std::holds_alternative<ArrayIter>(var);
+        }
+
+        NullIter GetNullIter() const {
+            return std::get<NullIter>(var);
+        }
+
+        ObjectIter GetObjectIter() const {
+            return std::get<ObjectIter>(var);
+        }
+
+        ObjectIter& GetObjectIter() {
+            return std::get<ObjectIter>(var);
+        }
+
+        ArrayIter GetArrayIter() const {
+            return std::get<ArrayIter>(var);
+        }
+
+        ArrayIter& GetArrayIter() {
+            return std::get<ArrayIter>(var);
+        }
+
+        const ObjectType::key_type& key() const {
+            return GetObjectIter()->first;
+        }
+
+        const Json& value() const
+        {
+            if (IsObjectIter())
+                return GetObjectIter()->second;
+            else if (IsArrayIter())
+                return *GetArrayIter();
+
+            throw std::runtime_error("null");
+        }
+
+        const Json& operator*() const {
+            return value();
+        }
+
+        const Json* operator->() const {
+            return &value();
+        }
+
+        base_const_iterator operator++(int)
+        {
+            base_const_iterator ret = *this;
+
+            if (IsObjectIter())
+                ++GetObjectIter();
+            else if (IsArrayIter())
+                ++GetArrayIter();
+            else
+                throw std::runtime_error("null");
+
+            return ret;
+        }
+
+        base_const_iterator& operator++()
+        {
+            if (IsObjectIter())
+                ++GetObjectIter();
+            else if (IsArrayIter())
+                ++GetArrayIter();
+            else
+                throw std::runtime_error("null");
+
+            return *this;
+        }
+
+        bool operator==(const base_const_iterator& it) const
+        {
+            assert(var.index() == it.var.index());
+
+            bool result;
+
+            if (IsObjectIter() && it.IsObjectIter())
+                result = GetObjectIter() == it.GetObjectIter();
+            else if (IsArrayIter() && it.IsArrayIter())
+                result = GetArrayIter() == it.GetArrayIter();
+            else
+                result = GetNullIter() == it.GetNullIter();
+
+            return result;
+        }
+
+        bool operator!=(const base_const_iterator& it) const {
+            return !(*this == it);
+        }
+    };
+
+    template<class ObjectIter, class ArrayIter>
+    class base_iterator : public base_const_iterator<ObjectIter, ArrayIter>
+    {
+    public:
+        Json& value()
+        {
+            if (this->IsObjectIter())
+                return this->GetObjectIter()->second;
+            else if (this->IsArrayIter())
+                return *this->GetArrayIter();
+
+            throw std::runtime_error("null");
+        }
+
+        Json& operator*() {
+            return value();
+        }
+
+        Json* operator->() {
+            return &value();
+        }
+    };
+
+    using const_iterator = base_const_iterator<ObjectType::const_iterator, ArrayType::const_iterator>;
+    using iterator = base_iterator<ObjectType::iterator, ArrayType::iterator>;
+
+    iterator begin()
+    {
+        if(IsObject())
+            return { GetObject().begin() };
+        else if(IsArray())
+            return { GetArray().begin() };
+
+        return {};
+    }
+
+    iterator end()
+    {
+        if(IsObject())
+            return { GetObject().end() };
+        else if(IsArray())
+            return { GetArray().end() };
+
+        return {};
+    }
+
+    const_iterator begin() const
+    {
+        if(IsObject())
+            return { GetObject().cbegin() };
+        else if(IsArray())
+            return { GetArray().cbegin() };
+
+        return {};
+    }
+
+    const_iterator end() const
+    {
+        if(IsObject())
+            return { GetObject().cend() };
+        else if(IsArray())
+            return { GetArray().cend() };
+
+        return {};
+    }
+
+    const_iterator find(std::string_view key) const
+    {
+        if (IsObject())
+            return { GetObject().find(key) };
+        
+        return {};
+    }
+
+    iterator find(std::string_view key)
+    {
+        if (IsObject())
+            return { GetObject().find(key) };
+
+        return {};
+    }
+
+    const_iterator find(const JsonKey& key) const
+    {
+        if (IsObject())
+            return { GetObject().find(key) };
+
+        return {};
+    }
+
+    iterator find(const JsonKey& key)
+    {
+        if (IsObject())
+            return { GetObject().find(key) };
+
+        return {};
+    }
+};
+
+static_assert(sizeof(Json) == 16);
+
+// Returned by Json::TryParse. Converts to true when parsing succeeded.
+struct JsonParseResult
+{
+    Json value;
+    JsonError error;
+
+    explicit operator bool() const {
+        return !error;
+    }
+};
+
+inline JsonParseResult Json::TryParse(std::string_view text, const JsonParseOptions& options)
+{
+    JsonParseResult result;
+    JsonParser parser(text, options);
+
+    if (!parser.TryParse(result.value))
+        result.error = parser.GetError();
+
+    return result;
+}
+
+inline size_t JsonObject::FindPos(std::string_view key) const
+{
+    // small objects aren't indexed, so don't pay for the hash
+    return FindPos(key, index.empty() ? 0 : Hash(key));
+}
+
+inline size_t JsonObject::FindPos(std::string_view key, uint32_t hash) const
+{
+    if (index.empty())
+    {
+        for (size_t i = 0; i != members.size(); ++i)
+        {
+            if (KeyEquals(members[i].first, key))
+                return i;
+        }
+
+        return members.size();
+    }
+
+    size_t mask = index.size() - 1;
+
+    for (size_t i = hash & mask; index[i].pos; i = (i + 1) & mask)
+    {
+        if (index[i].hash == hash && KeyEquals(members[index[i].pos - 1].first, key))
+            return index[i].pos - 1;
+    }
+
+    return members.size();
+}
+
+inline void JsonObject::IndexMember(size_t pos, uint32_t hash)
+{
+    size_t mask = index.size() - 1;
+    size_t i = hash & mask;
+
+    while (index[i].pos)
+        i = (i + 1) & mask;
+
+    index[i] = Slot{ hash, (uint32_t)(pos + 1) };
+}
+
+inline void JsonObject::RebuildIndex()
+{
+    index.clear();
+
+    if (members.size() < IndexThreshold)
+        return;
+
+    if (members.size() >= UINT32_MAX / 2)
+        throw std::length_error("json object is too large");
+
+    // keep the load factor at or below one half
+    index.resize(std::bit_ceil(members.size() * 2));
+
+    for (size_t i = 0; i != members.size(); ++i)
+        IndexMember(i, Hash(members[i].first));
+}
+
+// Called after a member has been appended.
+inline void JsonObject::OnInsert()
+{
+    if (members.size() * 2 > index.size())
+        RebuildIndex();
+    else
+        IndexMember(members.size() - 1, Hash(members.back().first));
+}
+
+template<class K, class... Args>
+inline std::pair<JsonObject::iterator, bool> JsonObject::TryEmplace(K&& key, Args&&... args)
+{
+    size_t pos = FindPos(key);
+    if (pos != members.size())
+        return { members.begin() + pos, false };
+
+    auto resource = members.get_allocator().resource();
+
+    if constexpr (std::is_same_v<std::decay_t<K>, JsonString>)
+        members.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+    else
+        members.emplace_back(std::piecewise_construct, std::forward_as_tuple(key, resource), std::forward_as_tuple(std::forward<Args>(args)...));
+
+    OnInsert();
+    return { members.end() - 1, true };
+}
+
+inline JsonObject::iterator JsonObject::find(std::string_view key) {
+    return members.begin() + FindPos(key);
+}
+
+inline JsonObject::const_iterator JsonObject::find(std::string_view key) const {
+    return members.begin() + FindPos(key);
+}
+
+inline JsonObject::iterator JsonObject::find(const JsonKey& key) {
+    return members.begin() + FindPos(key.GetName(), key.GetHash());
+}
+
+inline JsonObject::const_iterator JsonObject::find(const JsonKey& key) const {
+    return members.begin() + FindPos(key.GetName(), key.GetHash());
+}
+
+inline Json& JsonObject::at(std::string_view key)
+{
+    size_t pos = FindPos(key);
+    if (pos == members.size())
+        throw std::out_of_range("key not found");
+
+    return members[pos].second;
+}
+
+inline const Json& JsonObject::at(std::string_view key) const
+{
+    size_t pos = FindPos(key);
+    if (pos == members.size())
+        throw std::out_of_range("key not found");
+
+    return members[pos].second;
+}
+
+inline Json& JsonObject::operator[](std::string_view key) {
+    return TryEmplace(key).first->second;
+}
+
+inline Json& JsonObject::operator[](JsonString&& key) {
+    return TryEmplace(std::move(key)).first->second;
+}
+
+template<class V>
+inline std::pair<JsonObject::iterator, bool> JsonObject::insert_or_assign(std::string_view key, V&& value)
+{
+    auto result = TryEmplace(key);
+    result.first->second = std::forward<V>(value);
+    return result;
+}
+
+template<class V>
+inline std::pair<JsonObject::iterator, bool> JsonObject::insert_or_assign(JsonString&& key, V&& value)
+{
+    auto result = TryEmplace(std::move(key), std::forward<V>(value));
+    if (!result.second)
+        result.first->second = std::forward<V>(value);
+
+    return result;
+}
+
+inline JsonObject::iterator JsonObject::erase(const_iterator it)
+{
+    auto ret = members.erase(it);
+    RebuildIndex();
+    return ret;
+}
+
+inline size_t JsonObject::erase(std::string_view key)
+{
+    size_t pos = FindPos(key);
+    if (pos == members.size())
+        return 0;
+
+    erase(members.begin() + pos);
+    return 1;
+}
+
+
+inline void to_json(Json& obj, const Json::ObjectType& val) {
+    obj = Json(val);
+}
+
+inline void from_json(const Json& obj, Json::ObjectType& val) {
+    val = obj.GetObject();
+}
+
+inline void from_json(Json&& obj, Json::ObjectType& val) {
+    val = std::move(obj.GetObject());
+}
+
+inline void to_json(Json& obj, const Json::ArrayType& val) {
+    obj = Json(val);
+}
+
+inline void from_json(const Json& obj, Json::ArrayType& val) {
+    val = obj.GetArray();
+}
+
+inline void from_json(Json&& obj, Json::ArrayType& val) {
+    val = std::move(obj.GetArray());
+}
+
+template<class T> requires std::is_constructible_v<typename Json::StringType, T>
+inline void to_json(Json& obj, const T& val) {
+    obj = Json(Json::StringType(val));
+}
+
+inline void from_json(const Json& obj, Json::StringType& val) {
+    val = obj.GetString();
+}
+
+inline void from_json(Json&& obj, Json::StringType& val) {
+    val = std::move(obj.GetString());
+}
+
+inline void from_json(const Json& obj, std::string& val) {
+    val = obj.GetString();
+}
+
+template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+inline void to_json(Json& obj, const T& val) {
+    obj = Json((Json::IntegerType)val);
+}
+
+template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+inline void from_json(const Json& obj, T& val) {
+    val = (T)obj.GetInteger();
+}
+
+template<class T> requires std::is_floating_point_v<T>
+inline void to_json(Json& obj, const T& val) {
+    obj = Json((Json::FloatType)val);
+}
+
+template<class T> requires std::is_floating_point_v<T>
+inline void from_json(const Json& obj, T& val) {
+    val = (T)obj.GetFloat();
+}
+
+template<class T> requires std::is_same_v<typename Json::BooleanType, T>
+inline void to_json(Json& obj, const T& val) {
+    obj = Json(val);
+}
+
+template<class T> requires std::is_same_v<typename Json::BooleanType, T>
+inline void from_json(const Json& obj, T& val) {
+    val = obj.GetBoolean();
+}
+
+inline void to_json(Json& obj, const std::nullptr_t& val) {
+    obj = Json();
+}
+
+inline void from_json(const Json& obj, std::nullptr_t& val) {
+    val = nullptr;
+}
+
+template<class T>
+inline void to_json(Json& obj, const std::forward_list<T>& cont)
+{
+    Json val = Json::Array();
+
+    for(auto& elem : cont) {
+        val.PushBack(elem);
+    }
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void to_json(Json& obj, std::forward_list<T>&& cont)
+{
+    Json val = Json::Array();
+
+    for(auto& elem : cont) {
+        val.PushBack(Json(std::move(elem)));
+    }
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void from_json(const Json& obj, std::forward_list<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+
+    for (auto it = arr.rbegin(); it != arr.rend(); ++it) {
+        cont.push_front(it->Get<T>());
+    }
+}
+
+template<class T>
+inline void from_json(Json&& obj, std::forward_list<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+
+    for (auto it = arr.rbegin(); it != arr.rend(); ++it) {
+        cont.push_front(it->Take<T>());
+    }
+}
+
+template<class T>
+inline void to_json(Json& obj, const std::list<T>& cont)
+{
+    Json val = Json::Array();
+    val.GetArray().reserve(cont.size());
+
+    for(auto& elem : cont) {
+        val.PushBack(elem);
+    }
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void to_json(Json& obj, std::list<T>&& cont)
+{
+    Json val = Json::Array();
+    val.GetArray().reserve(cont.size());
+
+    for(auto& elem : cont) {
+        val.PushBack(Json(std::move(elem)));
+    }
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void from_json(const Json& obj, std::list<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+
+    for(auto& val : arr) {
+        cont.push_back(val.Get<T>());
+    }
+}
+
+template<class T>
+inline void from_json(Json&& obj, std::list<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+
+    for(auto& val : arr) {
+        cont.push_back(val.Take<T>());
+    }
+}
+
+template<class T, size_t N>
+inline void to_json(Json& obj, const std::array<T, N>& cont)
+{
+    Json val = Json::Array();
+    val.GetArray().reserve(N);
+
+    for(size_t i = 0; i != N; ++i) {
+        val.PushBack(cont[i]);
+    }
+
+    obj = std::move(val);
+}
+
+template<class T, size_t N>
+inline void from_json(const Json& obj, std::array<T, N>& cont)
+{
+    auto& arr = obj.GetArray();
+    
+    for(size_t i = 0; i != N; ++i) {
+        cont[i] = arr[i].Get<T>();
+    }
+}
+
+template<class T, size_t N>
+inline void from_json(Json&& obj, std::array<T, N>& cont)
+{
+    auto& arr = obj.GetArray();
+    
+    for(size_t i = 0; i != N; ++i) {
+        cont[i] = arr[i].Take<T>();
+    }
+}
+
+template<class T>
+inline void to_json(Json& obj, const std::vector<T>& cont)
+{
+    Json val = Json::Array();
+    val.GetArray().reserve(cont.size());
+
+    for(auto& elem : cont)
+        val.PushBack(elem);
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void to_json(Json& obj, std::vector<T>&& cont)
+{
+    Json val = Json::Array();
+    val.GetArray().reserve(cont.size());
+
+    for(auto& elem : cont)
+        val.PushBack(Json(std::move(elem)));
+
+    obj = std::move(val);
+}
+
+template<class T>
+inline void from_json(const Json& obj, std::vector<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+    cont.reserve(arr.size());
+
+    for(auto& val : arr) {
+        cont.push_back(val.Get<T>());
+    }
+}
+
+template<class T>
+inline void from_json(Json&& obj, std::vector<T>& cont)
+{
+    auto& arr = obj.GetArray();
+    cont.clear();
+    cont.reserve(arr.size());
+
+    for(auto& val : arr) {
+        cont.push_back(val.Take<T>());
+    }
+}
+
+template<class K, class T, class H> requires (std::is_constructible_v<typename Json::StringType, K> || has_to_string<K>::value)
+inline void to_json(Json& obj, const std::unordered_map<K, T, H>& cont)
+{
+    Json ret = Json::Object();
+    auto& objectValue = ret.GetObject();
+    objectValue.reserve(cont.size());
+
+    for(auto& [key, value] : cont)
+    {
+        if constexpr (std::is_constructible_v<typename Json::StringType, K>)
+        {
+            objectValue[Json::StringType(key)] = Json(value);
+        }
+        else
+        {
+            std::string k;
+            to_string(k, key);
+            objectValue[Json::StringType(k)] = Json(value);
+        }
+    }
+
+    obj = std::move(ret);
+}
+
+template<class K, class T, class H> requires (std::is_constructible_v<typename Json::StringType, K> || has_to_string<K>::value)
+inline void to_json(Json& obj, std::unordered_map<K, T, H>&& cont)
+{
+    Json ret = Json::Object();
+    auto& objectValue = ret.GetObject();
+    objectValue.reserve(cont.size());
+
+    for(auto& [key, value] : cont)
+    {
+        if constexpr (std::is_constructible_v<typename Json::StringType, K>)
+        {
+            objectValue[Json::StringType(key)] = Json(std::move(value));
+        }
+        else
+        {
+            std::string k;
+            to_string(k, key);
+            objectValue[Json::StringType(k)] = Json(std::move(value));
+        }
+    }
+
+    obj = std::move(ret);
+}
+
+template<class K, class T, class H> requires (std::is_constructible_v<K, typename Json::StringType> || has_from_string<K>::value)
+inline void from_json(const Json& obj, std::unordered_map<K, T, H>& cont)
+{
+    auto& objectValue = obj.GetObject();
+    cont.clear();
+    cont.reserve(objectValue.size());
+
+    for(auto& [key, val] : objectValue)
+    {
+        if constexpr (std::is_constructible_v<K, typename Json::StringType>)
+        {
+            cont[K(key)] = val.template Get<T>();
+        }
+        else
+        {
+            K k;
+            from_string(std::string(key), k);
+            cont[k] = val.template Get<T>();
+        }
+    }
+}
+
+template<class K, class T, class H> requires (std::is_constructible_v<K, typename Json::StringType> || has_from_string<K>::value)
+inline void from_json(Json&& obj, std::unordered_map<K, T, H>& cont)
+{
+    auto& objectValue = obj.GetObject();
+    cont.clear();
+    cont.reserve(objectValue.size());
+
+    for(auto& [key, val] : objectValue)
+    {
+        if constexpr (std::is_constructible_v<K, typename Json::StringType>)
+        {
+            cont[K(key)] = val.template Take<T>();
+        }
+        else
+        {
+            K k;
+            from_string(std::string(key), k);
+            cont[k] = val.template Take<T>();
+        }
+    }
+}
+
+template<class K, class T, class H>
+inline void to_json(Json& obj, const std::map<K, T, H>& cont)
+{
+    Json ret = Json::Object();
+    auto& objectValue = ret.GetObject();
+    objectValue.reserve(cont.size());
+
+    for(auto& [key, value] : cont)
+        objectValue[Json(key)] = Json(value);
+
+    obj = std::move(ret);
+}
+
+template<class K, class T, class H>
+inline void to_json(Json& obj, std::map<K, T, H>&& cont)
+{
+    Json ret = Json::Object();
+    auto& objectValue = ret.GetObject();
+    objectValue.reserve(cont.size());
+
+    for(auto& [key, value] : cont)
+        objectValue[Json(key)] = Json(std::move(value));
+
+    obj = std::move(ret);
+}
+
+template<class K, class T, class H>
+inline void from_json(const Json& obj, std::map<K, T, H>& cont)
+{
+    auto& objectValue = obj.GetObject();
+    cont.clear();
+
+    for(auto& [key, val] : objectValue) {
+        cont[Json(key)] = val.template Get<T>();
+    }
+}
+
+template<class K, class T, class H>
+inline void from_json(Json&& obj, std::map<K, T, H>& cont)
+{
+    auto& objectValue = obj.GetObject();
+    cont.clear();
+
+    for(auto& [key, val] : objectValue) {
+        cont[Json(key)] = val.template Take<T>();
+    }
+}
+
+// JsonHandler that builds a Json tree. This is what JsonParser::Parse()
+// uses, with all strings and containers allocated from 'resource'.
+class JsonDomBuilder
+{
+    std::pmr::memory_resource* resource;
+    JsonKeyTable* keyTable;
+    bool shareStrings;
+    std::vector<Json> containers;
+    std::vector<Json::StringType> keys;
+    Json root;
+
+    void Add(Json&& value)
+    {
+        if (containers.empty())
+        {
+            root = std::move(value);
+        }
+        else if (containers.back().GetType() == JsonDataType::Array)
+        {
+            containers.back().GetArray().push_back(std::move(value));
+        }
+        else
+        {
+            containers.back().GetObject().insert_or_assign(std::move(keys.back()), std::move(value));
+            keys.pop_back();
+        }
+    }
+
+    void EndContainer()
+    {
+        Json value = std::move(containers.back());
+        containers.pop_back();
+        Add(std::move(value));
+    }
+
+    Json::StringType MakeString(std::string_view str) const {
+        return shareStrings ? Json::StringType::Shared(str) : Json::StringType(str, resource);
+    }
+
+public:
+    // With 'shareStrings', strings and keys refer to the views they're
+    // reported with instead of copying them (see JsonString::Shared), which
+    // is only safe when those views outlive the tree, as with in-place parsing.
+    explicit JsonDomBuilder(std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+        JsonKeyTable* keyTable = nullptr, bool shareStrings = false)
+        : resource(resource), keyTable(keyTable), shareStrings(shareStrings) {}
+
+    void OnNull() { Add(Json()); }
+    void OnBoolean(bool value) { Add(Json(value)); }
+    void OnInteger(int64_t value) { Add(Json(value)); }
+    void OnFloat(double value) { Add(Json(value)); }
+    void OnString(std::string_view value) { Add(Json(MakeString(value))); }
+    void OnKey(std::string_view key)
+    {
+        if (keyTable)
+            keys.push_back(keyTable->MakeKey(key));
+        else
+            keys.push_back(MakeString(key));
+    }
+
+    void OnObjectStart() { containers.push_back(Json::Object(resource)); }
+    void OnArrayStart() { containers.push_back(Json::Array(resource)); }
+
+    void OnObjectEnd() { EndContainer(); }
+    void OnArrayEnd() { EndContainer(); }
+
+    Json& GetRoot() {
+        return root;
+    }
+
+    // Exchanges the builder's stacks with the caller's, which lets a parser
+    // keep their capacity from one document to the next.
+    void SwapStacks(std::vector<Json>& containers, std::vector<Json::StringType>& keys)
+    {
+        this->containers.swap(containers);
+        this->keys.swap(keys);
+    }
+};
+
+template<JsonReflected T>
+inline void JsonFieldsToJson(Json& obj, const T& value)
+{
+    Json ret = Json::Object();
+    auto& members = ret.GetObject();
+    members.reserve(JsonFieldTable<T>::Count);
+
+    JsonFieldTable<T>::ForEach(value, [&](std::string_view name, const auto& member) {
+        members.try_emplace(name, member);
+    });
+
+    obj = std::move(ret);
+}
+
+template<JsonReflected T>
+inline void JsonFieldsFromJson(const Json& obj, T& value)
+{
+    JsonFieldTable<T>::ForEach(value, [&](std::string_view name, auto& member) {
+        member = obj.GetAt(name).Get<std::remove_reference_t<decltype(member)>>();
+    });
+}
+
+template<JsonReflected T>
+inline void JsonFieldsFromJson(Json&& obj, T& value)
+{
+    JsonFieldTable<T>::ForEach(value, [&](std::string_view name, auto& member) {
+        member = obj.GetAt(name).Take<std::remove_reference_t<decltype(member)>>();
+    });
+}
+
+// Writes 'value' as JSON without building a Json tree first.
+template<class T>
+inline std::string JsonSerialize(const T& value, int indent = -1)
+{
+    std::string str;
+    JsonStringSink sink(str);
+    JsonPrinter(indent).WriteValue(sink, 0, value);
+    return str;
+}
+
+// Parses 'text' straight into a T without building a Json tree first.
+template<class T>
+inline T JsonDeserialize(std::string_view text, const JsonParseOptions& options = {})
+{
+    T value;
+    JsonParser parser(text, options);
+    parser.ParseInto(value);
+    return value;
+}
+
+inline JsonParser::JsonParser(const JsonParseOptions& options)
+    : JsonParser(std::string_view(), options){}
+
+inline JsonParser::JsonParser(std::string_view text, const JsonParseOptions& options)
+    : lexer(text, options), options(options)
+{
+    Reset(text);
+}
+
+inline JsonParser::JsonParser(const char* text, size_t length, const JsonParseOptions& options)
+    : JsonParser(std::string_view(text, length), options){}
+
+inline void JsonParser::Reset(std::string_view text)
+{
+    lexer.Reset(text);
+    token = JsonToken();
+    engine = options.engine;
+    resource = options.resource ? options.resource : std::pmr::get_default_resource();
+    structurals.clear();
+    nextStructural = 0;
+    nesting.clear();
+    depth = 0;
+    inSitu = nullptr;
+    error = JsonError();
+    this->text = text.data();
+    length = text.size();
+    resumeLexer = false;
+
+    if (engine == JsonParseEngine::Indexed && length > UINT32_MAX)
+        engine = JsonParseEngine::Streaming;
+
+    if (engine == JsonParseEngine::Indexed)
+    {
+        JsonStatsTimer timer(options.stats ? &options.stats->indexTime : nullptr);
+        JsonStructuralIndexer::Build(text, structurals);
+    }
+}
+
+inline void JsonParser::Reset(std::string_view text, const JsonParseOptions& options)
+{
+    this->options = options;
+    lexer.Reset(text, options);
+    Reset(text);
+}
+
+inline void JsonParser::ResetInSitu(char* text, size_t length)
+{
+    Reset(std::string_view(text, length));
+    lexer.ResetInSitu(text, length);
+    inSitu = text;
+}
+
+inline void JsonParser::ResetInSitu(char* text, size_t length, const JsonParseOptions& options)
+{
+    this->options = options;
+    lexer.Reset(std::string_view(text, length), options);
+    ResetInSitu(text, length);
+}
+
+template<class T>
+inline void JsonParser::ParseInto(T& value)
+{
+    StatsScope scope(*this);
+
+    if (!NextToken())
+        Fail(JsonErrorCode::EmptyInput);
+
+    ReadValue(value);
+}
+
+inline void JsonParser::ExpectToken(JsonTokenType type, const char* expected)
+{
+    if (token.type == type)
+        return;
+
+    switch (token.type)
+    {
+    case JsonTokenType::EndOfFile:
+        Fail(JsonErrorCode::UnexpectedEndOfInput);
+        break;
+    case JsonTokenType::ObjectEnd:
+    case JsonTokenType::ArrayEnd:
+    case JsonTokenType::Colon:
+    case JsonTokenType::Comma:
+        Fail(JsonErrorCode::UnexpectedToken);
+        break;
+    default:
+        break;
+    }
+
+    throw std::runtime_error(std::string("json value is not ") + expected);
+}
+
+inline void JsonParser::SkipValue()
+{
+    JsonHandlerBase handler;
+    ParseValue(handler);
+}
+
+template<class Func>
+inline void JsonParser::ReadObject(Func&& readMember)
+{
+    ExpectToken(JsonTokenType::ObjectStart, "an object");
+    EnterContainer();
+    NextToken();
+
+    std::string key;
+
+    while (token.type != JsonTokenType::ObjectEnd)
+    {
+        if (token.type != JsonTokenType::String)
+            Fail(JsonErrorCode::ExpectedString);
+
+        key.assign(token.GetString());
+        NextToken();
+
+        if (token.type != JsonTokenType::Colon)
+            Fail(JsonErrorCode::ExpectedColon);
+
+        NextToken();
+
+        readMember(key);
+
+        if (token.type == JsonTokenType::Comma)
+        {
+            NextToken();
+
+            if (token.type == JsonTokenType::ObjectEnd)
+                Fail(JsonErrorCode::ExpectedValue);
+        }
+        else
+        {
+            if (token.type != JsonTokenType::ObjectEnd)
+                Fail(JsonErrorCode::ExpectedObjectEnd);
+        }
+    }
+
+    --depth;
+    NextToken();
+}
+
+template<class Func>
+inline void JsonParser::ReadArray(Func&& readElement)
+{
+    ExpectToken(JsonTokenType::ArrayStart, "an array");
+    EnterContainer();
+    NextToken();
+
+    for (size_t i = 0; token.type != JsonTokenType::ArrayEnd; ++i)
+    {
+        readElement(i);
+
+        if (token.type == JsonTokenType::Comma)
+        {
+            NextToken();
+
+            if (token.type == JsonTokenType::ArrayEnd)
+                Fail(JsonErrorCode::ExpectedValue);
+        }
+        else
+        {
+            if (token.type != JsonTokenType::ArrayEnd)
+                Fail(JsonErrorCode::ExpectedArrayEnd);
+        }
+    }
+
+    --depth;
+    NextToken();
+}
+
+template<class T>
+inline void JsonParser::ReadValue(T& value)
+{
+    if constexpr (std::is_same_v<T, Json>)
+    {
+        JsonDomBuilder builder(resource, options.keyTable, inSitu != nullptr);
+        builder.SwapStacks(containers, keys);
+        ParseValue(builder);
+        builder.SwapStacks(containers, keys);
+        value = std::move(builder.GetRoot());
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        ExpectToken(JsonTokenType::Boolean, "a boolean");
+        value = token.GetBoolean();
+        NextToken(false);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        ExpectToken(JsonTokenType::Integer, "an integer");
+        value = (T)token.GetInteger();
+        NextToken(false);
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        ExpectToken(JsonTokenType::Float, "a float");
+        value = (T)token.GetFloat();
+        NextToken(false);
+    }
+    else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, Json::StringType>)
+    {
+        ExpectToken(JsonTokenType::String, "a string");
+        value = token.GetString();
+        NextToken(false);
+    }
+    else if constexpr (JsonReflected<T>)
+    {
+        using Table = JsonFieldTable<T>;
+        std::array<bool, Table::Count> found{};
+
+        ReadObject([&](const std::string& key) {
+            size_t index = Table::Find(key);
+
+            if (index == Table::Count) {
+                SkipValue();
+                return;
+            }
+
+            found[index] = true;
+            Table::Visit(value, index, [&](std::string_view, auto& member) { ReadValue(member); });
+        });
+
+        if (std::find(found.begin(), found.end(), false) != found.end())
+            throw std::out_of_range("key not found");
+    }
+    else if constexpr (is_json_string_map<T>)
+    {
+        value.clear();
+        ReadObject([&](const std::string& key) { ReadValue(value[key]); });
+    }
+    else if constexpr (is_json_sequence<T>)
+    {
+        using Element = typename T::value_type;
+
+        if constexpr (is_json_fixed_sequence<T>)
+        {
+            size_t count = 0;
+
+            ReadArray([&](size_t i) {
+                if (i == value.size())
+                    throw std::runtime_error("wrong number of array elements");
+
+                ReadValue(value[i]);
+                count = i + 1;
+            });
+
+            if (count != value.size())
+                throw std::runtime_error("wrong number of array elements");
+        }
+        else if constexpr (std::is_same_v<T, std::forward_list<Element, typename T::allocator_type>>)
+        {
+            value.clear();
+            auto last = value.before_begin();
+
+            ReadArray([&](size_t) {
+                Element element;
+                ReadValue(element);
+                last = value.insert_after(last, std::move(element));
+            });
+        }
+        else
+        {
+            value.clear();
+
+            ReadArray([&](size_t) {
+                Element element;
+                ReadValue(element);
+                value.push_back(std::move(element));
+            });
+        }
+    }
+    else
+    {
+        Json tmp;
+        ReadValue(tmp);
+        from_json(tmp, value);
+    }
+}
+
+inline Json JsonParser::Parse()
+{
+    unsigned threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+
+    if (threadCount > 1 && options.maxDepth != 0)
+    {
+        std::vector<uint32_t> bounds;
+        if (FindArrayElements(bounds))
+            return ParseArrayParallel(bounds, threadCount);
+    }
+
+    JsonDomBuilder builder(resource, options.keyTable, inSitu != nullptr);
+    builder.SwapStacks(containers, keys);
+    Parse(builder);
+    builder.SwapStacks(containers, keys);
+    return std::move(builder.GetRoot());
+}
+
+// Finds the elements of a top-level array from the structural index, which
+// already accounts for strings and escapes, so brackets and commas inside
+// strings are never mistaken for boundaries. On success, 'bounds' holds the
+// offset of the '[' followed by the offset of each ',' and the closing ']'
+// at depth one. Returns false if the input isn't an array, or if its
+// brackets don't match, in which case the serial parser reports the error.
+inline bool JsonParser::FindArrayElements(std::vector<uint32_t>& bounds)
+{
+    if (length > UINT32_MAX)
+        return false;
+
+    const char* first = JsonScanner::SkipWhitespace(text, text + length);
+    if (first == text + length || *first != '[')
+        return false;
+
+    if (structurals.empty())
+    {
+        JsonStatsTimer timer(options.stats ? &options.stats->indexTime : nullptr);
+        JsonStructuralIndexer::Build(std::string_view(text, length), structurals);
+    }
+
+    size_t depth = 0;
+
+    for (uint32_t offset : structurals)
+    {
+        switch (text[offset])
+        {
+        case '[':
+        case '{':
+            if (depth++ == 0)
+                bounds.push_back(offset);
+            break;
+
+        case ']':
+        case '}':
+            if (--depth == 0)
+            {
+                if (text[offset] != ']')
+                    return false;
+
+                bounds.push_back(offset);
+                return true;
+            }
+            break;
+
+        case ',':
+            if (depth == 1)
+                bounds.push_back(offset);
+            break;
+        }
+    }
+
+    return false;
+}
+
+inline Json JsonParser::ParseArrayParallel(const std::vector<uint32_t>& bounds, unsigned threadCount)
+{
+    StatsScope scope(*this);
+    size_t count = bounds.size() - 1;
+
+    // a single gap between the brackets is either one element or, if it's
+    // blank, an empty array
+    if (count == 1 && JsonScanner::SkipWhitespace(text + bounds[0] + 1, text + bounds[1]) == text + bounds[1])
+        count = 0;
+
+    Json ret = Json::Array(resource);
+    auto& arr = ret.GetArray();
+    arr.resize(count);
+
+    JsonParseOptions elementOptions = options;
+    elementOptions.engine = JsonParseEngine::Streaming;
+    elementOptions.threadCount = 1;
+    elementOptions.resource = resource;
+    elementOptions.keyTable = nullptr;
+    elementOptions.stats = nullptr;
+
+    // the elements are one level down
+    elementOptions.maxDepth = options.maxDepth - 1;
+
+    // elements are handed out in chunks, in order, so that the first
+    // error by position is always the one that's reported
+    constexpr size_t ChunkSize = 256;
+    size_t chunkCount = (count + ChunkSize - 1) / ChunkSize;
+
+    threadCount = (unsigned)std::clamp<size_t>(chunkCount, 1, threadCount);
+
+    std::atomic<size_t> nextChunk{ 0 };
+    std::atomic<bool> failed{ false };
+    std::mutex errorMutex;
+    size_t errorIndex = SIZE_MAX;
+    std::exception_ptr error;
+
+    // Errors are located in the whole input, as the serial parser would
+    // report them. This runs on the worker threads, so it can't use Fail.
+    auto locate = [&](JsonErrorCode code, size_t offset) {
+        return JsonError::At(code, std::string_view(text, length), offset);
+    };
+
+    auto work = [&]
+    {
+        // each thread counts its elements separately, and adds them up at the end
+        JsonParseStats threadStats;
+        JsonParseOptions threadOptions = elementOptions;
+
+        if (options.stats)
+            threadOptions.stats = &threadStats;
+
+        while (!failed.load(std::memory_order_relaxed))
+        {
+            size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= chunkCount)
+                break;
+
+            size_t end = std::min(count, (chunk + 1) * ChunkSize);
+
+            for (size_t i = chunk * ChunkSize; i != end; ++i)
+            {
+                const char* begin = text + bounds[i] + 1;
+                const char* stop = text + bounds[i + 1];
+
+                try
+                {
+                    // like the serial parser, a missing element is an
+                    // unexpected ',' or a missing value before the ']'
+                    if (JsonScanner::SkipWhitespace(begin, stop) == stop)
+                    {
+                        auto code = *stop == ']' ? JsonErrorCode::ExpectedValue : JsonErrorCode::UnexpectedToken;
+                        throw JsonParseError(locate(code, stop - text));
+                    }
+
+                    // The element's parser sees the rest of the input, not just
+                    // the element, so that it lexes exactly what the serial
+                    // parser would have at this point, and an element that
+                    // runs past its boundary fails the same way. Only the
+                    // token after the value is read past the element.
+                    size_t offset = begin - text;
+                    JsonParser parser(std::string_view(begin, length - offset), threadOptions);
+
+                    // the elements don't overlap, so each decodes its own strings
+                    if (inSitu)
+                        parser.ResetInSitu(inSitu + offset, length - offset);
+
+                    try {
+                        arr[i] = parser.Parse();
+                    }
+                    catch (const JsonParseError& e) {
+                        // the element's parser counts from the start of the element
+                        throw JsonParseError(locate(e.GetError().code, offset + e.GetError().offset), e.what());
+                    }
+
+                    if (offset + parser.token.pos != bounds[i + 1])
+                        throw JsonParseError(locate(JsonErrorCode::ExpectedArrayEnd, offset + parser.token.pos));
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+
+                    if (i < errorIndex) {
+                        errorIndex = i;
+                        error = std::current_exception();
+                    }
+
+                    failed = true;
+                    break;
+                }
+            }
+        }
+
+        if (options.stats)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            auto& stats = *options.stats;
+
+            // each element's parser also counted the ',' or ']' after it
+            for (size_t t = 0; t != stats.tokens.size(); ++t)
+                stats.tokens[t] += threadStats.tokens[t];
+
+            stats.strings += threadStats.strings;
+            stats.escapes += threadStats.escapes;
+            stats.maxDepth = std::max(stats.maxDepth, threadStats.maxDepth + 1);
+        }
+    };
+
+    JsonRunOnThreads(threadCount, work);
+
+    if (error)
+    {
+        try {
+            std::rethrow_exception(error);
+        }
+        catch (const JsonParseError& e) {
+            this->error = e.GetError();
+            throw;
+        }
+    }
+
+    // read the token after the array like ParseArray does, so IsAtEnd works
+    // and malformed input after it is rejected the same way
+    try {
+        token = lexer.GetTokenAt(bounds.back() + 1);
+    }
+    catch (const JsonParseError& e) {
+        this->error = e.GetError();
+        throw;
+    }
+
+    if (options.stats)
+    {
+        auto& stats = *options.stats;
+        stats.tokens[(size_t)JsonTokenType::ArrayStart] += 1;
+        stats.tokens[(size_t)JsonTokenType::ArrayEnd] += count == 0;
+        stats.tokens[(size_t)token.type] += 1;
+        stats.maxDepth = std::max<size_t>(stats.maxDepth, 1);
+    }
+
+    return ret;
+}
+
+template<JsonHandler Handler>
+inline void JsonParser::Parse(Handler& handler)
+{
+    ParseRoot(handler);
+}
+
+inline bool JsonParser::TryParse(Json& value)
+{
+    throwErrors = false;
+    lexer.SetThrowErrors(false);
+
+    JsonDomBuilder builder(resource, options.keyTable, inSitu != nullptr);
+    builder.SwapStacks(containers, keys);
+    bool ok = ParseRoot(builder);
+    builder.SwapStacks(containers, keys);
+
+    throwErrors = true;
+    lexer.SetThrowErrors(true);
+
+    if (!ok)
+    {
+        // drop whatever was left open so the next parse starts clean
+        containers.clear();
+        keys.clear();
+        return false;
+    }
+
+    value = std::move(builder.GetRoot());
+    return true;
+}
+
+template<class Handler>
+inline bool JsonParser::ParseRoot(Handler& handler)
+{
+    StatsScope scope(*this);
+
+    if (!Advance())
+        return false;
+
+    if (token.type == JsonTokenType::EndOfFile)
+        return Fail(JsonErrorCode::EmptyInput);
+
+    return ParseValue(handler);
+}
+
+inline bool JsonParser::Fail(JsonErrorCode code)
+{
+    error = JsonError::At(code, std::string_view(text, length), token.pos);
+
+    if (throwErrors)
+        throw JsonParseError(error);
+
+    return false;
+}
+
+inline bool JsonParser::Advance()
+{
+    NextToken();
+
+    if (token.type != JsonTokenType::Error)
+        return true;
+
+    error = lexer.GetError();
+    return false;
+}
+
+inline bool JsonParser::NextToken(bool thrownOnEOF)
+{
+    lexer.Recycle(token);
+
+    try
+    {
+        if (engine == JsonParseEngine::Indexed)
+            token = NextIndexedToken();
+        else
+            token = lexer.GetNextToken();
+    }
+    catch (const JsonParseError& e)
+    {
+        // the lexer throws its own errors, so keep GetError() up to date
+        error = e.GetError();
+        throw;
+    }
+
+    if (options.stats)
+        ++options.stats->tokens[(size_t)token.type];
+
+    return token.type != JsonTokenType::EndOfFile;
+}
+
+inline JsonToken JsonParser::NextIndexedToken()
+{
+    JsonToken ret;
+
+    if (resumeLexer)
+    {
+        ret = lexer.GetNextToken();
+    }
+    else if (nextStructural != structurals.size())
+    {
+        size_t offset = structurals[nextStructural++];
+
+        // punctuation is always a single byte, so there's nothing to lex
+        switch (text[offset])
+        {
+        case '{': return JsonToken(JsonTokenType::ObjectStart, offset, '{');
+        case '}': return JsonToken(JsonTokenType::ObjectEnd, offset, '}');
+        case '[': return JsonToken(JsonTokenType::ArrayStart, offset, '[');
+        case ']': return JsonToken(JsonTokenType::ArrayEnd, offset, ']');
+        case ':': return JsonToken(JsonTokenType::Colon, offset, ':');
+        case ',': return JsonToken(JsonTokenType::Comma, offset, ',');
+        default: ret = lexer.GetTokenAt(offset); break;
+        }
+    }
+    else
+    {
+        return JsonToken(JsonTokenType::EndOfFile, length, (char)EOF);
+    }
+
+    // Numbers and literals can run straight into another token without a
+    // separator, as in "1-2". The index can't see where the second token
+    // starts, so let the lexer continue until it reaches the next entry.
+    switch (ret.type)
+    {
+    case JsonTokenType::Integer:
+    case JsonTokenType::Float:
+    case JsonTokenType::Boolean:
+    case JsonTokenType::Null:
+    {
+        size_t next = nextStructural != structurals.size() ?
+            structurals[nextStructural] : length;
+
+        resumeLexer = !lexer.IsNextTokenAt(next);
+        break;
+    }
+    default:
+        resumeLexer = false;
+        break;
+    }
+
+    return ret;
+}
+
+inline bool JsonParser::EnterContainer()
+{
+    if (++depth > options.maxDepth)
+        return Fail(JsonErrorCode::DepthExceeded);
+
+    if (options.stats)
+        options.stats->maxDepth = std::max(options.stats->maxDepth, depth);
+
+    return true;
+}
+
+template<class Handler>
+inline bool JsonParser::ParseKey(Handler& handler)
+{
+    if (token.type != JsonTokenType::String)
+        return Fail(JsonErrorCode::ExpectedString);
+
+    handler.OnKey(token.GetString());
+
+    if (!Advance())
+        return false;
+
+    if (token.type != JsonTokenType::Colon)
+        return Fail(JsonErrorCode::ExpectedColon);
+
+    return Advance();
+}
+
+// Open containers are kept on an explicit stack instead of the call stack,
+// so nesting is only limited by options.maxDepth.
+template<class Handler>
+inline bool JsonParser::ParseValue(Handler& handler)
+{
+    size_t base = nesting.size();
+
+    while (true)
+    {
+        switch (token.type)
+        {
+        case JsonTokenType::ObjectStart:
+        case JsonTokenType::ArrayStart:
+        {
+            bool isObject = token.type == JsonTokenType::ObjectStart;
+
+            if (!EnterContainer())
+                return false;
+
+            nesting.push_back(token.type);
+
+            if (isObject)
+                handler.OnObjectStart();
+            else
+                handler.OnArrayStart();
+
+            if (!Advance())
+                return false;
+
+            if (token.type != (isObject ? JsonTokenType::ObjectEnd : JsonTokenType::ArrayEnd))
+            {
+                if (isObject && !ParseKey(handler))
+                    return false;
+
+                continue;
+            }
+
+            break;
+        }
+        case JsonTokenType::String:
+            handler.OnString(token.GetString());
+            if (!Advance())
+                return false;
+            break;
+        case JsonTokenType::Integer:
+            handler.OnInteger(token.GetInteger());
+            if (!Advance())
+                return false;
+            break;
+        case JsonTokenType::Float:
+            handler.OnFloat(token.GetFloat());
+            if (!Advance())
+                return false;
+            break;
+        case JsonTokenType::Boolean:
+            handler.OnBoolean(token.GetBoolean());
+            if (!Advance())
+                return false;
+            break;
+        case JsonTokenType::Null:
+            handler.OnNull();
+            if (!Advance())
+                return false;
+            break;
+        case JsonTokenType::EndOfFile:
+            return Fail(JsonErrorCode::UnexpectedEndOfInput);
+        case JsonTokenType::Error:
+            error = lexer.GetError();
+            return false;
+        default:
+            return Fail(JsonErrorCode::UnexpectedToken);
+        }
+
+        // a value just ended, so close any containers it completes and
+        // move on to the next element of the innermost one still open
+        while (true)
+        {
+            if (nesting.size() == base)
+                return true;
+
+            bool isObject = nesting.back() == JsonTokenType::ObjectStart;
+            auto close = isObject ? JsonTokenType::ObjectEnd : JsonTokenType::ArrayEnd;
+
+            if (token.type == close)
+            {
+                if (isObject)
+                    handler.OnObjectEnd();
+                else
+                    handler.OnArrayEnd();
+
+                nesting.pop_back();
+                --depth;
+
+                if (!Advance())
+                    return false;
+            }
+            else if (token.type == JsonTokenType::Comma)
+            {
+                if (!Advance())
+                    return false;
+
+                if (token.type == close)
+                    return Fail(JsonErrorCode::ExpectedValue);
+
+                if (isObject && !ParseKey(handler))
+                    return false;
+
+                break;
+            }
+            else
+            {
+                return Fail(isObject ? JsonErrorCode::ExpectedObjectEnd : JsonErrorCode::ExpectedArrayEnd);
+            }
+        }
+    }
+}
+
+enum class JsonPushStatus
+{
+    NeedMoreData,
+    Complete
+};
+
+// Incremental parser for input that arrives in chunks, such as a network
+// body. Each call to Feed() reports every token that is complete so far to
+// the handler, and only the bytes of a token split across chunks are kept
+// until the next call. Call Finish() once the input ends.
+//
+// Feed() returns Complete once a whole top-level value has been reported.
+// A top-level number or literal can't be known to be complete until the
+// input ends, so it's only reported by Finish(). Anything other than
+// whitespace after the value is an error; call Reset() to start parsing
+// another document. Errors are thrown as JsonParseError, located from the
+// start of the stream rather than the chunk.
+template<JsonHandler Handler>
+class JsonPushParser
+{
+    enum class State : uint8_t
+    {
+        Value,       // top level, or after a colon
+        ArrayFirst,  // after '['
+        ArrayNext,   // after a comma in an array
+        ObjectFirst, // after '{'
+        ObjectNext,  // after a comma in an object
+        Colon,       // after a key
+        AfterValue,  // after a value in an object or array
+        Done
+    };
+
+    Handler& handler;
+    JsonParseOptions options;
+    State state = State::Value;
+    bool started = false;
+    std::vector<JsonTokenType> containers;
+    std::string pending;
+    size_t stringScan = 0;
+
+    // where the next byte to be consumed is in the stream, and the buffer
+    // being consumed, so that errors can be located in the stream
+    JsonError position = { JsonErrorCode::None, 0, 1, 1 };
+    std::string_view input;
+
+public:
+    JsonPushParser(Handler& handler, const JsonParseOptions& options = {})
+        : handler(handler), options(options) {}
+
+    JsonPushStatus Feed(std::string_view chunk)
+    {
+        if (!pending.empty())
+        {
+            // finish the token split across chunks with only as much of this chunk as it needs
+            size_t length = FindPendingEnd(chunk);
+            if (length == std::string_view::npos)
+            {
+                pending.append(chunk);
+                return JsonPushStatus::NeedMoreData;
+            }
+
+            pending.append(chunk.substr(0, length));
+            Consume(pending, true);
+            Advance(pending);
+            pending.clear();
+            chunk.remove_prefix(length);
+        }
+
+        // parse the rest straight from the caller's chunk, keeping only the unfinished tail
+        size_t consumed = Consume(chunk, false);
+        Advance(chunk.substr(0, consumed));
+        pending.assign(chunk.substr(consumed));
+
+        return state == State::Done ? JsonPushStatus::Complete : JsonPushStatus::NeedMoreData;
+    }
+
+    void Finish()
+    {
+        Consume(pending, true);
+        Advance(pending);
+        pending.clear();
+
+        if (state != State::Done)
+            throw JsonParseError(Locate(started ? JsonErrorCode::UnexpectedEndOfInput : JsonErrorCode::EmptyInput, 0));
+    }
+
+    void Reset()
+    {
+        state = State::Value;
+        started = false;
+        containers.clear();
+        pending.clear();
+        stringScan = 0;
+        position = { JsonErrorCode::None, 0, 1, 1 };
+    }
+
+private:
+    // Locates 'offset' in the buffer being consumed within the stream.
+    JsonError Locate(JsonErrorCode code, size_t offset) const
+    {
+        JsonError error = JsonError::At(code, input, offset);
+
+        if (error.line == 1)
+            error.column += position.column - 1;
+
+        error.line += position.line - 1;
+        error.offset += position.offset;
+        return error;
+    }
+
+    [[noreturn]] void Fail(JsonErrorCode code, size_t offset, const char* message = nullptr) const
+    {
+        if (message)
+            throw JsonParseError(Locate(code, offset), message);
+
+        throw JsonParseError(Locate(code, offset));
+    }
+
+    // Moves the stream position past 'consumed'.
+    void Advance(std::string_view consumed)
+    {
+        position.offset += consumed.size();
+
+        size_t newline = consumed.rfind('\n');
+        if (newline != std::string_view::npos)
+        {
+            position.line += std::count(consumed.begin(), consumed.begin() + newline + 1, '\n');
+            position.column = 1;
+            consumed.remove_prefix(newline + 1);
+        }
+
+        position.column += std::count_if(consumed.begin(), consumed.end(),
+            [](char c) { return ((unsigned char)c & 0xC0) != 0x80; });
+    }
+
+    // Returns the token from 'lex', with the lexer's errors located in the stream.
+    template<typename Function>
+    JsonToken Lex(Function&& lex) const
+    {
+        try {
+            return lex();
+        }
+        catch (const JsonParseError& e) {
+            throw JsonParseError(Locate(e.GetError().code, e.GetError().offset), e.what());
+        }
+    }
+
+    static bool IsDelimiter(char c)
+    {
+        switch (c)
+        {
+        case '{': case '}': case '[': case ']': case ':': case ',': case '\"':
+            return true;
+        default:
+            return JsonScanner::IsWhitespace(c);
+        }
+    }
+
+    // Returns the end of the string token starting at 'p', or nullptr if it
+    // doesn't end before 'end'. Progress is remembered in 'stringScan' so a
+    // long string split across many chunks is only scanned once.
+    const char* FindStringEnd(const char* p, const char* end)
+    {
+        const char* q = p + std::max<size_t>(stringScan, 1);
+
+        while (true)
+        {
+            q = JsonScanner::FindStringSpecial(q, end, false);
+
+            if (q == end)
+                break;
+
+            if (*q == '\"')
+            {
+                stringScan = 0;
+                return q + 1;
+            }
+
+            // skip the escaped character, which may be a quote
+            if (end - q < 2)
+                break;
+
+            q += 2;
+        }
+
+        stringScan = q - p;
+        return nullptr;
+    }
+
+    // Returns the number of bytes of 'chunk' that finish the token in
+    // 'pending', or npos if it doesn't end in 'chunk'.
+    size_t FindPendingEnd(std::string_view chunk)
+    {
+        const char* begin = chunk.data();
+        const char* end = begin + chunk.size();
+
+        if (begin == end)
+            return std::string_view::npos;
+
+        if (pending[0] != '\"')
+        {
+            const char* p = begin;
+            while (p != end && !IsDelimiter(*p))
+                ++p;
+
+            return p == end ? std::string_view::npos : p - begin;
+        }
+
+        // a backslash at the end of 'pending' escapes the first byte of the chunk
+        const char* q = stringScan < pending.size() ? begin + 1 : begin;
+
+        while (true)
+        {
+            q = JsonScanner::FindStringSpecial(q, end, false);
+
+            if (q == end)
+                break;
+
+            if (*q == '\"')
+                return q + 1 - begin;
+
+            if (end - q < 2)
+                break;
+
+            q += 2;
+        }
+
+        stringScan = pending.size() + (q - begin);
+        return std::string_view::npos;
+    }
+
+    // Reports all complete tokens in 'data' and returns the number of bytes
+    // consumed. If 'final' is set, 'data' ends at a token boundary.
+    size_t Consume(std::string_view data, bool final)
+    {
+        JsonLexer lexer(data, options);
+        input = data;
+        const char* begin = data.data();
+        const char* end = begin + data.size();
+        const char* p = begin;
+
+        while (true)
+        {
+            p = JsonScanner::SkipWhitespace(p, end);
+            if (p == end)
+                return data.size();
+
+            size_t offset = p - begin;
+
+            switch (*p)
+            {
+            case '{': OnToken(JsonToken(JsonTokenType::ObjectStart, offset, '{')); ++p; break;
+            case '}': OnToken(JsonToken(JsonTokenType::ObjectEnd, offset, '}')); ++p; break;
+            case '[': OnToken(JsonToken(JsonTokenType::ArrayStart, offset, '[')); ++p; break;
+            case ']': OnToken(JsonToken(JsonTokenType::ArrayEnd, offset, ']')); ++p; break;
+            case ':': OnToken(JsonToken(JsonTokenType::Colon, offset, ':')); ++p; break;
+            case ',': OnToken(JsonToken(JsonTokenType::Comma, offset, ',')); ++p; break;
+            case '\"':
+            {
+                const char* tokenEnd = FindStringEnd(p, end);
+                if (!tokenEnd)
+                {
+                    if (final)
+                        Fail(JsonErrorCode::UnexpectedEndOfInput, data.size());
+
+                    return offset;
+                }
+
+                OnToken(Lex([&] { return lexer.GetTokenAt(offset); }));
+                p = tokenEnd;
+                break;
+            }
+            default:
+            {
+                // numbers and literals end at the next delimiter, which may be in a later chunk
+                const char* tokenEnd = p;
+                while (tokenEnd != end && !IsDelimiter(*tokenEnd))
+                    ++tokenEnd;
+
+                if (tokenEnd == end && !final)
+                    return offset;
+
+                // lex everything up to the delimiter, since tokens like "1-2" can run together
+                OnToken(Lex([&] { return lexer.GetTokenAt(offset); }));
+
+                while (lexer.GetOffset() < (size_t)(tokenEnd - begin))
+                    OnToken(Lex([&] { return lexer.GetNextToken(); }));
+
+                p = tokenEnd;
+                break;
+            }
+            }
+        }
+    }
+
+    void OnToken(const JsonToken& token)
+    {
+        started = true;
+
+        switch (state)
+        {
+        case State::Value:
+            OnValue(token);
+            break;
+
+        case State::ArrayFirst:
+            if (token.type == JsonTokenType::ArrayEnd)
+                EndContainer();
+            else
+                OnValue(token);
+            break;
+
+        case State::ArrayNext:
+            if (token.type == JsonTokenType::ArrayEnd)
+                Fail(JsonErrorCode::ExpectedValue, token.pos);
+
+            OnValue(token);
+            break;
+
+        case State::ObjectFirst:
+        case State::ObjectNext:
+            if (token.type == JsonTokenType::ObjectEnd)
+            {
+                if (state == State::ObjectNext)
+                    Fail(JsonErrorCode::ExpectedValue, token.pos);
+
+                EndContainer();
+            }
+            else if (token.type == JsonTokenType::String)
+            {
+                handler.OnKey(token.GetString());
+                state = State::Colon;
+            }
+            else
+            {
+                Fail(JsonErrorCode::ExpectedString, token.pos);
+            }
+            break;
+
+        case State::Colon:
+            if (token.type != JsonTokenType::Colon)
+                Fail(JsonErrorCode::ExpectedColon, token.pos);
+
+            state = State::Value;
+            break;
+
+        case State::AfterValue:
+            if (containers.back() == JsonTokenType::ObjectStart)
+            {
+                if (token.type == JsonTokenType::Comma)
+                    state = State::ObjectNext;
+                else if (token.type == JsonTokenType::ObjectEnd)
+                    EndContainer();
+                else
+                    Fail(JsonErrorCode::ExpectedObjectEnd, token.pos);
+            }
+            else
+            {
+                if (token.type == JsonTokenType::Comma)
+                    state = State::ArrayNext;
+                else if (token.type == JsonTokenType::ArrayEnd)
+                    EndContainer();
+                else
+                    Fail(JsonErrorCode::ExpectedArrayEnd, token.pos);
+            }
+            break;
+
+        case State::Done:
+            Fail(JsonErrorCode::UnexpectedToken, token.pos, "unexpected input after value");
+        }
+    }
+
+    void OnValue(const JsonToken& token)
+    {
+        if ((token.type == JsonTokenType::ObjectStart || token.type == JsonTokenType::ArrayStart) &&
+            containers.size() >= options.maxDepth)
+        {
+            Fail(JsonErrorCode::DepthExceeded, token.pos);
+        }
+
+        switch (token.type)
+        {
+        case JsonTokenType::ObjectStart:
+            handler.OnObjectStart();
+            containers.push_back(token.type);
+            state = State::ObjectFirst;
+            return;
+        case JsonTokenType::ArrayStart:
+            handler.OnArrayStart();
+            containers.push_back(token.type);
+            state = State::ArrayFirst;
+            return;
+        case JsonTokenType::String:
+            handler.OnString(token.GetString());
+            break;
+        case JsonTokenType::Integer:
+            handler.OnInteger(token.GetInteger());
+            break;
+        case JsonTokenType::Float:
+            handler.OnFloat(token.GetFloat());
+            break;
+        case JsonTokenType::Boolean:
+            handler.OnBoolean(token.GetBoolean());
+            break;
+        case JsonTokenType::Null:
+            handler.OnNull();
+            break;
+        default:
+            Fail(JsonErrorCode::UnexpectedToken, token.pos);
+        }
+
+        EndValue();
+    }
+
+    void EndContainer()
+    {
+        if (containers.back() == JsonTokenType::ObjectStart)
+            handler.OnObjectEnd();
+        else
+            handler.OnArrayEnd();
+
+        containers.pop_back();
+        EndValue();
+    }
+
+    void EndValue() {
+        state = containers.empty() ? State::Done : State::AfterValue;
+    }
+};
+
+// Read-only view of a value in a JSON document that's decoded on demand.
+// GetAt(key) and GetAt(index) walk the text to the requested member,
+// skipping the subtrees in between by bracket matching, and scalars are only
+// lexed when they're read. Nothing is allocated for parts of the document
+// that aren't touched.
+//
+// Only the parts of the text that are read are validated. If an object has
+// duplicate keys, GetAt returns the first one, whereas Json::Parse keeps the
+// last. The text must outlive every value that refers to it.
+class JsonLazyValue
+{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    JsonParseOptions options;
+
+    JsonLazyValue(const char* begin, const char* end, const JsonParseOptions& options)
+        : begin(begin), end(end), options(options) {}
+
+    static const char* SkipWhitespace(const char* p, const char* end)
+    {
+        p = JsonScanner::SkipWhitespace(p, end);
+        if (p == end)
+            throw std::runtime_error("unexpected end of input");
+
+        return p;
+    }
+
+    // Returns the end of the string starting at 'p'.
+    static const char* SkipString(const char* p, const char* end)
+    {
+        assert(*p == '\"');
+        ++p;
+
+        while (true)
+        {
+            p = JsonScanner::FindStringSpecial(p, end, false);
+
+            if (p == end)
+                throw std::runtime_error("unexpected end of input");
+
+            if (*p == '\"')
+                return p + 1;
+
+            // skip the escaped character, which may be a quote
+            if (end - p < 2)
+                throw std::runtime_error("unexpected end of input");
+
+            p += 2;
+        }
+    }
+
+    // Returns the end of the value starting at 'p' without decoding it.
+    static const char* SkipValue(const char* p, const char* end)
+    {
+        switch (*p)
+        {
+        case '\"':
+            return SkipString(p, end);
+
+        case '{':
+        case '[':
+        {
+            size_t depth = 0;
+
+            while (p != end)
+            {
+                switch (*p)
+                {
+                case '\"':
+                    p = SkipString(p, end);
+                    continue;
+                case '{':
+                case '[':
+                    ++depth;
+                    break;
+                case '}':
+                case ']':
+                    if (--depth == 0)
+                        return p + 1;
+                    break;
+                }
+
+                ++p;
+            }
+
+            throw std::runtime_error("unexpected end of input");
+        }
+
+        default:
+            while (p != end && !IsDelimiter(*p))
+                ++p;
+
+            return p;
+        }
+    }
+
+    static bool IsDelimiter(char c)
+    {
+        switch (c)
+        {
+        case '{': case '}': case '[': case ']': case ':': case ',': case '\"':
+            return true;
+        default:
+            return JsonScanner::IsWhitespace(c);
+        }
+    }
+
+    JsonToken GetToken() const
+    {
+        JsonLexer lexer(std::string_view(begin, end - begin), options);
+        return lexer.GetNextToken();
+    }
+
+    [[noreturn]] static void ThrowTypeError(const char* expected) {
+        throw std::runtime_error(std::string("json value is not ") + expected);
+    }
+
+    // Compares the string starting at 'p' and ending at 'stringEnd' with 'key',
+    // only decoding it if it contains escapes.
+    bool KeyEquals(const char* p, const char* stringEnd, std::string_view key) const
+    {
+        std::string_view raw(p + 1, stringEnd - p - 2);
+
+        if (raw.find('\\') == std::string_view::npos)
+            return raw == key;
+
+        JsonLexer lexer(std::string_view(p, stringEnd - p), options);
+        return lexer.GetNextToken().GetString() == key;
+    }
+
+public:
+    JsonLazyValue() = default;
+
+    // Only skips leading whitespace. Nothing else is read until it's accessed.
+    static JsonLazyValue Parse(std::string_view text, const JsonParseOptions& options = {})
+    {
+        const char* begin = text.data();
+        const char* end = begin + text.size();
+
+        begin = JsonScanner::SkipWhitespace(begin, end);
+        if (begin == end)
+            throw std::runtime_error("input is empty");
+
+        return JsonLazyValue(begin, end, options);
+    }
+
+    JsonDataType GetType() const
+    {
+        switch (*begin)
+        {
+        case '{': return JsonDataType::Object;
+        case '[': return JsonDataType::Array;
+        case '\"': return JsonDataType::String;
+        case 't':
+        case 'f': return JsonDataType::Boolean;
+        case 'n': return JsonDataType::Null;
+        default: return GetToken().type == JsonTokenType::Float ? JsonDataType::Float : JsonDataType::Integer;
+        }
+    }
+
+    bool IsNull() const { return *begin == 'n'; }
+    bool IsObject() const { return *begin == '{'; }
+    bool IsArray() const { return *begin == '['; }
+    bool IsString() const { return *begin == '\"'; }
+    bool IsBoolean() const { return *begin == 't' || *begin == 'f'; }
+    bool IsInteger() const { return GetType() == JsonDataType::Integer; }
+    bool IsFloat() const { return GetType() == JsonDataType::Float; }
+
+    // The raw text of this value.
+    std::string_view GetText() const {
+        return std::string_view(begin, SkipValue(begin, end) - begin);
+    }
+
+    // Returns the member named 'key', or nothing if there isn't one.
+    std::optional<JsonLazyValue> Find(std::string_view key) const
+    {
+        if (!IsObject())
+            ThrowTypeError("an object");
+
+        const char* p = SkipWhitespace(begin + 1, end);
+
+        if (*p != '}')
+        {
+            while (true)
+            {
+                if (*p != '\"')
+                    throw std::runtime_error("expected string");
+
+                const char* keyEnd = SkipString(p, end);
+                bool match = KeyEquals(p, keyEnd, key);
+
+                p = SkipWhitespace(keyEnd, end);
+                if (*p != ':')
+                    throw std::runtime_error("expected colon");
+
+                p = SkipWhitespace(p + 1, end);
+                if (match)
+                    return JsonLazyValue(p, end, options);
+
+                p = SkipWhitespace(SkipValue(p, end), end);
+
+                if (*p == '}')
+                    break;
+                else if (*p != ',')
+                    throw std::runtime_error("expected '}'");
+
+                p = SkipWhitespace(p + 1, end);
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // Returns the element at 'index', or nothing if it's out of range.
+    std::optional<JsonLazyValue> Find(size_t index) const
+    {
+        if (!IsArray())
+            ThrowTypeError("an array");
+
+        const char* p = SkipWhitespace(begin + 1, end);
+
+        if (*p != ']')
+        {
+            for (size_t i = 0; ; ++i)
+            {
+                if (i == index)
+                    return JsonLazyValue(p, end, options);
+
+                p = SkipWhitespace(SkipValue(p, end), end);
+
+                if (*p == ']')
+                    break;
+                else if (*p != ',')
+                    throw std::runtime_error("expected ']'");
+
+                p = SkipWhitespace(p + 1, end);
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    JsonLazyValue GetAt(std::string_view key) const
+    {
+        auto value = Find(key);
+        if (!value)
+            throw std::out_of_range("key not found");
+
+        return *value;
+    }
+
+    JsonLazyValue GetAt(size_t index) const
+    {
+        auto value = Find(index);
+        if (!value)
+            throw std::out_of_range("index out of range");
+
+        return *value;
+    }
+
+    // Calls func(key, value) for each member of an object, or func(index, value)
+    // for each element of an array. Keys are decoded only if they contain escapes.
+    template<class Func>
+    void ForEach(Func&& func) const
+    {
+        if (!IsObject() && !IsArray())
+            ThrowTypeError("an object or array");
+
+        bool isObject = IsObject();
+        char close = isObject ? '}' : ']';
+        const char* p = SkipWhitespace(begin + 1, end);
+
+        for (size_t index = 0; *p != close; ++index)
+        {
+            std::string_view key;
+            std::string decodedKey;
+
+            if (isObject)
+            {
+                if (*p != '\"')
+                    throw std::runtime_error("expected string");
+
+                const char* keyEnd = SkipString(p, end);
+                key = std::string_view(p + 1, keyEnd - p - 2);
+
+                if (key.find('\\') != std::string_view::npos)
+                {
+                    JsonLexer lexer(std::string_view(p, keyEnd - p), options);
+                    decodedKey = lexer.GetNextToken().GetString();
+                    key = decodedKey;
+                }
+
+                p = SkipWhitespace(keyEnd, end);
+                if (*p != ':')
+                    throw std::runtime_error("expected colon");
+
+                p = SkipWhitespace(p + 1, end);
+            }
+
+            JsonLazyValue value(p, end, options);
+
+            if (isObject)
+                func(key, value);
+            else
+                func(index, value);
+
+            p = SkipWhitespace(SkipValue(p, end), end);
+
+            if (*p == ',')
+                p = SkipWhitespace(p + 1, end);
+            else if (*p != close)
+                throw std::runtime_error(isObject ? "expected '}'" : "expected ']'");
+        }
+    }
+
+    JsonLazyValue operator[](std::string_view key) const {
+        return GetAt(key);
+    }
+
+    JsonLazyValue operator[](const char* key) const {
+        return GetAt(std::string_view(key));
+    }
+
+    JsonLazyValue operator[](size_t index) const {
+        return GetAt(index);
+    }
+
+    // Number of members or elements, found by skipping over each one.
+    size_t GetSize() const
+    {
+        if (IsString())
+            return GetString().size();
+        else if (!IsObject() && !IsArray())
+            return IsNull() ? 0 : 1;
+
+        size_t size = 0;
+        ForEach([&](auto&&, const JsonLazyValue&) { ++size; });
+        return size;
+    }
+
+    int64_t GetInteger() const
+    {
+        auto token = GetToken();
+        if (token.type != JsonTokenType::Integer)
+            ThrowTypeError("an integer");
+
+        return token.GetInteger();
+    }
+
+    double GetFloat() const
+    {
+        auto token = GetToken();
+        if (token.type != JsonTokenType::Float)
+            ThrowTypeError("a float");
+
+        return token.GetFloat();
+    }
+
+    bool GetBoolean() const
+    {
+        if (!IsBoolean())
+            ThrowTypeError("a boolean");
+
+        return GetToken().GetBoolean();
+    }
+
+    std::string GetString() const
+    {
+        if (!IsString())
+            ThrowTypeError("a string");
+
+        return std::string(GetToken().GetString());
+    }
+
+    // Returns the string as a view into the source text when it can be used
+    // as is, which is when it has no escape sequences (and is valid UTF-8,
+    // if validateUtf8 is set). Otherwise returns nullopt, and the string has
+    // to be decoded with GetString(). With a JsonMappedFile as the source,
+    // this reads strings straight out of the mapping without copying them.
+    std::optional<std::string_view> GetStringView() const
+    {
+        if (!IsString())
+            ThrowTypeError("a string");
+
+        const char* stringEnd = SkipString(begin, end);
+        std::string_view raw(begin + 1, stringEnd - begin - 2);
+
+        if (raw.find('\\') != std::string_view::npos)
+            return std::nullopt;
+
+        if (options.validateUtf8 && !utf8::is_valid(raw.begin(), raw.end()))
+            return std::nullopt;
+
+        return raw;
+    }
+
+    // Fully parses this value, and only this value.
+    Json ToJson(std::pmr::memory_resource* resource = nullptr) const
+    {
+        JsonParseOptions parseOptions = options;
+        parseOptions.resource = resource;
+        return Json::Parse(GetText(), parseOptions);
+    }
+
+    template<class T>
+    T Get() const
+    {
+        T val;
+        from_json(ToJson(), val);
+        return val;
+    }
+};
+
+// A JSON Pointer (RFC 6901) such as "/orders/0/price", parsed once into a
+// list of steps so it can be evaluated against many documents. Evaluating
+// a pointer against a Json returns references into it rather than copies.
+//
+// As an extension, a "*" step matches every element of an array or member
+// of an object, so a pointer like "/orders/*/price" can select several
+// values. A key that is literally "*" can't be addressed.
+class JsonPointer
+{
+    template<JsonHandler Handler>
+    friend class JsonPointerFilter;
+    friend class Json;
+
+    struct Step
+    {
+        std::string key;
+        size_t index = SIZE_MAX; // the key as an array index, if it is one
+        bool wildcard = false;
+    };
+
+    std::vector<Step> steps;
+
+    static size_t ParseIndex(std::string_view key)
+    {
+        // no sign, and no leading zeros
+        if (key.empty() || (key[0] == '0' && key.size() > 1))
+            return SIZE_MAX;
+
+        size_t index = 0;
+        auto ret = std::from_chars(key.data(), key.data() + key.size(), index);
+
+        if (ret.ec != std::errc() || ret.ptr != key.data() + key.size())
+            return SIZE_MAX;
+
+        return index;
+    }
+
+    template<class Value>
+    static Value* Advance(Value* value, const Step& step)
+    {
+        if (value->IsObject())
+        {
+            auto& obj = value->GetObject();
+            auto it = obj.find(step.key);
+            return it != obj.end() ? &it->second : nullptr;
+        }
+        else if (value->IsArray())
+        {
+            auto& arr = value->GetArray();
+            return step.index < arr.size() ? &arr[step.index] : nullptr;
+        }
+
+        return nullptr;
+    }
+
+    // Calls func on each match until it returns false. Returns false if stopped early.
+    template<class Value, class Func> requires std::is_same_v<std::remove_const_t<Value>, Json>
+    bool Visit(Value& value, size_t first, Func& func) const
+    {
+        Value* current = &value;
+
+        for (size_t i = first; i != steps.size(); ++i)
+        {
+            if (steps[i].wildcard)
+            {
+                if (current->IsObject())
+                {
+                    for (auto& [key, child] : current->GetObject())
+                        if (!Visit(child, i + 1, func))
+                            return false;
+                }
+                else if (current->IsArray())
+                {
+                    for (auto& child : current->GetArray())
+                        if (!Visit(child, i + 1, func))
+                            return false;
+                }
+
+                return true;
+            }
+
+            current = Advance(current, steps[i]);
+            if (!current)
+                return true;
+        }
+
+        return func(*current);
+    }
+
+    template<class Func>
+    bool Visit(const JsonLazyValue& value, size_t first, Func& func) const
+    {
+        std::optional<JsonLazyValue> current = value;
+
+        for (size_t i = first; i != steps.size(); ++i)
+        {
+            if (steps[i].wildcard)
+            {
+                if (!current->IsObject() && !current->IsArray())
+                    return true;
+
+                bool keepGoing = true;
+
+                current->ForEach([&](auto&&, const JsonLazyValue& child) {
+                    if (keepGoing)
+                        keepGoing = Visit(child, i + 1, func);
+                });
+
+                return keepGoing;
+            }
+
+            if (current->IsObject())
+                current = current->Find(std::string_view(steps[i].key));
+            else if (current->IsArray() && steps[i].index != SIZE_MAX)
+                current = current->Find(steps[i].index);
+            else
+                current.reset();
+
+            if (!current)
+                return true;
+        }
+
+        return func(*current);
+    }
+
+public:
+    // The empty pointer, which refers to the whole document.
+    JsonPointer() = default;
+
+    explicit JsonPointer(std::string_view pointer)
+    {
+        if (pointer.empty())
+            return;
+
+        if (pointer[0] != '/')
+            throw std::runtime_error("json pointer must start with '/'");
+
+        size_t start = 1;
+
+        while (true)
+        {
+            size_t slash = pointer.find('/', start);
+            std::string_view token = pointer.substr(start, slash - start);
+
+            Step step;
+            step.wildcard = (token == "*");
+
+            for (size_t i = 0; i != token.size(); ++i)
+            {
+                if (token[i] != '~') {
+                    step.key.push_back(token[i]);
+                }
+                else if (i + 1 != token.size() && (token[i + 1] == '0' || token[i + 1] == '1')) {
+                    step.key.push_back(token[++i] == '0' ? '~' : '/');
+                }
+                else {
+                    throw std::runtime_error("invalid escape in json pointer");
+                }
+            }
+
+            step.index = ParseIndex(step.key);
+            steps.push_back(std::move(step));
+
+            if (slash == std::string_view::npos)
+                break;
+
+            start = slash + 1;
+        }
+    }
+
+    size_t GetSize() const {
+        return steps.size();
+    }
+
+    bool HasWildcards() const {
+        return std::any_of(steps.begin(), steps.end(), [](const Step& step) { return step.wildcard; });
+    }
+
+    std::string ToString() const
+    {
+        std::string str;
+
+        for (auto& step : steps)
+            AppendToken(str, step.key);
+
+        return str;
+    }
+
+    // Appends '/' and 'token' to 'pointer', escaping '~' and '/'.
+    static void AppendToken(std::string& pointer, std::string_view token)
+    {
+        pointer.push_back('/');
+
+        for (char c : token)
+        {
+            if (c == '~')
+                pointer += "~0";
+            else if (c == '/')
+                pointer += "~1";
+            else
+                pointer.push_back(c);
+        }
+    }
+
+    // Returns the first value the pointer selects, or nullptr if there isn't one.
+    const Json* Find(const Json& root) const
+    {
+        const Json* result = nullptr;
+        auto func = [&](const Json& value) { result = &value; return false; };
+        Visit(root, 0, func);
+        return result;
+    }
+
+    Json* Find(Json& root) const {
+        return const_cast<Json*>(Find(static_cast<const Json&>(root)));
+    }
+
+    std::optional<JsonLazyValue> Find(const JsonLazyValue& root) const
+    {
+        std::optional<JsonLazyValue> result;
+        auto func = [&](const JsonLazyValue& value) { result = value; return false; };
+        Visit(root, 0, func);
+        return result;
+    }
+
+    const Json& GetAt(const Json& root) const
+    {
+        auto value = Find(root);
+        if (!value)
+            throw std::out_of_range("path not found");
+
+        return *value;
+    }
+
+    Json& GetAt(Json& root) const
+    {
+        auto value = Find(root);
+        if (!value)
+            throw std::out_of_range("path not found");
+
+        return *value;
+    }
+
+    JsonLazyValue GetAt(const JsonLazyValue& root) const
+    {
+        auto value = Find(root);
+        if (!value)
+            throw std::out_of_range("path not found");
+
+        return *value;
+    }
+
+    // Calls func(value) for every value the pointer selects, in document order.
+    template<class Value, class Func>
+    void ForEach(Value&& root, Func&& func) const
+    {
+        auto visit = [&](auto& value) { func(value); return true; };
+        Visit(root, 0, visit);
+    }
+
+    std::vector<const Json*> FindAll(const Json& root) const
+    {
+        std::vector<const Json*> results;
+        ForEach(root, [&](const Json& value) { results.push_back(&value); });
+        return results;
+    }
+};
+
+inline bool Json::Equals(const Json& other) const {
+    return Equals(other, true);
+}
+
+inline bool Json::Equals(const Json& other, bool numeric) const
+{
+    if (this == &other || SharesBoxWith(other))
+        return true;
+
+    if (type != other.type)
+    {
+        if (!numeric)
+            return false;
+
+        if (type == JsonDataType::Integer && other.type == JsonDataType::Float)
+            return (double)GetInteger() == other.GetFloat();
+
+        if (type == JsonDataType::Float && other.type == JsonDataType::Integer)
+            return GetFloat() == (double)other.GetInteger();
+
+        return false;
+    }
+
+    switch (type)
+    {
+    case JsonDataType::Object:
+    {
+        auto& a = GetObject();
+        auto& b = other.GetObject();
+
+        if (a.size() != b.size())
+            return false;
+
+        for (auto& [key, value] : a)
+        {
+            auto it = b.find(std::string_view(key));
+            if (it == b.end() || !value.Equals(it->second, numeric))
+                return false;
+        }
+
+        return true;
+    }
+    case JsonDataType::Array:
+        return std::equal(GetArray().begin(), GetArray().end(), other.GetArray().begin(), other.GetArray().end(),
+            [=](const Json& a, const Json& b) { return a.Equals(b, numeric); });
+    case JsonDataType::String:
+        return GetString() == std::string_view(other.GetString());
+    case JsonDataType::Integer:
+        return GetInteger() == other.GetInteger();
+    case JsonDataType::Float:
+        return GetFloat() == other.GetFloat();
+    case JsonDataType::Boolean:
+        return GetBoolean() == other.GetBoolean();
+    default:
+        return true;
+    }
+}
+
+inline Json Json::Diff(const Json& from, const Json& to)
+{
+    Json patch = Array();
+    std::string path;
+    Diff(from, to, path, patch.GetArray());
+    return patch;
+}
+
+inline void Json::Diff(const Json& from, const Json& to, std::string& path, ArrayType& patch)
+{
+    auto addOperation = [&](const char* op, const Json* value)
+    {
+        Json& operation = patch.emplace_back(Object());
+        operation["op"] = op;
+        operation["path"] = std::string_view(path);
+
+        if (value)
+            operation["value"] = *value;
+    };
+
+    if (from.SharesBoxWith(to))
+        return;
+
+    size_t length = path.size();
+
+    if (from.IsObject() && to.IsObject())
+    {
+        auto& a = from.GetObject();
+        auto& b = to.GetObject();
+
+        for (auto& [key, value] : a)
+        {
+            JsonPointer::AppendToken(path, key);
+            auto it = b.find(std::string_view(key));
+
+            if (it == b.end())
+                addOperation("remove", nullptr);
+            else
+                Diff(value, it->second, path, patch);
+
+            path.resize(length);
+        }
+
+        for (auto& [key, value] : b)
+        {
+            if (!a.contains(key))
+            {
+                JsonPointer::AppendToken(path, key);
+                addOperation("add", &value);
+                path.resize(length);
+            }
+        }
+    }
+    else if (from.IsArray() && to.IsArray())
+    {
+        // Elements are matched by position after skipping the common prefix
+        // and suffix, so an insertion or removal near either end doesn't
+        // turn into a replacement of every element after it.
+        auto& a = from.GetArray();
+        auto& b = to.GetArray();
+        size_t prefix = 0;
+        size_t suffix = 0;
+
+        while (prefix != a.size() && prefix != b.size() && a[prefix].Equals(b[prefix], false))
+            ++prefix;
+
+        while (suffix != a.size() - prefix && suffix != b.size() - prefix
+            && a[a.size() - 1 - suffix].Equals(b[b.size() - 1 - suffix], false))
+            ++suffix;
+
+        size_t changedFrom = a.size() - prefix - suffix;
+        size_t changedTo = b.size() - prefix - suffix;
+        size_t i = prefix;
+
+        for (; i != prefix + std::min(changedFrom, changedTo); ++i)
+        {
+            JsonPointer::AppendToken(path, std::to_string(i));
+            Diff(a[i], b[i], path, patch);
+            path.resize(length);
+        }
+
+        // the elements after 'i' shift down as each one is removed
+        for (size_t n = changedTo; n < changedFrom; ++n)
+        {
+            JsonPointer::AppendToken(path, std::to_string(i));
+            addOperation("remove", nullptr);
+            path.resize(length);
+        }
+
+        for (; i < prefix + changedTo; ++i)
+        {
+            JsonPointer::AppendToken(path, std::to_string(i));
+            addOperation("add", &b[i]);
+            path.resize(length);
+        }
+    }
+    else if (!from.Equals(to, false))
+    {
+        addOperation("replace", &to);
+    }
+}
+
+template<class Value>
+inline Value* Json::FindPatchTarget(Value& root, const JsonPointer& path, size_t count)
+{
+    Value* current = &root;
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        auto& step = path.steps[i];
+
+        if (current->IsObject())
+        {
+            auto& obj = current->GetObject();
+            auto it = obj.find(std::string_view(step.key));
+
+            if (it == obj.end())
+                return nullptr;
+
+            current = &it->second;
+        }
+        else if (current->IsArray())
+        {
+            auto& arr = current->GetArray();
+
+            if (step.index >= arr.size())
+                return nullptr;
+
+            current = &arr[step.index];
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    return current;
+}
+
+inline void Json::AddAt(const JsonPointer& path, Json&& value)
+{
+    if (path.steps.empty()) {
+        *this = std::move(value);
+        return;
+    }
+
+    Json* parent = FindPatchTarget(*this, path, path.steps.size() - 1);
+    auto& step = path.steps.back();
+
+    if (parent && parent->IsObject())
+    {
+        parent->GetObject().insert_or_assign(std::string_view(step.key), std::move(value));
+    }
+    else if (parent && parent->IsArray())
+    {
+        auto& arr = parent->GetArray();
+
+        if (step.key == "-")
+            arr.push_back(std::move(value));
+        else if (step.index <= arr.size())
+            arr.insert(arr.begin() + step.index, std::move(value));
+        else
+            throw std::out_of_range("path not found: " + path.ToString());
+    }
+    else
+    {
+        throw std::out_of_range("path not found: " + path.ToString());
+    }
+}
+
+inline Json Json::RemoveAt(const JsonPointer& path)
+{
+    if (path.steps.empty())
+        throw std::runtime_error("can't remove the whole document");
+
+    Json* parent = FindPatchTarget(*this, path, path.steps.size() - 1);
+    auto& step = path.steps.back();
+    Json value;
+
+    if (parent && parent->IsObject())
+    {
+        auto& obj = parent->GetObject();
+        auto it = obj.find(std::string_view(step.key));
+
+        if (it == obj.end())
+            throw std::out_of_range("path not found: " + path.ToString());
+
+        value = std::move(it->second);
+        obj.erase(it);
+    }
+    else if (parent && parent->IsArray())
+    {
+        auto& arr = parent->GetArray();
+
+        if (step.index >= arr.size())
+            throw std::out_of_range("path not found: " + path.ToString());
+
+        value = std::move(arr[step.index]);
+        arr.erase(arr.begin() + step.index);
+    }
+    else
+    {
+        throw std::out_of_range("path not found: " + path.ToString());
+    }
+
+    return value;
+}
+
+inline void Json::ApplyPatchOperation(const Json& operation)
+{
+    if (!operation.IsObject())
+        throw std::runtime_error("operation must be an object");
+
+    auto member = [&](std::string_view name) -> const Json&
+    {
+        auto& obj = operation.GetObject();
+        auto it = obj.find(name);
+
+        if (it == obj.end())
+            throw std::runtime_error("missing \"" + std::string(name) + "\"");
+
+        return it->second;
+    };
+
+    std::string_view op = member("op").GetString();
+    JsonPointer path(std::string_view(member("path").GetString()));
+
+    if (op == "add")
+    {
+        AddAt(path, Json(member("value")));
+    }
+    else if (op == "remove")
+    {
+        RemoveAt(path);
+    }
+    else if (op == "replace")
+    {
+        Json* target = FindPatchTarget(*this, path, path.steps.size());
+
+        if (!target)
+            throw std::out_of_range("path not found: " + path.ToString());
+
+        *target = member("value");
+    }
+    else if (op == "move")
+    {
+        JsonPointer from(std::string_view(member("from").GetString()));
+
+        bool intoItself = from.steps.size() < path.steps.size() && std::equal(from.steps.begin(), from.steps.end(),
+            path.steps.begin(), [](auto& a, auto& b) { return a.key == b.key; });
+
+        if (intoItself)
+            throw std::runtime_error("can't move a value into itself");
+
+        if (from.ToString() != path.ToString())
+            AddAt(path, RemoveAt(from));
+        else if (!FindPatchTarget(*this, from, from.steps.size()))
+            throw std::out_of_range("path not found: " + from.ToString());
+    }
+    else if (op == "copy")
+    {
+        JsonPointer from(std::string_view(member("from").GetString()));
+        const Json* source = FindPatchTarget(std::as_const(*this), from, from.steps.size());
+
+        if (!source)
+            throw std::out_of_range("path not found: " + from.ToString());
+
+        AddAt(path, Json(*source));
+    }
+    else if (op == "test")
+    {
+        const Json* target = FindPatchTarget(std::as_const(*this), path, path.steps.size());
+
+        if (!target || !target->Equals(member("value")))
+            throw std::runtime_error("test failed at " + path.ToString());
+    }
+    else
+    {
+        throw std::runtime_error("unknown operation: " + std::string(op));
+    }
+}
+
+inline void Json::ApplyPatch(const Json& patch)
+{
+    if (!patch.IsArray())
+        throw std::runtime_error("json patch must be an array");
+
+    auto& operations = patch.GetArray();
+
+    // patch a copy and keep it only once every operation has succeeded
+    Json patched = Share();
+
+    for (size_t i = 0; i != operations.size(); ++i)
+    {
+        try {
+            patched.ApplyPatchOperation(operations[i]);
+        }
+        catch (const std::exception& e) {
+            throw std::runtime_error("json patch operation " + std::to_string(i) + " failed: " + e.what());
+        }
+    }
+
+    *this = std::move(patched);
+}
+
+inline void Json::MergePatch(const Json& patch)
+{
+    if (!patch.IsObject()) {
+        *this = patch;
+        return;
+    }
+
+    if (!IsObject())
+        *this = Object();
+
+    auto& obj = GetObject();
+
+    for (auto& [key, value] : patch.GetObject())
+    {
+        if (value.IsNull())
+            obj.erase(std::string_view(key));
+        else
+            obj[std::string_view(key)].MergePatch(value);
+    }
+}
+
+// JsonHandler that forwards only the values selected by a JsonPointer to
+// another handler, so a pointer can be evaluated while streaming without
+// building a tree. Each selected value is reported as a complete value,
+// in document order.
+template<JsonHandler Handler>
+class JsonPointerFilter
+{
+    struct Frame
+    {
+        bool isObject = false;
+        bool matched = false; // the path to this container matches the pointer so far
+        size_t index = 0;
+        std::string key{};
+    };
+
+    const JsonPointer& pointer;
+    Handler& handler;
+    std::vector<Frame> frames;
+    size_t forwardDepth = 0; // open containers inside a selected value
+
+    // Returns true if the value that's starting is selected by the pointer,
+    // and sets 'onPath' if it's a container the pointer may descend into.
+    bool BeginValue(bool& onPath)
+    {
+        onPath = false;
+
+        bool matched = true;
+
+        if (!frames.empty())
+        {
+            Frame& frame = frames.back();
+            size_t index = frame.isObject ? 0 : frame.index++;
+
+            size_t depth = frames.size();
+            if (!frame.matched || depth > pointer.steps.size())
+                return false;
+
+            auto& step = pointer.steps[depth - 1];
+            matched = step.wildcard ||
+                (frame.isObject ? frame.key == step.key : index == step.index);
+        }
+
+        if (!matched)
+            return false;
+
+        if (frames.size() == pointer.steps.size())
+            return true;
+
+        onPath = true;
+        return false;
+    }
+
+    template<class Func>
+    void OnScalar(Func&& func)
+    {
+        bool onPath;
+        if (forwardDepth || BeginValue(onPath))
+            func();
+    }
+
+    void OnContainerStart(bool isObject)
+    {
+        bool onPath = false;
+
+        if (forwardDepth || BeginValue(onPath))
+        {
+            ++forwardDepth;
+
+            if (isObject)
+                handler.OnObjectStart();
+            else
+                handler.OnArrayStart();
+        }
+        else
+        {
+            frames.push_back(Frame{ .isObject = isObject, .matched = onPath });
+        }
+    }
+
+    void OnContainerEnd(bool isObject)
+    {
+        if (forwardDepth)
+        {
+            --forwardDepth;
+
+            if (isObject)
+                handler.OnObjectEnd();
+            else
+                handler.OnArrayEnd();
+        }
+        else
+        {
+            frames.pop_back();
+        }
+    }
+
+public:
+    JsonPointerFilter(const JsonPointer& pointer, Handler& handler)
+        : pointer(pointer), handler(handler) {}
+
+    void OnNull() { OnScalar([&] { handler.OnNull(); }); }
+    void OnBoolean(bool value) { OnScalar([&] { handler.OnBoolean(value); }); }
+    void OnInteger(int64_t value) { OnScalar([&] { handler.OnInteger(value); }); }
+    void OnFloat(double value) { OnScalar([&] { handler.OnFloat(value); }); }
+    void OnString(std::string_view value) { OnScalar([&] { handler.OnString(value); }); }
+
+    void OnKey(std::string_view key)
+    {
+        if (forwardDepth)
+            handler.OnKey(key);
+        else if (frames.back().matched)
+            frames.back().key.assign(key);
+    }
+
+    void OnObjectStart() { OnContainerStart(true); }
+    void OnObjectEnd() { OnContainerEnd(true); }
+    void OnArrayStart() { OnContainerStart(false); }
+    void OnArrayEnd() { OnContainerEnd(false); }
+};
+
+// Thrown when a document doesn't match a JsonSchema. GetPath() is a JSON
+// Pointer to the value that was rejected.
+class JsonSchemaError : public std::runtime_error
+{
+    std::string path;
+public:
+    JsonSchemaError(const std::string& path, const std::string& message)
+        : std::runtime_error(path.empty() ? message : path + ": " + message), path(path) {}
+
+    const std::string& GetPath() const {
+        return path;
+    }
+};
+
+// A JSON Schema compiled to be checked while a document is parsed, by
+// JsonSchemaValidator. This covers the keywords that can be checked in a
+// single pass over the document: type, properties, required,
+// additionalProperties, items (as one schema), minimum, maximum,
+// exclusiveMinimum and exclusiveMaximum (as numbers), minLength and
+// maxLength (in code points), minItems, maxItems, minProperties and
+// maxProperties. Annotations such as title and description are ignored,
+// and any other keyword is rejected instead of silently going unchecked.
+class JsonSchema
+{
+    template<JsonHandler Handler>
+    friend class JsonSchemaValidator;
+
+    static constexpr size_t None = SIZE_MAX;
+
+    struct Property
+    {
+        size_t node = None;     // schema of the value, or None for any value
+        size_t required = None; // position in Node::required, if it's required
+        bool declared = false;  // listed in "properties", not just "required"
+    };
+
+    struct Node
+    {
+        // bits of JsonDataType that are allowed, and whether "integer"
+        // allows floats without a fractional part, as the spec says
+        uint8_t types = 0x7F;
+        bool integralFloats = false;
+
+        double minimum = -INFINITY;
+        double maximum = INFINITY;
+        bool exclusiveMinimum = false;
+        bool exclusiveMaximum = false;
+
+        size_t minLength = 0;
+        size_t maxLength = SIZE_MAX;
+        size_t minItems = 0;
+        size_t maxItems = SIZE_MAX;
+        size_t minProperties = 0;
+        size_t maxProperties = SIZE_MAX;
+
+        std::map<std::string, Property, std::less<>> properties;
+        std::vector<std::string> required;
+        bool additionalProperties = true;
+        size_t additionalNode = None;
+        size_t items = None;
+    };
+
+    // nodes[0] is the root, and nodes refer to each other by index
+    std::vector<Node> nodes;
+
+    static uint8_t TypeBit(JsonDataType type) {
+        return (uint8_t)(1 << (uint8_t)type);
+    }
+
+    static double GetNumber(const Json& value, std::string_view keyword)
+    {
+        if (value.IsInteger())
+            return (double)value.GetInteger();
+
+        if (value.IsFloat())
+            return value.GetFloat();
+
+        throw std::runtime_error("schema keyword " + std::string(keyword) + " must be a number");
+    }
+
+    static size_t GetCount(const Json& value, std::string_view keyword)
+    {
+        if (!value.IsInteger() || value.GetInteger() < 0)
+            throw std::runtime_error("schema keyword " + std::string(keyword) + " must be a non-negative integer");
+
+        return (size_t)value.GetInteger();
+    }
+
+    static uint8_t GetTypes(const Json& value, bool& integralFloats)
+    {
+        auto typeBits = [&](const Json& name) -> uint8_t
+        {
+            std::string_view str = name.IsString() ? std::string_view(name.GetString()) : std::string_view();
+
+            if (str == "null") return TypeBit(JsonDataType::Null);
+            if (str == "boolean") return TypeBit(JsonDataType::Boolean);
+            if (str == "object") return TypeBit(JsonDataType::Object);
+            if (str == "array") return TypeBit(JsonDataType::Array);
+            if (str == "string") return TypeBit(JsonDataType::String);
+            if (str == "number") return TypeBit(JsonDataType::Integer) | TypeBit(JsonDataType::Float);
+
+            if (str == "integer") {
+                integralFloats = true;
+                return TypeBit(JsonDataType::Integer);
+            }
+
+            throw std::runtime_error("unknown schema type");
+        };
+
+        if (!value.IsArray())
+            return typeBits(value);
+
+        uint8_t types = 0;
+
+        for (auto& name : value.GetArray())
+            types |= typeBits(name);
+
+        return types;
+    }
+
+    size_t Compile(const Json& schema)
+    {
+        size_t index = nodes.size();
+        nodes.emplace_back();
+
+        // true accepts anything, and false accepts nothing
+        if (schema.IsBoolean())
+        {
+            if (!schema.GetBoolean())
+                nodes[index].types = 0;
+
+            return index;
+        }
+
+        if (!schema.IsObject())
+            throw std::runtime_error("schema must be an object or a boolean");
+
+        static const std::unordered_set<std::string_view> annotations {
+            "$schema", "$id", "id", "$comment", "title", "description", "default",
+            "examples", "format", "readOnly", "writeOnly", "deprecated"
+        };
+
+        for (auto& [key, value] : schema.GetObject())
+        {
+            std::string_view keyword = key;
+
+            if (keyword == "type")
+            {
+                bool integralFloats = false;
+                nodes[index].types = GetTypes(value, integralFloats);
+                nodes[index].integralFloats = integralFloats;
+            }
+            else if (keyword == "properties")
+            {
+                if (!value.IsObject())
+                    throw std::runtime_error("schema keyword properties must be an object");
+
+                for (auto& [name, propertySchema] : value.GetObject())
+                {
+                    size_t node = Compile(propertySchema);
+                    auto& property = nodes[index].properties[std::string(name)];
+                    property.node = node;
+                    property.declared = true;
+                }
+            }
+            else if (keyword == "required")
+            {
+                if (!value.IsArray())
+                    throw std::runtime_error("schema keyword required must be an array");
+
+                for (auto& name : value.GetArray())
+                {
+                    if (!name.IsString())
+                        throw std::runtime_error("schema keyword required must list strings");
+
+                    nodes[index].required.emplace_back(name.GetString());
+                }
+            }
+            else if (keyword == "additionalProperties")
+            {
+                if (value.IsBoolean()) {
+                    nodes[index].additionalProperties = value.GetBoolean();
+                }
+                else {
+                    size_t node = Compile(value);
+                    nodes[index].additionalNode = node;
+                }
+            }
+            else if (keyword == "items")
+            {
+                size_t node = Compile(value);
+                nodes[index].items = node;
+            }
+            else if (keyword == "minimum" || keyword == "exclusiveMinimum")
+            {
+                // the stricter of the two bounds wins
+                Node& node = nodes[index];
+                double bound = GetNumber(value, keyword);
+                bool exclusive = keyword == "exclusiveMinimum";
+
+                if (bound > node.minimum || (bound == node.minimum && exclusive)) {
+                    node.minimum = bound;
+                    node.exclusiveMinimum = exclusive;
+                }
+            }
+            else if (keyword == "maximum" || keyword == "exclusiveMaximum")
+            {
+                Node& node = nodes[index];
+                double bound = GetNumber(value, keyword);
+                bool exclusive = keyword == "exclusiveMaximum";
+
+                if (bound < node.maximum || (bound == node.maximum && exclusive)) {
+                    node.maximum = bound;
+                    node.exclusiveMaximum = exclusive;
+                }
+            }
+            else if (keyword == "minLength") nodes[index].minLength = GetCount(value, keyword);
+            else if (keyword == "maxLength") nodes[index].maxLength = GetCount(value, keyword);
+            else if (keyword == "minItems") nodes[index].minItems = GetCount(value, keyword);
+            else if (keyword == "maxItems") nodes[index].maxItems = GetCount(value, keyword);
+            else if (keyword == "minProperties") nodes[index].minProperties = GetCount(value, keyword);
+            else if (keyword == "maxProperties") nodes[index].maxProperties = GetCount(value, keyword);
+            else if (!annotations.contains(keyword))
+                throw std::runtime_error("unsupported schema keyword: " + std::string(keyword));
+        }
+
+        Node& node = nodes[index];
+
+        // a name that's required twice only needs to be seen once
+        std::sort(node.required.begin(), node.required.end());
+        node.required.erase(std::unique(node.required.begin(), node.required.end()), node.required.end());
+
+        size_t position = 0;
+        for (auto& name : node.required)
+            node.properties[name].required = position++;
+
+        return index;
+    }
+
+public:
+    explicit JsonSchema(const Json& schema) {
+        Compile(schema);
+    }
+
+    // Checks 'text' against the schema without building a tree. Throws a
+    // JsonSchemaError at the first value that doesn't match.
+    void Validate(std::string_view text, const JsonParseOptions& options = {}) const;
+
+    // Parses 'text', checking it against the schema as it's read, so an
+    // invalid document is rejected at the first value that doesn't match,
+    // before the rest of it is parsed.
+    Json Parse(std::string_view text, const JsonParseOptions& options = {}) const;
+};
+
+// JsonHandler that checks parse events against a JsonSchema before
+// forwarding them to another handler, and throws a JsonSchemaError at the
+// first value that doesn't match. Nothing is buffered, so the handler
+// has seen everything before that value when the error is thrown.
+template<JsonHandler Handler>
+class JsonSchemaValidator
+{
+    using Node = JsonSchema::Node;
+
+    struct Frame
+    {
+        const Node* node = nullptr; // null if the container's contents aren't constrained
+        bool isObject = false;
+        size_t count = 0; // elements or members so far
+        size_t requiredStart = 0; // where this object's flags start in 'seenRequired'
+        size_t requiredSeen = 0;
+        const Node* member = nullptr; // schema of the value of the last key
+        std::string_view name{}; // the last key, when its value is constrained
+        std::string key{}; // storage for 'name' when the schema doesn't hold it
+    };
+
+    const JsonSchema& schema;
+    Handler& handler;
+    std::vector<Frame> frames;
+    std::vector<bool> seenRequired;
+
+    // Throws for the value that's being read, or with 'container' set, for
+    // the innermost open container, once it's clear the container is wrong.
+    [[noreturn]] void Fail(const std::string& message, bool container = false) const
+    {
+        std::string path;
+        size_t levels = frames.size() - (container ? 1 : 0);
+
+        for (size_t i = 0; i != levels; ++i)
+        {
+            if (frames[i].isObject)
+                JsonPointer::AppendToken(path, frames[i].name);
+            else
+                JsonPointer::AppendToken(path, std::to_string(frames[i].count - 1));
+        }
+
+        throw JsonSchemaError(path, message);
+    }
+
+    static std::string DescribeTypes(uint8_t types)
+    {
+        static const std::pair<uint8_t, const char*> names[] = {
+            { JsonSchema::TypeBit(JsonDataType::Null), "null" },
+            { JsonSchema::TypeBit(JsonDataType::Boolean), "boolean" },
+            { JsonSchema::TypeBit(JsonDataType::Object), "object" },
+            { JsonSchema::TypeBit(JsonDataType::Array), "array" },
+            { JsonSchema::TypeBit(JsonDataType::String), "string" },
+        };
+
+        std::string str;
+        auto add = [&](const char* name) { str += str.empty() ? name : std::string(" or ") + name; };
+
+        for (auto [bit, name] : names)
+            if (types & bit)
+                add(name);
+
+        uint8_t numbers = types & (JsonSchema::TypeBit(JsonDataType::Integer) | JsonSchema::TypeBit(JsonDataType::Float));
+
+        if (numbers == JsonSchema::TypeBit(JsonDataType::Integer))
+            add("integer");
+        else if (numbers)
+            add("number");
+
+        return str.empty() ? "no value" : str;
+    }
+
+    // Finds the schema of the value that's starting and checks its type.
+    const Node* BeginValue(JsonDataType type, bool integral = false)
+    {
+        const Node* node = &schema.nodes[0];
+
+        if (!frames.empty())
+        {
+            Frame& frame = frames.back();
+
+            if (frame.isObject)
+            {
+                node = frame.member;
+            }
+            else
+            {
+                if (++frame.count > (frame.node ? frame.node->maxItems : SIZE_MAX))
+                    Fail("array has more than " + std::to_string(frame.node->maxItems) + " items", true);
+
+                node = frame.node && frame.node->items != JsonSchema::None ?
+                    &schema.nodes[frame.node->items] : nullptr;
+            }
         }
 
-        return ret;
+        if (node && !(node->types & JsonSchema::TypeBit(type)) && !(integral && node->integralFloats))
+            Fail("expected " + DescribeTypes(node->types));
+
+        return node;
     }
 
-    bool IsEmpty() const
+    void CheckNumber(const Node* node, double value) const
     {
-        if (IsObject())
-            return GetObject().empty();
-        else if (IsArray())
-            return GetArray().empty();
-        else if (IsString())
-            return GetString().empty();
-        else if (IsNull())
-            return true;
-        else // IsInteger() || IsFloat() || IsBoolean()
-            return false;
+        if (!node)
+            return;
+
+        if (value < node->minimum || (node->exclusiveMinimum && value == node->minimum))
+            Fail("number is below the minimum");
+
+        if (value > node->maximum || (node->exclusiveMaximum && value == node->maximum))
+            Fail("number is above the maximum");
     }
 
-    size_t GetSize() const
+    void BeginContainer(const Node* node, bool isObject)
     {
-        if (IsObject())
-            return GetObject().size();
-        else if (IsArray())
-            return GetArray().size();
-        else if (IsString())
-            return GetString().size();
-        else if (IsNull())
-            return 0;
-        else // IsInteger() || IsFloat() || IsBoolean()
-            return 1;
+        Frame frame{ .node = node, .isObject = isObject };
+
+        if (node && isObject)
+        {
+            frame.requiredStart = seenRequired.size();
+            seenRequired.resize(seenRequired.size() + node->required.size(), false);
+        }
+
+        frames.push_back(std::move(frame));
     }
 
-    void Clear()
+public:
+    JsonSchemaValidator(const JsonSchema& schema, Handler& handler)
+        : schema(schema), handler(handler) {}
+
+    void OnNull()
     {
-        if (IsObject())
-            GetObject().clear();
-        else if (IsArray())
-            GetArray().clear();
-        else if (IsString())
-            GetString().clear();
-        else if (IsInteger())
-            GetInteger() = 0;
-        else if (IsFloat())
-            GetFloat() = 0;
-        else if (IsBoolean())
-            GetBoolean() = false;
+        BeginValue(JsonDataType::Null);
+        handler.OnNull();
     }
-    
-    void PushBack(const Json& val)
-    {
-        if (IsNull())
-            data.emplace<ArrayType>();
 
-        GetArray().push_back(val);
+    void OnBoolean(bool value)
+    {
+        BeginValue(JsonDataType::Boolean);
+        handler.OnBoolean(value);
     }
 
-    void PushBack(Json&& val)
+    void OnInteger(int64_t value)
     {
-        if (IsNull())
-            data.emplace<ArrayType>();
+        CheckNumber(BeginValue(JsonDataType::Integer), (double)value);
+        handler.OnInteger(value);
+    }
 
-        GetArray().push_back(std::move(val));
+    void OnFloat(double value)
+    {
+        CheckNumber(BeginValue(JsonDataType::Float, std::trunc(value) == value), value);
+        handler.OnFloat(value);
     }
-    
-    template<class ObjectIter, class ArrayIter, class NullIter = std::nullptr_t>
-    class base_const_iterator
+
+    void OnString(std::string_view value)
     {
-        std::variant<NullIter, ObjectIter, ArrayIter> var;
-    public:
-        base_const_iterator() : var(NullIter{}){}
-        base_const_iterator(ObjectIter it) : var(it){}
-        base_const_iterator(ArrayIter it) : var(it){}
+        const Node* node = BeginValue(JsonDataType::String);
 
-        bool IsNullIter() const {
-            return std::holds_alternative<NullIter>(var);
-        }
+        if (node && (node->minLength != 0 || node->maxLength != SIZE_MAX))
+        {
+            size_t length = 0;
 
-        bool IsObjectIter() const {
-            return std::holds_alternative<ObjectIter>(var);
-        }
+            for (unsigned char c : value)
+                length += (c & 0xC0) != 0x80;
 
-        bool IsArrayIter() const {
-            return std::holds_alternative<ArrayIter>(var);
-        }
+            if (length < node->minLength)
+                Fail("string is shorter than " + std::to_string(node->minLength) + " characters");
 
-        NullIter GetNullIter() const {
-            return std::get<NullIter>(var);
+            if (length > node->maxLength)
+                Fail("string is longer than " + std::to_string(node->maxLength) + " characters");
         }
 
-        ObjectIter GetObjectIter() const {
-            return std::get<ObjectIter>(var);
-        }
+        handler.OnString(value);
+    }
 
-        ObjectIter& GetObjectIter() {
-            return std::get<ObjectIter>(var);
-        }
+    void OnKey(std::string_view key)
+    {
+        Frame& frame = frames.back();
+        frame.member = nullptr;
+        frame.name = {};
 
-        ArrayIter GetArrayIter() const {
-            return std::get<ArrayIter>(var);
-        }
+        if (const Node* node = frame.node)
+        {
+            if (++frame.count > node->maxProperties)
+                Fail("object has more than " + std::to_string(node->maxProperties) + " properties", true);
 
-        ArrayIter& GetArrayIter() {
-            return std::get<ArrayIter>(var);
-        }
+            auto it = node->properties.find(key);
+            bool declared = it != node->properties.end() && it->second.declared;
 
-        const ObjectType::key_type& key() const {
-            return GetObjectIter()->first;
+            if (it != node->properties.end())
+            {
+                size_t required = it->second.required;
+
+                if (required != JsonSchema::None && !seenRequired[frame.requiredStart + required])
+                {
+                    seenRequired[frame.requiredStart + required] = true;
+                    ++frame.requiredSeen;
+                }
+            }
+
+            if (declared)
+            {
+                frame.name = it->first;
+
+                if (it->second.node != JsonSchema::None)
+                    frame.member = &schema.nodes[it->second.node];
+            }
+            else if (!node->additionalProperties || node->additionalNode != JsonSchema::None)
+            {
+                frame.key.assign(key);
+                frame.name = frame.key;
+
+                if (!node->additionalProperties)
+                    Fail("property is not allowed");
+
+                frame.member = &schema.nodes[node->additionalNode];
+            }
         }
 
-        const Json& value() const
+        handler.OnKey(key);
+    }
+
+    void OnObjectStart()
+    {
+        BeginContainer(BeginValue(JsonDataType::Object), true);
+        handler.OnObjectStart();
+    }
+
+    void OnArrayStart()
+    {
+        BeginContainer(BeginValue(JsonDataType::Array), false);
+        handler.OnArrayStart();
+    }
+
+    void OnObjectEnd()
+    {
+        Frame& frame = frames.back();
+
+        if (const Node* node = frame.node)
         {
-            if (IsObjectIter())
-                return GetObjectIter()->second;
-            else if (IsArrayIter())
-                return *GetArrayIter();
+            if (frame.requiredSeen != node->required.size())
+            {
+                for (size_t i = 0; i != node->required.size(); ++i)
+                    if (!seenRequired[frame.requiredStart + i])
+                        Fail("missing required property \"" + node->required[i] + "\"", true);
+            }
 
-            throw std::runtime_error("null");
+            if (frame.count < node->minProperties)
+                Fail("object has fewer than " + std::to_string(node->minProperties) + " properties", true);
+
+            seenRequired.resize(frame.requiredStart);
         }
 
-        const Json& operator*() const {
-            return value();
+        frames.pop_back();
+        handler.OnObjectEnd();
+    }
+
+    void OnArrayEnd()
+    {
+        Frame& frame = frames.back();
+
+        if (frame.node && frame.count < frame.node->minItems)
+            Fail("array has fewer than " + std::to_string(frame.node->minItems) + " items", true);
+
+        frames.pop_back();
+        handler.OnArrayEnd();
+    }
+};
+
+inline void JsonSchema::Validate(std::string_view text, const JsonParseOptions& options) const
+{
+    JsonHandlerBase handler;
+    JsonSchemaValidator<JsonHandlerBase> validator(*this, handler);
+    JsonParser parser(text, options);
+    parser.Parse(validator);
+}
+
+inline Json JsonSchema::Parse(std::string_view text, const JsonParseOptions& options) const
+{
+    JsonDomBuilder builder(options.resource ? options.resource : std::pmr::get_default_resource(), options.keyTable);
+    JsonSchemaValidator<JsonDomBuilder> validator(*this, builder);
+    JsonParser parser(text, options);
+    parser.Parse(validator);
+    return std::move(builder.GetRoot());
+}
+
+struct JsonLinesOptions
+{
+    JsonParseOptions parseOptions;
+
+    // Number of threads that ForEach and ForEachUnordered parse with. Zero
+    // selects std::thread::hardware_concurrency().
+    unsigned threadCount = 0;
+
+    // Approximate size in bytes of the batches of lines that are handed out
+    // to the threads. Each batch ends at a line break.
+    size_t batchSize = 256 * 1024;
+};
+
+// Reads newline-delimited JSON (NDJSON or JSON Lines), where each line holds
+// one value. Blank lines are skipped, and a line with anything after its
+// value is an error, reported with its 1-based line number.
+//
+// Next() reads one value at a time. ForEach and ForEachUnordered split the
+// text into batches of lines and parse them in parallel. Each thread parses
+// into its own arena, which is reused from one batch to the next, so the
+// values passed to the callback are only valid for the duration of the call.
+// Copy them if they need to be kept.
+class JsonLinesReader
+{
+    struct Batch
+    {
+        const char* begin;
+        const char* end;
+        size_t firstLine;
+    };
+
+    std::string_view text;
+    JsonLinesOptions options;
+    size_t offset = 0;
+    size_t line = 0;
+
+    std::vector<Batch> SplitBatches() const;
+    unsigned GetThreadCount(size_t batchCount) const;
+
+    // Calls onValue(line, Json&&) for each value in 'batch'.
+    template<class Func>
+    static void ParseBatch(const Batch& batch, const JsonParseOptions& parseOptions, Func&& onValue);
+
+    static Json ParseLine(std::string_view text, size_t line, const JsonParseOptions& parseOptions);
+public:
+    JsonLinesReader(std::string_view text, const JsonLinesOptions& options = {})
+        : text(text), options(options) {}
+
+    // Parses the next value into 'value', allocating from parseOptions.resource.
+    // Returns false at the end of the text.
+    bool Next(Json& value);
+
+    // Zero-based line index of the value last returned by Next().
+    size_t GetLine() const {
+        return line - 1;
+    }
+
+    // Calls func(line, value) on this thread for every value, in order, while
+    // the following batches are parsed in the background. If a line fails to
+    // parse, the values before it are delivered and then the error is thrown.
+    template<class Func>
+    void ForEach(Func&& func);
+
+    // Calls func(line, value) for every value, in no particular order, from
+    // all of the parsing threads at once. This is faster than ForEach, but
+    // 'func' must be thread-safe. The first error stops all the threads and
+    // is rethrown once they're done.
+    template<class Func>
+    void ForEachUnordered(Func&& func);
+};
+
+inline std::vector<JsonLinesReader::Batch> JsonLinesReader::SplitBatches() const
+{
+    std::vector<Batch> batches;
+
+    const char* p = text.data();
+    const char* end = p + text.size();
+    size_t firstLine = 0;
+    size_t batchSize = std::max<size_t>(options.batchSize, 1);
+
+    while (p != end)
+    {
+        const char* stop = end;
+
+        if ((size_t)(end - p) > batchSize)
+        {
+            auto newline = (const char*)std::memchr(p + batchSize, '\n', end - (p + batchSize));
+            if (newline)
+                stop = newline + 1;
         }
 
-        const Json* operator->() const {
-            return &value();
+        batches.push_back({ p, stop, firstLine });
+        firstLine += std::count(p, stop, '\n');
+        p = stop;
+    }
+
+    return batches;
+}
+
+inline unsigned JsonLinesReader::GetThreadCount(size_t batchCount) const
+{
+    unsigned count = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+    return (unsigned)std::clamp<size_t>(batchCount, 1, std::max(count, 1u));
+}
+
+inline Json JsonLinesReader::ParseLine(std::string_view text, size_t line, const JsonParseOptions& parseOptions)
+{
+    try
+    {
+        JsonParser parser(text, parseOptions);
+        Json value = parser.Parse();
+
+        if (!parser.IsAtEnd())
+            throw std::runtime_error("unexpected input after value");
+
+        return value;
+    }
+    catch (std::exception& ex)
+    {
+        throw std::runtime_error("line " + std::to_string(line + 1) + ": " + ex.what());
+    }
+}
+
+template<class Func>
+inline void JsonLinesReader::ParseBatch(const Batch& batch, const JsonParseOptions& parseOptions, Func&& onValue)
+{
+    const char* p = batch.begin;
+    size_t line = batch.firstLine;
+
+    for (; p != batch.end; ++line)
+    {
+        auto newline = (const char*)std::memchr(p, '\n', batch.end - p);
+        const char* lineEnd = newline ? newline : batch.end;
+
+        if (JsonScanner::SkipWhitespace(p, lineEnd) != lineEnd)
+            onValue(line, ParseLine(std::string_view(p, lineEnd - p), line, parseOptions));
+
+        p = newline ? newline + 1 : batch.end;
+    }
+}
+
+inline bool JsonLinesReader::Next(Json& value)
+{
+    while (offset != text.size())
+    {
+        size_t newline = text.find('\n', offset);
+        size_t lineEnd = newline == std::string_view::npos ? text.size() : newline;
+        auto lineText = text.substr(offset, lineEnd - offset);
+
+        offset = newline == std::string_view::npos ? text.size() : newline + 1;
+        ++line;
+
+        if (JsonScanner::SkipWhitespace(lineText.data(), lineText.data() + lineText.size()) != lineText.data() + lineText.size())
+        {
+            value = ParseLine(lineText, line - 1, options.parseOptions);
+            return true;
         }
+    }
 
-        base_const_iterator operator++(int)
+    return false;
+}
+
+template<class Func>
+inline void JsonLinesReader::ForEach(Func&& func)
+{
+    auto batches = SplitBatches();
+    unsigned threadCount = GetThreadCount(batches.size());
+
+    // Each parsed batch waits in a slot until it's delivered. Workers only
+    // run ahead by as many batches as there are slots, which bounds memory.
+    struct Slot
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        std::vector<std::pair<size_t, Json>> values;
+        std::exception_ptr error;
+        size_t batch = SIZE_MAX;
+    };
+
+    size_t slotCount = (size_t)threadCount * 2;
+    std::unique_ptr<Slot[]> slots(new Slot[slotCount]);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t nextBatch = 0;
+    size_t delivered = 0;
+    bool stop = false;
+
+    auto work = [&]
+    {
+        while (true)
         {
-            base_const_iterator ret = *this;
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || nextBatch == batches.size() || nextBatch < delivered + slotCount; });
 
-            if (IsObjectIter())
-                ++GetObjectIter();
-            else if (IsArrayIter())
-                ++GetArrayIter();
-            else
-                throw std::runtime_error("null");
+                if (stop || nextBatch == batches.size())
+                    return;
 
-            return ret;
+                index = nextBatch++;
+            }
+
+            Slot& slot = slots[index % slotCount];
+            JsonParseOptions parseOptions = options.parseOptions;
+            parseOptions.resource = &slot.arena;
+
+            try {
+                ParseBatch(batches[index], parseOptions, [&](size_t line, Json&& value) {
+                    slot.values.emplace_back(line, std::move(value));
+                });
+            }
+            catch (...) {
+                slot.error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.batch = index;
+            }
+
+            cv.notify_all();
         }
+    };
 
-        base_const_iterator& operator++()
+    std::vector<std::thread> threads;
+
+    struct Joiner
+    {
+        std::vector<std::thread>& threads;
+        std::mutex& mutex;
+        std::condition_variable& cv;
+        bool& stop;
+
+        ~Joiner()
         {
-            if (IsObjectIter())
-                ++GetObjectIter();
-            else if (IsArrayIter())
-                ++GetArrayIter();
-            else
-                throw std::runtime_error("null");
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
 
-            return *this;
+            cv.notify_all();
+
+            for (auto& thread : threads)
+                thread.join();
         }
+    } joiner{ threads, mutex, cv, stop };
 
-        bool operator==(const base_const_iterator& it) const
+    for (unsigned i = 0; i != threadCount; ++i)
+        threads.emplace_back(work);
+
+    for (size_t index = 0; index != batches.size(); ++index)
+    {
+        Slot& slot = slots[index % slotCount];
         {
-            assert(var.index() == it.var.index());
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return slot.batch == index; });
+        }
 
-            bool result;
+        for (auto& [line, value] : slot.values)
+            func(line, value);
 
-            if (IsObjectIter() && it.IsObjectIter())
-                result = GetObjectIter() == it.GetObjectIter();
-            else if (IsArrayIter() && it.IsArrayIter())
-                result = GetArrayIter() == it.GetArrayIter();
-            else
-                result = GetNullIter() == it.GetNullIter();
+        if (slot.error)
+            std::rethrow_exception(slot.error);
 
-            return result;
-        }
+        slot.values.clear();
+        slot.arena.release();
 
-        bool operator!=(const base_const_iterator& it) const {
-            return !(*this == it);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            delivered = index + 1;
         }
-    };
 
-    template<class ObjectIter, class ArrayIter>
-    class base_iterator : public base_const_iterator<ObjectIter, ArrayIter>
+        cv.notify_all();
+    }
+}
+
+template<class Func>
+inline void JsonLinesReader::ForEachUnordered(Func&& func)
+{
+    auto batches = SplitBatches();
+    unsigned threadCount = GetThreadCount(batches.size());
+
+    std::atomic<size_t> nextBatch{ 0 };
+    std::atomic<bool> failed{ false };
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto work = [&]
     {
-    public:
-        Json& value()
+        std::pmr::monotonic_buffer_resource arena;
+        JsonParseOptions parseOptions = options.parseOptions;
+        parseOptions.resource = &arena;
+
+        while (!failed.load(std::memory_order_relaxed))
         {
-            if (this->IsObjectIter())
-                return this->GetObjectIter()->second;
-            else if (this->IsArrayIter())
-                return *this->GetArrayIter();
+            size_t index = nextBatch.fetch_add(1, std::memory_order_relaxed);
+            if (index >= batches.size())
+                break;
 
-            throw std::runtime_error("null");
-        }
+            try {
+                ParseBatch(batches[index], parseOptions, [&](size_t line, Json&& value) {
+                    func(line, value);
+                });
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
 
-        Json& operator*() {
-            return value();
-        }
+                failed = true;
+            }
 
-        Json* operator->() {
-            return &value();
+            arena.release();
         }
     };
 
-    using const_iterator = base_const_iterator<ObjectType::const_iterator, ArrayType::const_iterator>;
-    using iterator = base_iterator<ObjectType::iterator, ArrayType::iterator>;
+    JsonRunOnThreads(threadCount, work);
 
-    iterator begin()
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Owns a parsed value along with the arena that its strings and containers
+// were allocated from. Allocations during parsing are bump-pointer
+// allocations, and the arena's memory is released in one go when the
+// document is destroyed or re-parsed.
+//
+// Values moved out of the document still point into the arena, so copy
+// them if they need to outlive it.
+class JsonDocument
+{
+    // The arena starts in 'buffer', and when a document doesn't fit, the
+    // buffer grows to hold everything the arena allocated for it, so that
+    // documents of a similar size don't allocate at all after that.
+    std::unique_ptr<char[]> buffer;
+    size_t bufferSize = 0;
+    JsonCountingResource upstream;
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+    JsonParser parser;
+    Json root;
+
+    void ResetArena()
     {
-        if(IsObject())
-            return { GetObject().begin() };
-        else if(IsArray())
-            return { GetArray().begin() };
+        size_t needed = bufferSize + upstream.GetAllocatedBytes();
 
-        return {};
-    }
+        if (arena && needed == bufferSize)
+        {
+            arena->release();
+            return;
+        }
 
-    iterator end()
-    {
-        if(IsObject())
-            return { GetObject().end() };
-        else if(IsArray())
-            return { GetArray().end() };
+        arena.reset();
+        upstream.ResetCounts();
 
-        return {};
+        if (needed != bufferSize)
+        {
+            buffer.reset();
+            buffer.reset(new char[needed]);
+            bufferSize = needed;
+        }
+
+        if (bufferSize)
+            arena.emplace(buffer.get(), bufferSize, &upstream);
+        else
+            arena.emplace(&upstream);
     }
 
-    const_iterator begin() const
-    {
-        if(IsObject())
-            return { GetObject().cbegin() };
-        else if(IsArray())
-            return { GetArray().cbegin() };
+public:
+    JsonDocument() {
+        ResetArena();
+    }
 
-        return {};
+    explicit JsonDocument(size_t initialSize)
+        : buffer(new char[initialSize]), bufferSize(initialSize)
+    {
+        ResetArena();
     }
 
-    const_iterator end() const
+    JsonDocument(const JsonDocument&) = delete;
+    JsonDocument& operator=(const JsonDocument&) = delete;
+
+    void Parse(std::string_view text, JsonParseOptions options = {})
     {
-        if(IsObject())
-            return { GetObject().cend() };
-        else if(IsArray())
-            return { GetArray().cend() };
+        root = Json();
+        ResetArena();
 
-        return {};
+        options.resource = &*arena;
+        options.threadCount = 1;
+        parser.Reset(text, options);
+        root = parser.Parse();
     }
 
-    const_iterator find(const ObjectType::key_type& key) const
+    // Like Parse, but decodes strings in place, so 'text' must stay valid
+    // and unmodified for as long as the root is in use (see Json::ParseInSitu).
+    void ParseInSitu(char* text, size_t length, JsonParseOptions options = {})
     {
-        if (IsObject())
-            return { GetObject().find(key) };
-        
-        return {};
+        root = Json();
+        ResetArena();
+
+        options.resource = &*arena;
+        options.threadCount = 1;
+        parser.ResetInSitu(text, length, options);
+        root = parser.Parse();
     }
 
-    iterator find(const ObjectType::key_type& key)
+    // Like Parse, but returns the error instead of throwing it.
+    JsonError TryParse(std::string_view text, JsonParseOptions options = {})
     {
-        if (IsObject())
-            return { GetObject().find(key) };
+        root = Json();
+        ResetArena();
+
+        options.resource = &*arena;
+        parser.Reset(text, options);
+
+        if (!parser.TryParse(root))
+            return parser.GetError();
 
         return {};
     }
-};
 
-inline void to_json(Json& obj, const Json::ObjectType& val) {
-    obj = Json(val);
-}
-
-inline void from_json(const Json& obj, Json::ObjectType& val) {
-    val = obj.GetObject();
-}
+    void ParseFile(const std::filesystem::path& path, const JsonParseOptions& options = {})
+    {
+        JsonMappedFile file(path);
+        Parse(file.GetText(), options);
+    }
 
-inline void to_json(Json& obj, const Json::ArrayType& val) {
-    obj = Json(val);
-}
+    Json& GetRoot() {
+        return root;
+    }
 
-inline void from_json(const Json& obj, Json::ArrayType& val) {
-    val = obj.GetArray();
-}
+    const Json& GetRoot() const {
+        return root;
+    }
 
-template<class T> requires std::is_constructible_v<typename Json::StringType, T>
-inline void to_json(Json& obj, const T& val) {
-    obj = Json(Json::StringType(val));
-}
+    std::pmr::memory_resource* GetResource() {
+        return &*arena;
+    }
+};
 
-inline void from_json(const Json& obj, Json::StringType& val) {
-    val = obj.GetString();
-}
+template<JsonSink Sink>
+inline void JsonPrinter::Indent(Sink& sink, int indent)
+{
+    if(pretty)
+    {
+        static constexpr char spaces[] = "                                                                ";
+        constexpr size_t maxRun = sizeof(spaces) - 1;
 
-template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
-inline void to_json(Json& obj, const T& val) {
-    obj = Json((Json::IntegerType)val);
-}
+        size_t totalIndent = (size_t)indent * indentWidth;
 
-template<class T> requires (std::is_integral_v<T> && !std::is_same_v<T, bool>)
-inline void from_json(const Json& obj, T& val) {
-    val = (T)obj.GetInteger();
-}
+        while (totalIndent > maxRun) {
+            sink.Write(spaces, maxRun);
+            totalIndent -= maxRun;
+        }
 
-template<class T> requires std::is_floating_point_v<T>
-inline void to_json(Json& obj, const T& val) {
-    obj = Json((Json::FloatType)val);
+        sink.Write(spaces, totalIndent);
+    }
 }
 
-template<class T> requires std::is_floating_point_v<T>
-inline void from_json(const Json& obj, T& val) {
-    val = (T)obj.GetFloat();
+inline JsonPrinter::JsonPrinter(int indentWidth, unsigned threadCount)
+    : indentWidth(indentWidth),
+    pretty(indentWidth != -1),
+    threadCount(threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u))
+{
 }
 
-template<class T> requires std::is_same_v<typename Json::BooleanType, T>
-inline void to_json(Json& obj, const T& val) {
-    obj = Json(val);
+inline std::string JsonPrinter::ToString(const Json& value)
+{
+    std::string str;
+    ToString(value, str);
+    return str;
 }
 
-template<class T> requires std::is_same_v<typename Json::BooleanType, T>
-inline void from_json(const Json& obj, T& val) {
-    val = obj.GetBoolean();
+inline void JsonPrinter::ToString(const Json& value, std::string& str)
+{
+    str.clear();
+    JsonStringSink sink(str);
+    Print(sink, 0, value, threadCount > 1);
 }
 
-inline void to_json(Json& obj, const std::nullptr_t& val) {
-    obj = Json();
+inline void JsonPrinter::ToStream(std::ostream& stream, int indent, const Json& value)
+{
+    JsonStreamSink sink(stream);
+    Print(sink, indent, value, threadCount > 1);
 }
 
-inline void from_json(const Json& obj, std::nullptr_t& val) {
-    val = nullptr;
+template<JsonSink Sink>
+inline void JsonPrinter::Write(Sink& sink, int indent, const Json& value)
+{
+    Print(sink, indent, value, false);
 }
 
-template<class T>
-inline void to_json(Json& obj, const std::forward_list<T>& cont)
+template<JsonSink Sink>
+inline void JsonPrinter::Print(Sink& sink, int indent, const Json& value, bool parallel)
 {
-    Json val = Json::Array();
+    if (!stats)
+    {
+        if (parallel)
+            WriteParallel(sink, indent, value);
+        else
+            WriteTree(sink, indent, value);
 
-    for(auto& elem : cont) {
-        val.PushBack(elem);
+        return;
     }
 
-    obj = std::move(val);
-}
-
-template<class T>
-inline void from_json(const Json& obj, std::forward_list<T>& cont)
-{
-    auto& arr = obj.GetArray();
-    cont.clear();
+    JsonStatsTimer timer(&stats->time);
+    JsonCountingSink<Sink> counting(sink, stats->bytes);
 
-    for (auto it = arr.rbegin(); it != arr.rend(); ++it) {
-        cont.push_front(it->Get<T>());
-    }
+    if (parallel)
+        WriteParallel(counting, indent, value);
+    else
+        WriteTree(counting, indent, value);
 }
 
-template<class T>
-inline void to_json(Json& obj, const std::list<T>& cont)
+inline void JsonPrinter::CountValue(const Json& value)
 {
-    Json val = Json::Array();
-
-    for(auto& elem : cont) {
-        val.PushBack(elem);
-    }
-
-    obj = std::move(val);
+    if (stats)
+        ++stats->values[(size_t)value.GetType()];
 }
 
-template<class T>
-inline void from_json(const Json& obj, std::list<T>& cont)
+// Writes element 'index' of an array or object, along with the separator
+// and indentation before it, exactly as Write does.
+template<JsonSink Sink>
+inline void JsonPrinter::WriteMember(Sink& sink, int indent, size_t index, const Json& container)
 {
-    auto& arr = obj.GetArray();
-    cont.clear();
+    WriteSeparator(sink, indent, index);
 
-    for(auto& val : arr) {
-        cont.push_back(val.Get<T>());
+    if (container.IsObject())
+    {
+        auto& [key, val] = container.GetObject().begin()[index];
+        WriteEscaped(sink, key);
+        sink.Put(':');
+        if (pretty) sink.Put(' ');
+        WriteTree(sink, indent + 1, val);
+    }
+    else
+    {
+        WriteTree(sink, indent + 1, container.GetArray()[index]);
     }
 }
 
-template<class T, size_t N>
-inline void to_json(Json& obj, const std::array<T, N>& cont)
+// Like Write, but looks for large containers to hand to WriteChunked.
+template<JsonSink Sink>
+inline void JsonPrinter::WriteParallel(Sink& sink, int indent, const Json& value)
 {
-    Json val = Json::Array();
-
-    for(size_t i = 0; i != N; ++i) {
-        val.PushBack(cont[i]);
+    if ((!value.IsObject() && !value.IsArray()) || indent >= ParallelMaxDepth)
+    {
+        WriteTree(sink, indent, value);
+        return;
     }
 
-    obj = std::move(val);
-}
+    CountValue(value);
+    size_t size = value.GetSize();
 
-template<class T, size_t N>
-inline void from_json(const Json& obj, std::array<T, N>& cont)
-{
-    auto& arr = obj.GetArray();
-    
-    for(size_t i = 0; i != N; ++i) {
-        cont[i] = arr[i].Get<T>();
+    if (size >= ParallelThreshold)
+    {
+        WriteChunked(sink, indent, value);
+        return;
     }
-}
 
-template<class T>
-inline void to_json(Json& obj, const std::vector<T>& cont)
-{
-    Json val = Json::Array();
+    bool isObject = value.IsObject();
+    sink.Put(isObject ? '{' : '[');
 
-    for(auto& elem : cont)
-        val.PushBack(elem);
+    if (isObject)
+    {
+        size_t i = 0;
+        for (auto& [key, val] : value.GetObject())
+        {
+            WriteSeparator(sink, indent, i++);
+            WriteEscaped(sink, key);
+            sink.Put(':');
+            if (pretty) sink.Put(' ');
+            WriteParallel(sink, indent + 1, val);
+        }
+    }
+    else
+    {
+        size_t i = 0;
+        for (auto& elem : value.GetArray())
+        {
+            WriteSeparator(sink, indent, i++);
+            WriteParallel(sink, indent + 1, elem);
+        }
+    }
 
-    obj = std::move(val);
+    EndContainer(sink, indent, isObject ? '}' : ']', size == 0);
 }
 
-template<class T>
-inline void from_json(const Json& obj, std::vector<T>& cont)
+template<JsonSink Sink>
+inline void JsonPrinter::WriteChunked(Sink& sink, int indent, const Json& value)
 {
-    auto& arr = obj.GetArray();
-    cont.clear();
+    size_t size = value.GetSize();
 
-    for(auto& val : arr) {
-        cont.push_back(val.Get<T>());
-    }
-}
+    // more chunks than threads evens out elements that differ in size
+    size_t chunkCount = std::min<size_t>((size_t)threadCount * 4, size);
+    size_t chunkSize = (size + chunkCount - 1) / chunkCount;
+    std::vector<std::string> chunks(chunkCount);
 
-template<class K, class T, class H> requires (std::is_constructible_v<typename Json::StringType, K> || has_to_string<K>::value)
-inline void to_json(Json& obj, const std::unordered_map<K, T, H>& cont)
-{
-    Json ret = Json::Object();
-    auto& objectValue = ret.GetObject();
+    std::atomic<size_t> nextChunk{ 0 };
+    std::mutex errorMutex;
+    std::exception_ptr error;
 
-    for(auto& [key, value] : cont)
+    JsonRunOnThreads(threadCount, [&]
     {
-        if constexpr (std::is_constructible_v<typename Json::StringType, K>)
+        // each thread counts into its own stats, which are added up at the
+        // end, and the bytes are counted as the chunks are joined
+        JsonDumpStats threadStats;
+        JsonPrinter printer = *this;
+
+        if (stats)
+            printer.stats = &threadStats;
+
+        while (true)
         {
-            objectValue[key] = Json(value);
+            size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= chunkCount)
+                break;
+
+            try
+            {
+                JsonStringSink chunkSink(chunks[chunk]);
+                size_t end = std::min(size, (chunk + 1) * chunkSize);
+
+                for (size_t i = chunk * chunkSize; i < end; ++i)
+                    printer.WriteMember(chunkSink, indent, i, value);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+            }
         }
-        else
+
+        if (stats)
         {
-            std::string k;
-            to_string(k, key);
-            objectValue[k] = Json(value);
+            std::lock_guard<std::mutex> lock(errorMutex);
+
+            for (size_t t = 0; t != stats->values.size(); ++t)
+                stats->values[t] += threadStats.values[t];
+
+            stats->strings += threadStats.strings;
+            stats->escapes += threadStats.escapes;
         }
-    }
+    });
 
-    obj = std::move(ret);
+    if (error)
+        std::rethrow_exception(error);
+
+    sink.Put(value.IsObject() ? '{' : '[');
+
+    for (auto& chunk : chunks)
+        sink.Write(chunk.data(), chunk.size());
+
+    EndContainer(sink, indent, value.IsObject() ? '}' : ']', false);
 }
 
-template<class K, class T, class H> requires (std::is_constructible_v<K, typename Json::StringType> || has_from_string<K>::value)
-inline void from_json(const Json& obj, std::unordered_map<K, T, H>& cont)
+template<JsonSink Sink>
+inline void JsonPrinter::WriteEscaped(Sink& sink, std::string_view val)
 {
-    auto& objectValue = obj.GetObject();
-    cont.clear();
-
-    for(auto& [key, val] : objectValue)
+    // maps each byte to the character that follows its backslash, or 0 if it's written as is
+    static constexpr auto escapes = [] {
+        std::array<char, 256> table{};
+        table['\"'] = '\"';
+        table['\\'] = '\\';
+        table['\r'] = 'r';
+        table['\n'] = 'n';
+        table['\t'] = 't';
+        table['\b'] = 'b';
+        table['\f'] = 'f';
+        return table;
+    }();
+
+    sink.Put('\"');
+
+    if (stats)
+        ++stats->strings;
+
+    const char* p = val.data();
+    const char* end = p + val.size();
+    const char* run = p;
+
+    for (; p != end; ++p)
     {
-        if constexpr (std::is_constructible_v<K, typename Json::StringType>)
-        {
-            cont[key] = val.Get<T>();
-        }
-        else
+        char escape = escapes[(unsigned char)*p];
+        if (escape)
         {
-            K k;
-            from_string(key, k);
-            cont[k] = val.Get<T>();
+            if (stats)
+                ++stats->escapes;
+
+            // copy everything since the last escape in one go
+            sink.Write(run, p - run);
+            sink.Put('\\');
+            sink.Put(escape);
+            run = p + 1;
         }
     }
+
+    sink.Write(run, p - run);
+    sink.Put('\"');
 }
 
-template<class K, class T, class H>
-inline void to_json(Json& obj, const std::map<K, T, H>& cont)
+template<JsonSink Sink, class T>
+inline void JsonPrinter::WriteInteger(Sink& sink, T val)
 {
-    Json ret = Json::Object();
-    auto& objectValue = ret.GetObject();
-
-    for(auto& [key, value] : cont)
-        objectValue[Json(key)] = Json(value);
-
-    obj = std::move(ret);
+    char chars[21];
+    auto ret = std::to_chars(&chars[0], &chars[0] + sizeof(chars), val);
+    sink.Write(chars, ret.ptr - chars);
 }
 
-template<class K, class T, class H>
-inline void from_json(const Json& obj, std::map<K, T, H>& cont)
+template<JsonSink Sink>
+inline void JsonPrinter::WriteFloat(Sink& sink, double val)
 {
-    auto& objectValue = obj.GetObject();
-    cont.clear();
+    constexpr int MaxDigits = 325;
+    char chars[MaxDigits];
 
-    for(auto& [key, val] : objectValue) {
-        cont[Json(key)] = val.Get<T>();
+    auto ret = std::to_chars(
+        &chars[0], &chars[0] + MaxDigits,
+        val, std::chars_format::general);
+
+    std::string_view str(&chars[0], ret.ptr);
+    if(str.find_first_of(".e") == std::string_view::npos)
+    {
+        auto p = ret.ptr;
+        *p++ = '.';
+        *p++ = '0';
+        str = std::string_view(&chars[0], p);
     }
-}
 
-inline JsonParser::JsonParser(const std::string& text)
-    : lexer(text){}
+    sink.Write(str.data(), str.size());
+}
 
-inline Json JsonParser::Parse()
+// Writes what comes before the member or element at 'index'.
+template<JsonSink Sink>
+inline void JsonPrinter::WriteSeparator(Sink& sink, int indent, size_t index)
 {
-    if (!NextToken())
-        throw std::runtime_error("input is empty");
-
-    return ParseValue();
-}
+    if (index) {
+        sink.Put(',');
+        if (pretty) sink.Put('\n');
+    }
+    else if (pretty) {
+        sink.Put('\n');
+    }
 
-inline bool JsonParser::NextToken(bool thrownOnEOF) {
-    token = std::move(lexer.GetNextToken());
-    return token.type != JsonTokenType::EndOfFile;
+    Indent(sink, indent + 1);
 }
 
-inline Json JsonParser::ParseValue()
+template<JsonSink Sink>
+inline void JsonPrinter::EndContainer(Sink& sink, int indent, char close, bool empty)
 {
-    switch (token.type)
+    if (!empty)
     {
-    case JsonTokenType::ObjectStart:
-        return ParseObject();
-    case JsonTokenType::ArrayStart:
-        return ParseArray();
-    case JsonTokenType::String:
-        return ParseString();
-    case JsonTokenType::Integer:
-        return ParseInteger();
-    case JsonTokenType::Float:
-        return ParseFloat();
-    case JsonTokenType::Boolean:
-        return ParseBoolean();
-    case JsonTokenType::Null:
-        return ParseNull();
-    case JsonTokenType::EndOfFile:
-        throw std::runtime_error("unexpected end of input");
-    default:
-        throw std::runtime_error("unexpected token");
+        if (pretty) sink.Put('\n');
+        Indent(sink, indent);
     }
-}
 
-inline Json JsonParser::ParseString()
-{
-    assert(token.type == JsonTokenType::String);
-    auto ret = Json(token.GetString());
-    NextToken(false);
-    return ret;
+    sink.Put(close);
 }
 
-inline Json JsonParser::ParseInteger()
+template<JsonSink Sink, class T>
+inline void JsonPrinter::WriteValue(Sink& sink, int indent, const T& value)
 {
-    assert(token.type == JsonTokenType::Integer);
-    auto ret = Json(token.GetInteger());
-    NextToken(false);
-    return ret;
-}
+    if constexpr (std::is_same_v<T, Json>)
+    {
+        Write(sink, indent, value);
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        if (value)
+            sink.Write("true", 4);
+        else
+            sink.Write("false", 5);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        WriteInteger(sink, value);
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        WriteFloat(sink, (double)value);
+    }
+    else if constexpr (std::is_same_v<T, std::nullptr_t>)
+    {
+        sink.Write("null", 4);
+    }
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+    {
+        WriteEscaped(sink, value);
+    }
+    else if constexpr (JsonReflected<T>)
+    {
+        size_t i = 0;
+        sink.Put('{');
+
+        JsonFieldTable<T>::ForEach(value, [&](std::string_view name, const auto& member) {
+            WriteSeparator(sink, indent, i++);
+            WriteEscaped(sink, name);
+            sink.Put(':');
+            if (pretty) sink.Put(' ');
+            WriteValue(sink, indent + 1, member);
+        });
+
+        EndContainer(sink, indent, '}', false);
+    }
+    else if constexpr (is_json_string_map<T>)
+    {
+        size_t i = 0;
+        sink.Put('{');
 
-inline Json JsonParser::ParseFloat()
-{
-    assert(token.type == JsonTokenType::Float);
-    auto ret = Json(token.GetFloat());
-    NextToken(false);
-    return ret;
-}
+        for (auto& [key, member] : value)
+        {
+            WriteSeparator(sink, indent, i++);
+            WriteEscaped(sink, key);
+            sink.Put(':');
+            if (pretty) sink.Put(' ');
+            WriteValue(sink, indent + 1, member);
+        }
 
-inline Json JsonParser::ParseBoolean()
-{
-    assert(token.type == JsonTokenType::Boolean);
-    auto ret = Json(token.GetBoolean());
-    NextToken(false);
-    return ret;
-}
+        EndContainer(sink, indent, '}', i == 0);
+    }
+    else if constexpr (is_json_sequence<T>)
+    {
+        size_t i = 0;
+        sink.Put('[');
 
-inline Json JsonParser::ParseNull()
-{
-    assert(token.type == JsonTokenType::Null);
-    auto ret = Json();
-    NextToken(false);
-    return ret;
+        for (auto& elem : value)
+        {
+            WriteSeparator(sink, indent, i++);
+            WriteValue(sink, indent + 1, (const typename T::value_type&)elem);
+        }
+
+        EndContainer(sink, indent, ']', i == 0);
+    }
+    else
+    {
+        Write(sink, indent, Json(value));
+    }
 }
 
-inline Json JsonParser::ParseObject()
+// Open containers are kept on an explicit stack instead of the call stack,
+// which starts out in a local buffer so shallow values don't allocate.
+template<JsonSink Sink>
+inline void JsonPrinter::WriteTree(Sink& sink, int indent, const Json& value)
 {
-    assert(token.type == JsonTokenType::ObjectStart);
-    NextToken();
+    struct Frame
+    {
+        const Json* container;
+        size_t index;
+        size_t size;
+    };
 
-    Json::ObjectType values;
+    constexpr size_t LocalFrames = 32;
+    alignas(Frame) unsigned char buffer[LocalFrames * sizeof(Frame)];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    std::pmr::vector<Frame> stack(&arena);
+    stack.reserve(LocalFrames);
 
-    while (token.type != JsonTokenType::ObjectEnd)
+    const Json* current = &value;
+
+    while (true)
     {
-        if (token.type != JsonTokenType::String)
-            throw std::runtime_error("expected string");
+        CountValue(*current);
 
-        Json key = ParseString();
+        switch (current->GetType())
+        {
+        default:
+        case JsonDataType::Null:
+            sink.Write("null", 4);
+            break;
 
-        if (token.type != JsonTokenType::Colon)
-            throw std::runtime_error("expected colon");
+        case JsonDataType::Object:
+        case JsonDataType::Array:
+        {
+            bool isObject = current->IsObject();
+            size_t size = current->GetSize();
+            sink.Put(isObject ? '{' : '[');
 
-        NextToken();
+            if (size == 0)
+                sink.Put(isObject ? '}' : ']');
+            else
+                stack.push_back({ current, 0, size });
+
+            break;
+        }
+        case JsonDataType::String:
+            WriteEscaped(sink, current->GetString());
+            break;
 
-        values[key.GetString()] = ParseValue();
+        case JsonDataType::Integer:
+            WriteInteger(sink, current->GetInteger());
+            break;
 
-        if (token.type == JsonTokenType::Comma)
-        {
-            NextToken();
+        case JsonDataType::Float:
+            WriteFloat(sink, current->GetFloat());
+            break;
 
-            if (token.type == JsonTokenType::ObjectEnd)
-                throw std::runtime_error("expected a value");
+        case JsonDataType::Boolean:
+            if (current->GetBoolean())
+                sink.Write("true", 4);
+            else
+                sink.Write("false", 5);
+            break;
         }
-        else
+
+        // close the containers that are finished, then move on to the next
+        // element of the innermost one that isn't
+        while (true)
         {
-            if (token.type != JsonTokenType::ObjectEnd)
-                throw std::runtime_error("expected '}'");
+            if (stack.empty())
+                return;
+
+            Frame& top = stack.back();
+            int level = indent + (int)stack.size() - 1;
+            bool isObject = top.container->IsObject();
+
+            if (top.index == top.size)
+            {
+                EndContainer(sink, level, isObject ? '}' : ']', false);
+                stack.pop_back();
+                continue;
+            }
+
+            WriteSeparator(sink, level, top.index);
+
+            if (isObject)
+            {
+                auto& [key, val] = top.container->GetObject().begin()[top.index];
+                WriteEscaped(sink, key);
+                sink.Put(':');
+                if (pretty) sink.Put(' ');
+                current = &val;
+            }
+            else
+            {
+                current = &top.container->GetArray()[top.index];
+            }
+
+            ++top.index;
+            break;
         }
     }
+}
 
-    NextToken();
+inline std::string JsonCborWriter::ToString(const Json& value)
+{
+    std::string str;
+    JsonStringSink sink(str);
+    Write(sink, value);
+    return str;
+}
+
+template<JsonSink Sink>
+inline void JsonCborWriter::WriteHead(Sink& sink, uint8_t major, uint64_t value)
+{
+    char bytes[9];
+    size_t size;
+
+    major <<= 5;
+
+    if (value < 24) {
+        bytes[0] = (char)(major | value);
+        size = 1;
+    }
+    else if (value <= UINT8_MAX) {
+        bytes[0] = (char)(major | 24);
+        size = 2;
+    }
+    else if (value <= UINT16_MAX) {
+        bytes[0] = (char)(major | 25);
+        size = 3;
+    }
+    else if (value <= UINT32_MAX) {
+        bytes[0] = (char)(major | 26);
+        size = 5;
+    }
+    else {
+        bytes[0] = (char)(major | 27);
+        size = 9;
+    }
 
-    return Json(std::move(values));
+    for (size_t i = 1; i != size; ++i)
+        bytes[i] = (char)(value >> (8 * (size - 1 - i)));
+
+    sink.Write(bytes, size);
 }
 
-inline Json JsonParser::ParseArray()
+template<JsonSink Sink>
+inline void JsonCborWriter::Write(Sink& sink, const Json& value)
 {
-    assert(token.type == JsonTokenType::ArrayStart);
-    NextToken();
+    switch (value.GetType())
+    {
+    case JsonDataType::Null:
+        sink.Put((char)0xF6);
+        break;
 
-    std::vector<Json> values;
+    case JsonDataType::Boolean:
+        sink.Put(value.GetBoolean() ? (char)0xF5 : (char)0xF4);
+        break;
 
-    while (token.type != JsonTokenType::ArrayEnd)
+    case JsonDataType::Integer:
     {
-        values.push_back(ParseValue());
+        auto integer = value.GetInteger();
 
-        if (token.type == JsonTokenType::Comma)
-        {
-            NextToken();
+        if (integer >= 0)
+            WriteHead(sink, 0, (uint64_t)integer);
+        else
+            WriteHead(sink, 1, (uint64_t)(-1 - integer));
+        break;
+    }
+    case JsonDataType::Float:
+    {
+        auto floating = value.GetFloat();
 
-            if (token.type == JsonTokenType::ArrayEnd)
-                throw std::runtime_error("expected a value");
+        // the range check keeps the conversion to float defined
+        if (std::isnan(floating) || (std::fabs(floating) <= FLT_MAX && (double)(float)floating == floating))
+        {
+            uint32_t bits = std::bit_cast<uint32_t>((float)floating);
+            char bytes[5] = { (char)0xFA, (char)(bits >> 24), (char)(bits >> 16), (char)(bits >> 8), (char)bits };
+            sink.Write(bytes, 5);
         }
         else
         {
-            if (token.type != JsonTokenType::ArrayEnd)
-                throw std::runtime_error("expected ']'");
+            uint64_t bits = std::bit_cast<uint64_t>(floating);
+            char bytes[9] = { (char)0xFB };
+
+            for (int i = 0; i != 8; ++i)
+                bytes[1 + i] = (char)(bits >> (56 - 8 * i));
+
+            sink.Write(bytes, 9);
         }
+        break;
+    }
+    case JsonDataType::String:
+    {
+        auto& str = value.GetString();
+        WriteHead(sink, 3, str.size());
+        sink.Write(str.data(), str.size());
+        break;
     }
+    case JsonDataType::Array:
+    {
+        auto& arr = value.GetArray();
+        WriteHead(sink, 4, arr.size());
 
-    NextToken();
+        for (auto& elem : arr)
+            Write(sink, elem);
+        break;
+    }
+    case JsonDataType::Object:
+    {
+        auto& obj = value.GetObject();
+        WriteHead(sink, 5, obj.size());
 
-    return Json(std::move(values));
+        for (auto& [key, member] : obj)
+        {
+            WriteHead(sink, 3, key.size());
+            sink.Write(key.data(), key.size());
+            Write(sink, member);
+        }
+        break;
+    }
+    }
 }
 
-inline void JsonPrinter::Indent(std::ostream& stream, int indent)
+inline JsonCborReader::JsonCborReader(std::string_view data, const JsonParseOptions& options)
+    : pos((const uint8_t*)data.data()), end((const uint8_t*)data.data() + data.size()), options(options),
+    resource(options.resource ? options.resource : std::pmr::get_default_resource())
 {
-    if(pretty)
-    {
-        int totalIndent = indent * indentWidth;
-
-        for(int i = 0; i != totalIndent; ++i)
-            stream.put(' ');
-    }
 }
 
-inline JsonPrinter::JsonPrinter(int indentWidth)
-    : indentWidth(indentWidth),
-    pretty(indentWidth != -1)
+inline Json JsonCborReader::Read()
 {
+    if (pos == end)
+        throw std::runtime_error("input is empty");
+
+    Json value = ReadValue();
+
+    if (pos != end)
+        throw std::runtime_error("unexpected input after value");
+
+    return value;
 }
 
-inline std::string JsonPrinter::ToString(const Json& value)
+inline void JsonCborReader::Require(uint64_t count)
 {
-    std::stringstream stream;
-    ToStream(stream, 0, value);
-    return stream.str();
+    if ((uint64_t)(end - pos) < count)
+        throw std::runtime_error("unexpected end of input");
 }
 
-inline void JsonPrinter::WriteEscaped(std::ostream& stream, const std::string& val)
+inline uint64_t JsonCborReader::ReadBigEndian(size_t count)
 {
-    stream << '\"';
+    Require(count);
 
-    for(auto& c : val)
-    {
-        if(c == '\"')
-            stream << '\\' << '\"';
-        else if (c == '\\')
-            stream << '\\' << '\\';
-        else if(c == '\r')
-            stream << '\\' << 'r';
-        else if(c == '\n')
-            stream << '\\' << 'n';
-        else if(c == '\t')
-            stream << '\\' << 't';
-        else if(c == '\b')
-            stream << '\\' << 'b';
-        else if(c == '\f')
-            stream << '\\' << 'f';
-        else
-            stream << c;
-    }
+    uint64_t value = 0;
+    for (size_t i = 0; i != count; ++i)
+        value = (value << 8) | *pos++;
 
-    stream << '\"';
+    return value;
 }
 
-inline void JsonPrinter::ToStream(std::ostream& stream, int indent, const Json& value)
+inline uint64_t JsonCborReader::ReadArgument(uint8_t info)
 {
-    switch (value.GetType())
+    switch (info)
     {
+    case 24: return ReadBigEndian(1);
+    case 25: return ReadBigEndian(2);
+    case 26: return ReadBigEndian(4);
+    case 27: return ReadBigEndian(8);
     default:
-    case JsonDataType::Null:
-        stream << "null";
-        break;
-
-    case JsonDataType::Object:
-    {
-        auto& obj = value.GetObject();
+        if (info < 24)
+            return info;
 
-        stream << '{';
-        if (pretty && !obj.empty()) stream << '\n';
+        throw std::runtime_error("unsupported cbor item");
+    }
+}
 
-        int i = 0;
-        for (auto& [key, val] : obj)
-        {
-            if (i++) {
-                stream << ',';
-                if (pretty) stream << '\n';
-            }
+inline std::string_view JsonCborReader::ReadText(uint64_t length)
+{
+    Require(length);
 
-            Indent(stream, indent + 1);
+    auto begin = (const char*)pos;
+    pos += length;
 
-            WriteEscaped(stream, key);
-            stream << ':';
-            if (pretty) stream << ' ';
-            ToStream(stream, indent + 1, val);
-        }
+    if (options.validateUtf8 && !utf8::is_valid(begin, begin + length))
+        throw std::runtime_error("invalid utf-8 in string");
 
-        if (!obj.empty())
-        {
-            if (pretty) stream << '\n';
-            Indent(stream, indent);
-        }
+    return std::string_view(begin, (size_t)length);
+}
 
-        stream << '}';
-        break;
-    }
-    case JsonDataType::Array:
-    {
-        stream << '[';
+inline JsonString JsonCborReader::ReadString(uint64_t length) {
+    return JsonString(ReadText(length), resource);
+}
 
-        auto& arr = value.GetArray();
+inline Json JsonCborReader::ReadValue()
+{
+    Require(1);
 
-        if (pretty && !arr.empty()) stream << '\n';
+    uint8_t major = *pos >> 5;
+    uint8_t info = *pos & 31;
+    ++pos;
 
-        int i = 0;
-        for (auto& elem : arr)
+    if (major == 7)
+    {
+        switch (info)
         {
-            if (i++) {
-                stream << ',';
-                if (pretty) stream << '\n';
-            }
+        case 20: return Json(false);
+        case 21: return Json(true);
+        case 22: return Json();
+        case 25:
+        {
+            auto half = (uint32_t)ReadBigEndian(2);
+            int exponent = (half >> 10) & 0x1F;
+            int mantissa = half & 0x3FF;
+
+            double floating;
+            if (exponent == 0)
+                floating = std::ldexp(mantissa, -24);
+            else if (exponent != 31)
+                floating = std::ldexp(mantissa + 1024, exponent - 25);
+            else
+                floating = mantissa ? std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::infinity();
 
-            Indent(stream, indent + 1);
-            ToStream(stream, indent + 1, elem);
+            return Json((half & 0x8000) ? -floating : floating);
         }
-
-        if (!arr.empty())
-        {
-            if (pretty) stream << '\n';
-            Indent(stream, indent);
+        case 26: return Json((double)std::bit_cast<float>((uint32_t)ReadBigEndian(4)));
+        case 27: return Json(std::bit_cast<double>(ReadBigEndian(8)));
+        default:
+            throw std::runtime_error("unsupported cbor item");
         }
-
-        stream << ']';
-        break;
     }
-    case JsonDataType::String:
+
+    uint64_t argument = ReadArgument(info);
+
+    switch (major)
     {
-        auto& val = value.GetString();
-        WriteEscaped(stream, val);
-        break;
-    }
-    case JsonDataType::Integer:
+    case 0:
+        if (argument <= (uint64_t)INT64_MAX)
+            return Json((int64_t)argument);
+
+        // like the text parser, integers that don't fit become floats
+        return Json((double)argument);
+
+    case 1:
+        if (argument <= (uint64_t)INT64_MAX)
+            return Json(-1 - (int64_t)argument);
+
+        return Json(-1.0 - (double)argument);
+
+    case 3:
+        return Json(ReadString(argument));
+
+    case 4:
     {
-        auto integer = value.Get<Json::IntegerType>();
-        stream << integer;
-        break;
+        // every element takes at least a byte, which bounds the reservation
+        Require(argument);
+
+        if (++depth > options.maxDepth)
+            throw std::runtime_error("maximum nesting depth exceeded");
+
+        Json ret = Json::Array(resource);
+        auto& arr = ret.GetArray();
+        arr.reserve((size_t)argument);
+
+        for (uint64_t i = 0; i != argument; ++i)
+            arr.push_back(ReadValue());
+
+        --depth;
+
+        return ret;
     }
-    case JsonDataType::Float:
+    case 5:
     {
-        auto floating = value.Get<Json::FloatType>();
+        // every member takes at least two bytes
+        if (argument > (uint64_t)(end - pos) / 2)
+            throw std::runtime_error("unexpected end of input");
 
-        constexpr int MaxDigits = 325;
-        char chars[MaxDigits];
+        if (++depth > options.maxDepth)
+            throw std::runtime_error("maximum nesting depth exceeded");
 
-        auto ret = std::to_chars(
-            &chars[0], &chars[0] + MaxDigits,
-            floating, std::chars_format::general);
+        Json ret = Json::Object(resource);
+        auto& obj = ret.GetObject();
+        obj.reserve((size_t)argument);
 
-        std::string_view str(&chars[0], ret.ptr);
-        if(str.find('.') == std::string_view::npos)
+        for (uint64_t i = 0; i != argument; ++i)
         {
-            auto p = ret.ptr;
-            *p++ = '.';
-            *p++ = '0';
-            str = std::string_view(&chars[0], p);
-        }
+            Require(1);
 
-        stream << str;
+            if ((*pos >> 5) != 3)
+                throw std::runtime_error("expected string");
 
-        break;
-    }
-    case JsonDataType::Boolean:
-    {
-        auto boolean = value.Get<Json::BooleanType>();
-        stream << std::boolalpha << boolean;
-        break;
+            uint8_t keyInfo = *pos++ & 31;
+            uint64_t keyLength = ReadArgument(keyInfo);
+            JsonString key = options.keyTable ? options.keyTable->MakeKey(ReadText(keyLength)) : ReadString(keyLength);
+            obj.insert_or_assign(std::move(key), ReadValue());
+        }
+
+        --depth;
+        return ret;
     }
+    default:
+        throw std::runtime_error("unsupported cbor item");
     }
 }
@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Json.h"
+
+// Counts allocations, to report how many each operation makes.
+std::atomic<size_t> allocationCount{ 0 };
+
+void* operator new(size_t size)
+{
+    ++allocationCount;
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// std::pmr::new_delete_resource allocates through these
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    ++allocationCount;
+    size_t align = std::max((size_t)alignment, sizeof(void*));
+
+    // over-allocate and keep the original pointer just before the aligned block
+    if (void* p = std::malloc(size + align + sizeof(void*)))
+    {
+        uintptr_t aligned = ((uintptr_t)p + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+        ((void**)aligned)[-1] = p;
+        return (void*)aligned;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    if (p)
+        std::free(((void**)p)[-1]);
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+    operator delete(p, alignment);
+}
+
+std::string ReadFile(const std::string& filename)
+{
+    std::ifstream fin(filename, std::ios::in | std::ios::binary);
+
+    if (!fin.good())
+        throw std::runtime_error("failed to open file");
+
+    fin.seekg(0, std::ios::end);
+    auto sz = (size_t)fin.tellg();
+    fin.seekg(0, std::ios::beg);
+
+    std::string contents;
+    contents.resize(sz);
+    fin.read(contents.data(), sz);
+
+    return contents;
+}
+
+// Array of small homogeneous records, like an API response.
+std::string MakeRecords(size_t count)
+{
+    std::mt19937 rng(1);
+    Json arr = Json::Array();
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        Json rec;
+        rec["id"] = (int64_t)i;
+        rec["name"] = "user" + std::to_string(rng() % 100000);
+        rec["score"] = (double)(rng() % 10000) / 100.0;
+        rec["active"] = (rng() % 2) == 0;
+        rec["tags"] = std::vector<std::string>{ "alpha", "beta", "gamma" };
+        arr.PushBack(std::move(rec));
+    }
+
+    return arr.Dump(2);
+}
+
+// Flat array of integers and floats.
+std::string MakeNumbers(size_t count)
+{
+    std::mt19937_64 rng(2);
+    Json arr = Json::Array();
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        if (i % 2)
+            arr.PushBack((int64_t)(rng() >> 16));
+        else
+            arr.PushBack((double)(rng() % 1000000) / 1000.0);
+    }
+
+    return arr.Dump();
+}
+
+// Array of long strings with the occasional escape, like log messages or base64 blobs.
+std::string MakeStrings(size_t count)
+{
+    std::mt19937 rng(3);
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    Json arr = Json::Array();
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        std::string str(200 + rng() % 800, ' ');
+
+        for (auto& c : str)
+            c = alphabet[rng() % 64];
+
+        if (i % 4 == 0)
+            str[str.size() / 2] = '\n';
+
+        arr.PushBack(std::move(str));
+    }
+
+    return arr.Dump();
+}
+
+// Small values nested 'depth' levels, alternating objects and arrays.
+std::string MakeDeep(size_t count, size_t depth)
+{
+    std::string element;
+
+    for (size_t i = 0; i != depth; ++i)
+        element += i % 2 ? "[" : "{\"a\":";
+
+    element += "1";
+
+    for (size_t i = depth; i-- != 0; )
+        element += i % 2 ? "]" : "}";
+
+    std::string text = "[";
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        if (i)
+            text += ",";
+
+        text += element;
+    }
+
+    return text + "]";
+}
+
+// One object with many members, which exercises the key index.
+std::string MakeWide(size_t count)
+{
+    std::mt19937 rng(4);
+    Json obj = Json::Object();
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        std::string key = "key" + std::to_string(rng());
+
+        if (i % 2)
+            obj[key] = (int64_t)i;
+        else
+            obj[key] = "value" + std::to_string(i);
+    }
+
+    return obj.Dump(2);
+}
+
+struct Record
+{
+    int64_t id{};
+    std::string name;
+    double score{};
+    bool active{};
+    std::vector<std::string> tags;
+};
+
+JSON_FIELDS(Record, id, name, score, active, tags)
+
+// Allocations made by one call of 'func'.
+size_t CountAllocations(const std::function<void()>& func)
+{
+    size_t before = allocationCount;
+    func();
+    return allocationCount - before;
+}
+
+// Enough iterations to process about 100 MB, within reason.
+int IterationsFor(const std::string& text)
+{
+    return (int)std::clamp<size_t>((size_t)100e6 / std::max<size_t>(text.size(), 1), 3, 20000);
+}
+
+double Measure(const std::function<void()>& func, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i != iterations; ++i)
+        func();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+void CompareEngines(const char* name, const std::string& text, int iterations)
+{
+    JsonParseOptions streaming;
+    streaming.engine = JsonParseEngine::Streaming;
+
+    JsonParseOptions indexed;
+    indexed.engine = JsonParseEngine::Indexed;
+
+    if (Json::Parse(text, streaming).Dump() != Json::Parse(text, indexed).Dump())
+        throw std::runtime_error(std::string("engines disagree on ") + name);
+
+    double mb = text.size() / (1024.0 * 1024.0);
+    double streamingTime = Measure([&]{ Json::Parse(text, streaming); }, iterations);
+    double indexedTime = Measure([&]{ Json::Parse(text, indexed); }, iterations);
+
+    JsonDocument doc;
+    double arenaTime = Measure([&]{ doc.Parse(text, streaming); }, iterations);
+
+    // includes refreshing the buffer, which in-place parsing overwrites
+    std::string buffer;
+    double inSituTime = Measure([&]{
+        buffer = text;
+        Json::ParseInSitu(buffer.data(), buffer.size(), streaming);
+    }, iterations);
+
+    Json value = Json::Parse(text);
+    double dumpTime = Measure([&]{ value.Dump(); }, iterations);
+
+    std::printf("%-14s %9.2f MB   streaming %8.1f MB/s   indexed %8.1f MB/s   arena %8.1f MB/s   in situ %8.1f MB/s   dump %8.1f MB/s\n",
+        name, mb, mb / streamingTime, mb / indexedTime, mb / arenaTime, mb / inSituTime, mb / dumpTime);
+
+    // per document, once everything reused has been sized by the runs above
+    size_t streamingAllocations = CountAllocations([&]{ Json::Parse(text, streaming); });
+    size_t indexedAllocations = CountAllocations([&]{ Json::Parse(text, indexed); });
+    size_t arenaAllocations = CountAllocations([&]{ doc.Parse(text, streaming); });
+    buffer = text;
+    size_t inSituAllocations = CountAllocations([&]{ Json::ParseInSitu(buffer.data(), buffer.size(), streaming); });
+    size_t dumpAllocations = CountAllocations([&]{ value.Dump(); });
+
+    std::printf("%-14s allocations    streaming %8zu        indexed %8zu        arena %8zu        in situ %8zu        dump %8zu\n",
+        name, streamingAllocations, indexedAllocations, arenaAllocations, inSituAllocations, dumpAllocations);
+}
+
+// Encodes and decodes the document as CBOR, against the text format.
+void CompareCbor(const char* name, const std::string& text, int iterations)
+{
+    Json value = Json::Parse(text);
+    std::string cbor = value.ToCbor();
+
+    if (Json::FromCbor(cbor).Dump() != value.Dump())
+        throw std::runtime_error(std::string("cbor round trip differs on ") + name);
+
+    double mb = text.size() / (1024.0 * 1024.0);
+    double encodeTime = Measure([&]{ value.ToCbor(); }, iterations);
+    double decodeTime = Measure([&]{ Json::FromCbor(cbor); }, iterations);
+
+    std::printf("%-14s %9.2f MB   cbor %6.1f%% of text   encode %8.1f MB/s   decode %8.1f MB/s\n",
+        name, cbor.size() / (1024.0 * 1024.0), 100.0 * cbor.size() / text.size(), mb / encodeTime, mb / decodeTime);
+}
+
+// Parses the records as NDJSON on one thread and on all of them, and parses
+// and dumps them as one array with its elements split across all of them.
+void CompareLines(const char* name, const std::string& text, int iterations)
+{
+    Json value = Json::Parse(text);
+    std::string lines;
+
+    for (auto& record : value.GetArray())
+        lines += record.Dump() + "\n";
+
+    JsonLinesOptions single;
+    single.threadCount = 1;
+
+    JsonLinesOptions parallel;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    JsonParseOptions parallelArray;
+    parallelArray.threadCount = 0;
+
+    double arrayTime = Measure([&]{ Json::Parse(text, parallelArray); }, iterations);
+    double dumpTime = Measure([&]{ value.Dump(-1, 0); }, iterations);
+
+    double mb = lines.size() / (1024.0 * 1024.0);
+    double singleTime = Measure([&]{ JsonLinesReader(lines, single).ForEach([](size_t, Json&) {}); }, iterations);
+    double orderedTime = Measure([&]{ JsonLinesReader(lines, parallel).ForEach([](size_t, Json&) {}); }, iterations);
+    double unorderedTime = Measure([&]{ JsonLinesReader(lines, parallel).ForEachUnordered([](size_t, Json&) {}); }, iterations);
+
+    std::printf("%-14s %9.2f MB   ndjson 1 thread %8.1f MB/s   %u threads ordered %8.1f MB/s   unordered %8.1f MB/s\n",
+        name, mb, mb / singleTime, threads, mb / orderedTime, mb / unorderedTime);
+
+    std::printf("%-14s %9.2f MB   array on %u threads   parse %8.1f MB/s   dump %8.1f MB/s\n",
+        name, text.size() / (1024.0 * 1024.0), threads, text.size() / (1024.0 * 1024.0) / arrayTime, mb / dumpTime);
+}
+
+// Reads a few fields near the end of a large document.
+void CompareLazy(const char* name, const std::string& text, int iterations)
+{
+    size_t last = Json::Parse(text).GetSize() - 1;
+
+    double parseTime = Measure([&]{
+        Json value = Json::Parse(text);
+        value[last]["score"].GetFloat();
+    }, iterations);
+
+    double lazyTime = Measure([&]{
+        auto value = JsonLazyValue::Parse(text);
+        value[last]["score"].GetFloat();
+    }, iterations);
+
+    std::printf("%-14s last element   parse %8.3f ms   lazy %8.3f ms\n",
+        name, parseTime * 1000.0, lazyTime * 1000.0);
+}
+
+// Copies a parsed document, and a shared one, and modifies one field of the copy.
+void CompareSharing(const char* name, const std::string& text, int iterations)
+{
+    Json value = Json::Parse(text);
+    Json shared = value;
+    shared.Share();
+
+    double copyTime = Measure([&]{ Json copy = value; copy.GetArray()[0]["score"] = 0.0; }, iterations);
+    double sharedTime = Measure([&]{ Json copy = shared; copy.GetArray()[0]["score"] = 0.0; }, iterations);
+
+    std::printf("%-14s copy and edit  deep %8.3f ms   shared %8.3f ms\n",
+        name, copyTime * 1000.0, sharedTime * 1000.0);
+}
+
+// Rejects small malformed payloads by catching exceptions and by TryParse.
+void CompareRejects(const char* name, int iterations)
+{
+    std::string bad = R"({"id":1,"name":"user","score":2.5,"tags":["alpha",}")";
+
+    double throwTime = Measure([&]{
+        try { Json::Parse(bad); }
+        catch (const JsonParseError&) {}
+    }, iterations);
+
+    double tryTime = Measure([&]{ Json::TryParse(bad); }, iterations);
+
+    std::printf("%-14s reject         throw %8.3f us   try %8.3f us\n",
+        name, throwTime * 1e6, tryTime * 1e6);
+}
+
+// Maps the records to structs through a Json tree and directly.
+void CompareReflection(const char* name, const std::string& text, int iterations)
+{
+    auto records = JsonDeserialize<std::vector<Record>>(text);
+
+    if (JsonSerialize(records) != Json(records).Dump())
+        throw std::runtime_error(std::string("serializers disagree on ") + name);
+
+    double domRead = Measure([&]{ std::vector<Record> out = Json::Parse(text); }, iterations);
+    double directRead = Measure([&]{ JsonDeserialize<std::vector<Record>>(text); }, iterations);
+    double domWrite = Measure([&]{ Json(records).Dump(); }, iterations);
+    double directWrite = Measure([&]{ JsonSerialize(records); }, iterations);
+
+    std::printf("%-14s structs        read %8.3f ms -> %8.3f ms   write %8.3f ms -> %8.3f ms\n",
+        name, domRead * 1000.0, directRead * 1000.0, domWrite * 1000.0, directWrite * 1000.0);
+}
+
+// Changes one field of a shared document, then sends subscribers the
+// whole document or a patch, and applies the patch.
+void ComparePatch(const char* name, const std::string& text, int iterations)
+{
+    Json base = Json::Parse(text);
+    base.Share();
+
+    Json next = base;
+    next[base.GetSize() / 2]["score"] = -1.0;
+
+    std::string full;
+    Json patch = Json::Diff(base, next);
+    std::string delta = patch.Dump();
+
+    double dumpTime = Measure([&]{ next.Dump(full); }, iterations);
+    double diffTime = Measure([&]{ Json::Diff(base, next).Dump(delta); }, iterations);
+    double applyTime = Measure([&]{ Json copy = base; copy.ApplyPatch(patch); }, iterations);
+
+    std::printf("%-14s one change     dump %8.3f ms %9zu bytes   diff %8.3f ms %6zu bytes   apply %8.3f ms\n",
+        name, dumpTime * 1000.0, full.size(), diffTime * 1000.0, delta.size(), applyTime * 1000.0);
+}
+
+// Parses the records alone, while checking them against a schema, and
+// checks them without building a tree. A bad first record shows how soon
+// an invalid document is rejected.
+void CompareSchema(const char* name, const std::string& text, int iterations)
+{
+    JsonSchema schema(Json::Parse(R"({
+        "type": "array",
+        "items": {
+            "type": "object",
+            "required": ["id", "name", "score", "active", "tags"],
+            "properties": {
+                "id": { "type": "integer", "minimum": 0 },
+                "name": { "type": "string", "minLength": 1, "maxLength": 32 },
+                "score": { "type": "number", "minimum": 0, "maximum": 100 },
+                "active": { "type": "boolean" },
+                "tags": { "type": "array", "items": { "type": "string" }, "maxItems": 8 }
+            },
+            "additionalProperties": false
+        }
+    })"));
+
+    std::string bad = text;
+    bad.replace(bad.find("\"id\": 0"), 7, "\"id\": -1");
+
+    double parseTime = Measure([&]{ Json::Parse(text); }, iterations);
+    double fusedTime = Measure([&]{ schema.Parse(text); }, iterations);
+    double validateTime = Measure([&]{ schema.Validate(text); }, iterations);
+
+    double rejectTime = Measure([&]{
+        try { schema.Parse(bad); }
+        catch (const JsonSchemaError&) {}
+    }, iterations);
+
+    std::printf("%-14s schema         parse %8.3f ms   checked %8.3f ms   validate only %8.3f ms   reject %8.3f ms\n",
+        name, parseTime * 1000.0, fusedTime * 1000.0, validateTime * 1000.0, rejectTime * 1000.0);
+}
+
+// The standard corpus is twitter.json, canada.json and citm_catalog.json,
+// as found in nativejson-benchmark. They're read from the directory given
+// on the command line, or "corpus" by default, and skipped if missing.
+int main(int argc, char** argv)
+{
+    std::filesystem::path corpus = argc > 1 ? argv[1] : "corpus";
+
+    CompareEngines("test.json", ReadFile("test.json"), 20000);
+    CompareRejects("malformed", 100000);
+
+    for (const char* name : { "twitter.json", "canada.json", "citm_catalog.json" })
+    {
+        std::filesystem::path path = corpus / name;
+
+        if (!std::filesystem::exists(path)) {
+            std::printf("%-14s not found in %s\n", name, corpus.string().c_str());
+            continue;
+        }
+
+        std::string text = ReadFile(path.string());
+        CompareEngines(name, text, IterationsFor(text));
+        CompareCbor(name, text, IterationsFor(text));
+    }
+
+    std::string records = MakeRecords(100000);
+    CompareEngines("records", records, 5);
+    CompareLazy("records", records, 5);
+    CompareReflection("records", records, 5);
+    CompareSharing("records", records, 5);
+    CompareSchema("records", records, 5);
+    ComparePatch("records", records, 5);
+    CompareCbor("records", records, 5);
+    CompareLines("records", records, 5);
+    std::string numbers = MakeNumbers(1000000);
+    CompareEngines("numbers", numbers, 5);
+    CompareCbor("numbers", numbers, 5);
+    CompareEngines("strings", MakeStrings(50000), 5);
+    CompareEngines("deep", MakeDeep(2000, 500), 5);
+    CompareEngines("wide", MakeWide(200000), 5);
+
+    return 0;
+}
@@ -1,11 +1,63 @@
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <random>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include "Json.h"
 
+// Counts allocations so tests can check that reused objects stop allocating.
+std::atomic<size_t> allocationCount{ 0 };
+
+void* operator new(size_t size)
+{
+    ++allocationCount;
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// std::pmr::new_delete_resource allocates through these
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    ++allocationCount;
+    size_t align = std::max((size_t)alignment, sizeof(void*));
+
+    // over-allocate and keep the original pointer just before the aligned block
+    if (void* p = std::malloc(size + align + sizeof(void*)))
+    {
+        uintptr_t aligned = ((uintptr_t)p + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+        ((void**)aligned)[-1] = p;
+        return (void*)aligned;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    if (p)
+        std::free(((void**)p)[-1]);
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+    operator delete(p, alignment);
+}
+
 std::string ReadFile(const std::string& filename)
 {
     std::ifstream fin(filename, std::ios::in | std::ios::binary);
@@ -52,6 +104,31 @@ void TestParsing()
     std::cout << dump2 << std::endl << std::endl;
 }
 
+void TestIndexedEngine()
+{
+    std::string text = ReadFile("test.json");
+
+    JsonParseOptions options;
+    options.engine = JsonParseEngine::Indexed;
+
+    Json obj = Json::Parse(text, options);
+    assert(obj.Dump() == Json::Parse(text).Dump());
+}
+
+void TestDocument()
+{
+    std::string text = ReadFile("test.json");
+
+    JsonDocument doc;
+    doc.Parse(text);
+    assert(doc.GetRoot().Dump() == Json::Parse(text).Dump());
+
+    // copies leave the arena
+    Json copy = doc.GetRoot();
+    doc.Parse("[]");
+    assert(copy.Dump() == Json::Parse(text).Dump());
+}
+
 struct Parent
 {
     std::string name;
@@ -71,36 +148,751 @@ struct Family
     std::vector<Child> children;
 };
 
-void to_json(Json& obj, const Parent& parent) {
-    obj["name"] = parent.name;
-    obj["number"] = parent.number;
+JSON_FIELDS(Parent, name, number)
+JSON_FIELDS(Child, name, age)
+JSON_FIELDS(Family, address, parents, children)
+
+void TestMappedFile()
+{
+    assert(Json::ParseFile("test.json").Dump() == Json::Parse(ReadFile("test.json")).Dump());
+
+    JsonMappedFile file("test.json");
+    auto root = JsonLazyValue::Parse(file.GetText());
+
+    // unescaped strings are views into the mapping
+    auto name = root["firstName"].GetStringView();
+    assert(name && *name == "John");
+    assert(name->data() >= file.GetText().data() && name->data() < file.GetText().data() + file.GetSize());
+
+    auto escaped = root[""][1];
+    assert(!escaped.GetStringView() && escaped.GetString() == "a\\b");
+
+    bool threw = false;
+    try { Json::ParseFile("missing.json"); }
+    catch (std::runtime_error&) { threw = true; }
+    assert(threw);
 }
 
-void from_json(const Json& obj, Parent& parent) {
-    parent.name = obj["name"];
-    parent.number = obj["number"];
+void TestJsonLines()
+{
+    std::string text;
+    for (int i = 0; i != 1000; ++i)
+        text += (i % 7 ? "{\"id\": " + std::to_string(i) + ", \"tags\": [\"a long string that isn't inline\"]}\r\n" : "\n");
+
+    JsonLinesOptions options;
+    options.threadCount = 4;
+    options.batchSize = 256;
+
+    std::vector<size_t> lines;
+    JsonLinesReader(text, options).ForEach([&](size_t line, Json& value) {
+        assert(value["id"].GetInteger() == (int64_t)line);
+        lines.push_back(line);
+    });
+
+    assert(lines.size() == 857 && std::is_sorted(lines.begin(), lines.end()));
+
+    std::atomic<int64_t> sum = 0;
+    JsonLinesReader(text, options).ForEachUnordered([&](size_t line, Json& value) {
+        sum += value["id"].GetInteger();
+    });
+
+    int64_t expected = 0;
+    for (size_t line : lines)
+        expected += line;
+
+    assert(sum == expected);
+
+    JsonLinesReader reader("1\n\n[2]\n");
+    Json value;
+    assert(reader.Next(value) && value.GetInteger() == 1 && reader.GetLine() == 0);
+    assert(reader.Next(value) && value.Dump() == "[2]" && reader.GetLine() == 2);
+    assert(!reader.Next(value));
+
+    std::string error;
+    lines.clear();
+
+    try {
+        JsonLinesReader(text + "1 2\n" + text, options).ForEach([&](size_t line, Json&) { lines.push_back(line); });
+    }
+    catch (std::runtime_error& ex) {
+        error = ex.what();
+    }
+
+    assert(error == "line 1001: unexpected input after value");
+    assert(lines.size() == 857);
 }
 
-void to_json(Json& obj, const Child& child) {
-    obj["name"] = child.name;
-    obj["age"] = child.age;
+// Random document for differential tests, with the escapes, multi-byte
+// characters and bracket-like string contents that trip up scanners.
+std::string RandomJson(std::mt19937& rng, int depth = 0)
+{
+    auto space = [&] { return std::string(" \n\t" + rng() % 3, rng() % 2); };
+
+    auto string = [&]
+    {
+        static const char* parts[] = { "a", "xyz", "\\\"", "\\\\", "\\n", "\\u00e9", "\\u4e2d", "\xC3\xA9", "\xF0\x9F\x98\x80", "[", "]", ",", "{", "}", ":" };
+        std::string str = "\"";
+        for (int i = (int)(rng() % 8); i != 0; --i)
+            str += parts[rng() % std::size(parts)];
+        return str + "\"";
+    };
+
+    switch (rng() % (depth > 3 ? 6 : 8))
+    {
+    case 0: return std::to_string((int64_t)(rng() % 2000000) - 1000000);
+    case 1: return std::to_string((int)(rng() % 1000)) + "." + std::to_string((int)(rng() % 1000)) + (rng() % 2 ? "e-3" : "");
+    case 2:
+    case 3: return string();
+    case 4: return rng() % 2 ? "true" : "false";
+    case 5: return "null";
+    case 6:
+    {
+        std::string arr = "[" + space();
+        for (int i = (int)(rng() % 5); i != 0; --i)
+            arr += RandomJson(rng, depth + 1) + space() + (i != 1 ? "," + space() : "");
+        return arr + "]";
+    }
+    default:
+    {
+        std::string obj = "{" + space();
+        for (int i = (int)(rng() % 5); i != 0; --i)
+            obj += string() + space() + ":" + space() + RandomJson(rng, depth + 1) + (i != 1 ? "," + space() : "");
+        return obj + "}";
+    }
+    }
 }
 
-void from_json(const Json& obj, Child& child) {
-    child.name = obj["name"];
-    child.age = obj["age"];
+void TestParallelArray()
+{
+    std::string text = "[";
+    for (int i = 0; i != 2000; ++i)
+        text += (i ? ", " : "") + std::string(R"({"id": )") + std::to_string(i) + R"(, "text": "a, [tricky] \"string\" {"})";
+    text += "]";
+
+    JsonParseOptions options;
+    options.threadCount = 4;
+
+    Json value = Json::Parse(text, options);
+    assert(value.GetSize() == 2000 && value[1999]["id"].GetInteger() == 1999);
+    assert(value.Dump() == Json::Parse(text).Dump());
+    assert(Json::Parse(" [ ] ", options).Dump() == "[]");
+
+    // errors are the serial parser's, located in the whole input
+    auto error = [&](std::string_view text, unsigned threadCount) {
+        JsonParseOptions options;
+        options.threadCount = threadCount;
+        JsonParser parser(text, options);
+
+        try { parser.Parse(); }
+        catch (const JsonParseError& ex) {
+            assert(ex.GetError().offset == parser.GetError().offset);
+            return std::make_pair(std::string(ex.what()), parser.GetError());
+        }
+
+        return std::make_pair(std::string(), JsonError());
+    };
+
+    for (auto bad : { "[1, 2", "[1, 2}", "[1, , 2]", "[, 1]", "[1, 2, ]", "[1 2]", "[1,\n2,\n[3, x]]", "[1, {\"a\": }]", "[1] x" })
+    {
+        auto [message, err] = error(bad, 4);
+        auto [serialMessage, serialErr] = error(bad, 1);
+        assert(err && message == serialMessage && err.code == serialErr.code);
+        assert(err.offset == serialErr.offset && err.line == serialErr.line && err.column == serialErr.column);
+    }
+
+    auto [message, err] = error("[1,\n2,\n[3, x]]", 4);
+    assert(err.code == JsonErrorCode::UnexpectedInput && err.offset == 11 && err.line == 3 && err.column == 5);
+    assert(error("[1, , 2]", 4).second.code == JsonErrorCode::UnexpectedToken);
+    assert(error("[1, 2, ]", 4).second.code == JsonErrorCode::ExpectedValue);
+    assert(error("[1, 2", 4).second.code == JsonErrorCode::ExpectedArrayEnd);
+
+    // returns the error and where it is, or the tree's Dump
+    auto parse = [](const std::string& text, unsigned threadCount, JsonParseEngine engine)
+    {
+        JsonParseOptions options;
+        options.threadCount = threadCount;
+        options.engine = engine;
+        JsonParser parser(text, options);
+
+        try {
+            return parser.Parse().Dump();
+        }
+        catch (const JsonParseError& e) {
+            auto& err = e.GetError();
+            return std::string("error: ") + e.what() + " " + std::to_string((int)err.code) + " at "
+                + std::to_string(err.offset) + ":" + std::to_string(err.line) + ":" + std::to_string(err.column);
+        }
+    };
+
+    // random arrays, some large enough to span several chunks of elements,
+    // and half of them damaged, parse the same on several threads
+    std::mt19937 rng(19);
+    int errors = 0;
+
+    for (int i = 0; i != 3000; ++i)
+    {
+        std::string text = " [ ";
+        for (int n = (int)(rng() % (i % 10 ? 10 : 600)), j = 0; j != n; ++j)
+            text += (j ? (rng() % 2 ? "," : " ,\n") : "") + RandomJson(rng, 1);
+        text += " ] ";
+
+        if (i % 2)
+        {
+            static const char junk[] = "\"\\{}[]:,x1 ";
+
+            for (int m = (int)(rng() % 3); m != 0; --m)
+            {
+                size_t pos = rng() % text.size();
+                if (rng() % 2)
+                    text[pos] = junk[rng() % (sizeof(junk) - 1)];
+                else
+                    text.erase(pos, 1);
+            }
+        }
+
+        std::string serial = parse(text, 1, JsonParseEngine::Streaming);
+        errors += serial.starts_with("error: ");
+        assert(parse(text, 4, i % 3 ? JsonParseEngine::Streaming : JsonParseEngine::Indexed) == serial);
+    }
+
+    assert(errors > 500);
 }
 
-void to_json(Json& obj, const Family& family) {
-    obj["address"] = family.address;
-    obj["parents"] = family.parents;
-    obj["children"] = family.children;
+void TestParallelDump()
+{
+    Json records = Json::Array();
+    Json index = Json::Object();
+
+    for (int i = 0; i != 10000; ++i)
+    {
+        Json record;
+        record["id"] = i;
+        record["tags"] = std::vector<std::string>{ "a", "b\n" };
+        records.PushBack(std::move(record));
+        index["key" + std::to_string(i)] = i * 0.5;
+    }
+
+    Json value = Json::Object();
+    value["records"] = std::move(records);
+    value["index"] = std::move(index);
+    value["empty"] = Json::Array();
+
+    for (int indent : { -1, 0, 2 })
+    {
+        std::string serial = value.Dump(indent);
+        assert(value.Dump(indent, 4) == serial);
+
+        std::stringstream stream;
+        JsonPrinter(indent, 4).ToStream(stream, 0, value);
+        assert(stream.str() == serial);
+    }
 }
 
-void from_json(const Json& obj, Family& family) {
-    family.address = obj["address"];
-    family.parents = obj["parents"];
-    family.children = obj["children"];
+void TestKeyInterning()
+{
+    JsonKeyTable keys;
+    JsonParseOptions options;
+    options.keyTable = &keys;
+
+    std::string text = R"([{"identifier":1,"description_text":"a","id":2},{"identifier":3,"description_text":"b","id":4}])";
+    Json value = Json::Parse(text, options);
+    assert(value.Dump() == Json::Parse(text).Dump());
+    assert(keys.GetSize() == 1);
+
+    // both records point at the interned key
+    const auto& first = value.GetArray()[0].GetObject();
+    const auto& second = value[1].GetObject();
+    assert(first.find("description_text")->first.data() == second.find("description_text")->first.data());
+
+    JsonKey description("description_text");
+    assert(value[1].GetAt(description).GetString() == "b");
+    assert(value[1].find(description) != value[1].end());
+    assert(value[1].find(JsonKey("missing")) == value[1].end());
+
+    // copies and modifications get their own storage
+    Json copy = value.GetArray()[0];
+    assert(copy.GetObject().find("description_text")->first.data() != first.find("description_text")->first.data());
+
+    JsonString key = first.find("description_text")->first;
+    JsonString shared = JsonString::Shared(keys.Intern("description_text"));
+    shared.append("_2");
+    assert(shared == "description_text_2");
+    assert(key == "description_text");
+    assert(value.Dump() == Json::Parse(text).Dump());
+
+    Json decoded = Json::FromCbor(value.ToCbor(), options);
+    assert(decoded.Dump() == value.Dump());
+    assert(keys.GetSize() == 1);
+}
+
+void TestSharedValues()
+{
+    Json original = Json::Parse(R"({"name":"config","limits":{"cpu":4,"memory":[1,2,3]},"tags":["a","b"]})");
+    std::string text = original.Dump();
+
+    Json doc = original;
+    doc.Share();
+    assert(doc.IsShared() && doc["limits"].IsShared());
+    assert(doc.Dump() == text);
+
+    // copies refer to the same containers
+    Json copy = doc;
+    const Json& constCopy = copy;
+    assert(&constCopy["limits"]["memory"] == &std::as_const(doc)["limits"]["memory"]);
+
+    // modifying a copy only copies the containers on the way to the change
+    copy["limits"]["cpu"] = 8;
+    assert(!copy.IsShared() && !copy["limits"].IsShared());
+    assert(std::as_const(copy)["tags"].IsShared());
+    assert(doc.Dump() == text);
+    assert(copy["limits"]["cpu"].GetInteger() == 8);
+
+    // the last owner modifies in place
+    Json last = std::move(copy);
+    last["tags"].PushBack("c");
+    assert(last["tags"].GetSize() == 3);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> matches{ 0 };
+
+    for (int i = 0; i != 4; ++i)
+    {
+        threads.emplace_back([&, i, handle = doc]() mutable {
+            Json local = std::as_const(handle)["limits"];
+            matches += std::as_const(local)["memory"].GetSize() == 3;
+            local["cpu"] = i;
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    assert(matches == 4);
+    assert(doc.Dump() == text);
+}
+
+void TestReuse()
+{
+    std::string messages[] = {
+        R"({"id":1,"name":"a name that doesn't fit inline","tags":["x\ty","a tag that doesn't fit either"]})",
+        R"({"id":2,"name":"another name","tags":[],"nested":{"values":[1,2.5,true,null]}})"
+    };
+
+    std::vector<std::string> expected;
+
+    for (auto& message : messages)
+        expected.push_back(Json::Parse(message).Dump());
+
+    for (auto engine : { JsonParseEngine::Streaming, JsonParseEngine::Indexed })
+    {
+        JsonParseOptions options;
+        options.engine = engine;
+
+        JsonDocument doc;
+        JsonPrinter printer(-1);
+        std::string out;
+
+        for (int round = 0; round != 3; ++round)
+        {
+            size_t before = allocationCount;
+
+            for (size_t i = 0; i != std::size(messages); ++i)
+            {
+                doc.Parse(messages[i], options);
+                printer.ToString(doc.GetRoot(), out);
+                assert(out == expected[i]);
+            }
+
+            // everything has been sized by the last round
+            if (round == 2)
+                assert(allocationCount == before);
+        }
+
+        JsonParser parser(options);
+
+        for (size_t i = 0; i != std::size(messages); ++i)
+        {
+            parser.Reset(messages[i]);
+            assert(parser.Parse().Dump() == expected[i]);
+        }
+    }
+}
+
+void TestDepthLimit()
+{
+    auto nested = [](size_t depth) {
+        return std::string(depth, '[') + "1" + std::string(depth, ']');
+    };
+
+    auto rejects = [](auto&& parse) {
+        try {
+            parse();
+        }
+        catch (const std::runtime_error& e) {
+            return std::string(e.what()) == "maximum nesting depth exceeded";
+        }
+
+        return false;
+    };
+
+    std::string deep = nested(1000000);
+
+    for (auto engine : { JsonParseEngine::Streaming, JsonParseEngine::Indexed })
+    {
+        JsonParseOptions options;
+        options.engine = engine;
+        assert(rejects([&]{ Json::Parse(deep, options); }));
+
+        options.maxDepth = 3;
+        assert(Json::Parse(nested(3), options).Dump() == "[[[1]]]");
+        assert(rejects([&]{ Json::Parse(nested(4), options); }));
+        assert(rejects([&]{ Json::Parse(R"({"a":[{"b":[1]}]})", options); }));
+        assert(rejects([&]{ JsonDeserialize<std::vector<std::vector<std::vector<std::vector<int>>>>>(nested(4), options); }));
+
+        options.threadCount = 4;
+        assert(Json::Parse(nested(3), options).Dump() == "[[[1]]]");
+        assert(rejects([&]{ Json::Parse("[1,[[[2]]]]", options); }));
+    }
+
+    JsonHandlerBase handler;
+    JsonPushParser<JsonHandlerBase> push(handler);
+    assert(rejects([&]{ push.Feed(deep); }));
+
+    // values built in code aren't limited, and print without recursing
+    Json value = 1;
+    for (int i = 0; i != 10000; ++i)
+    {
+        Json parent = Json::Array();
+        parent.PushBack(std::move(value));
+        value = std::move(parent);
+    }
+
+    std::string text = value.Dump();
+    assert(text == nested(10000));
+
+    JsonParseOptions unlimited;
+    unlimited.maxDepth = SIZE_MAX;
+    assert(Json::Parse(text, unlimited).Dump() == text);
+    assert(rejects([&]{ Json::FromCbor(value.ToCbor()); }));
+}
+
+void TestCompactNodes()
+{
+    assert(sizeof(Json) == 16);
+
+    Json shortString = std::string(JsonString::InlineCapacity, 'a');
+    Json longString = std::string(JsonString::InlineCapacity + 1, 'b');
+    assert(shortString.GetString() == std::string(JsonString::InlineCapacity, 'a'));
+    assert(longString.GetString() == std::string(JsonString::InlineCapacity + 1, 'b'));
+
+    // assigning a child to its parent
+    Json root = Json::Parse(R"({"child":{"values":[1,2.5,true,"a string that lives on the heap"]}})");
+    root = root["child"];
+    assert(root["values"].GetArray().size() == 4);
+    assert(root["values"][3].GetString() == "a string that lives on the heap");
+
+    bool threw = false;
+    try { root.GetArray(); }
+    catch (const std::runtime_error&) { threw = true; }
+    assert(threw);
+}
+
+void TestObjectOrder()
+{
+    // members keep insertion order, and duplicate keys keep the last value
+    Json obj = Json::Parse(R"({"b":1,"a":2,"c":3,"a":4})");
+    assert(obj.Dump() == R"({"b":1,"a":4,"c":3})");
+
+    // large enough to use the hash index
+    Json big = Json::Object();
+    for (int i = 0; i != 100; ++i)
+        big["key" + std::to_string(i)] = i;
+
+    assert(big.begin().key() == "key0");
+    assert(big["key42"].GetInteger() == 42);
+
+    big.GetObject().erase("key42");
+    assert(big.find("key42") == big.end());
+    assert(big["key99"].GetInteger() == 99);
+    assert(big.GetSize() == 99);
+}
+
+struct CountingHandler : JsonHandlerBase
+{
+    int objects = 0;
+    int arrays = 0;
+    int scalars = 0;
+    int depth = 0;
+    int maxDepth = 0;
+    std::vector<std::string> keys;
+
+    void OnKey(std::string_view key) { keys.emplace_back(key); }
+    void OnNull() { ++scalars; }
+    void OnBoolean(bool value) { ++scalars; }
+    void OnInteger(int64_t value) { ++scalars; }
+    void OnFloat(double value) { ++scalars; }
+    void OnString(std::string_view value) { ++scalars; }
+    void OnObjectStart() { ++objects; maxDepth = std::max(maxDepth, ++depth); }
+    void OnArrayStart() { ++arrays; maxDepth = std::max(maxDepth, ++depth); }
+    void OnObjectEnd() { --depth; }
+    void OnArrayEnd() { --depth; }
+};
+
+void TestHandler()
+{
+    CountingHandler handler;
+    JsonParser parser(R"({"a":[1,2.5,{"b":null}],"c":"str","d":true})");
+    parser.Parse(handler);
+
+    assert(handler.objects == 2);
+    assert(handler.arrays == 1);
+    assert(handler.scalars == 5);
+    assert(handler.depth == 0 && handler.maxDepth == 3);
+    assert((handler.keys == std::vector<std::string>{ "a", "b", "c", "d" }));
+}
+
+void TestPushParser()
+{
+    std::string text = ReadFile("test.json");
+
+    // feed in small chunks so that tokens are split across chunk boundaries
+    for (size_t chunkSize : { 1, 3, 7, 64 })
+    {
+        JsonDomBuilder builder;
+        JsonPushParser parser(builder);
+        JsonPushStatus status = JsonPushStatus::NeedMoreData;
+
+        for (size_t i = 0; i < text.size(); i += chunkSize)
+            status = parser.Feed(std::string_view(text).substr(i, chunkSize));
+
+        assert(status == JsonPushStatus::Complete);
+        parser.Finish();
+        assert(builder.GetRoot().Dump() == Json::Parse(text).Dump());
+    }
+
+    // a top-level number could continue in the next chunk
+    JsonDomBuilder builder;
+    JsonPushParser parser(builder);
+    assert(parser.Feed("12") == JsonPushStatus::NeedMoreData);
+    assert(parser.Feed("34") == JsonPushStatus::NeedMoreData);
+    parser.Finish();
+    assert(builder.GetRoot().GetInteger() == 1234);
+
+    // tokens finished by the start of a chunk, including an escape split after its backslash
+    parser.Reset();
+    parser.Feed(R"(["a\)");
+    parser.Feed(R"("b", tr)");
+    parser.Feed("ue, 12");
+    assert(parser.Feed("3]") == JsonPushStatus::Complete);
+    parser.Finish();
+    assert(builder.GetRoot().Dump() == R"(["a\"b",true,123])");
+
+    bool threw = false;
+    parser.Reset();
+    parser.Feed("[1, 2");
+    try { parser.Finish(); }
+    catch (const JsonParseError& e) {
+        assert(e.GetError().code == JsonErrorCode::UnexpectedEndOfInput && e.GetError().offset == 5);
+        threw = true;
+    }
+    assert(threw);
+
+    // errors are located in the stream, not in the chunk that failed
+    threw = false;
+    parser.Reset();
+    parser.Feed("[1,\n2,\n3,");
+    try { parser.Feed(" tru]"); }
+    catch (const JsonParseError& e)
+    {
+        auto& error = e.GetError();
+        assert(error.code == JsonErrorCode::ExpectedBoolean);
+        assert(error.offset == 10 && error.line == 3 && error.column == 4);
+        threw = true;
+    }
+    assert(threw);
+
+    // returns the error, or the tree's Dump
+    auto push = [](std::string_view text, std::mt19937& rng) -> std::string
+    {
+        JsonDomBuilder builder;
+        JsonPushParser parser(builder);
+
+        try
+        {
+            for (size_t i = 0; i < text.size(); )
+            {
+                size_t chunk = 1 + rng() % 17;
+                parser.Feed(text.substr(i, chunk));
+                i += chunk;
+            }
+
+            parser.Finish();
+        }
+        catch (const std::runtime_error& e) {
+            return std::string("error: ") + e.what();
+        }
+
+        return builder.GetRoot().Dump();
+    };
+
+    // random documents split at random points give the same trees
+    std::mt19937 rng(9);
+
+    for (int i = 0; i != 2000; ++i)
+    {
+        std::string doc = RandomJson(rng);
+        std::string expected = Json::Parse(doc).Dump();
+        assert(push(doc, rng) == expected);
+
+        // unlike Json::Parse, the push parser rejects another value after the first
+        std::string trailing = doc + " " + RandomJson(rng);
+        assert(Json::Parse(trailing).Dump() == expected);
+        assert(push(trailing, rng) == "error: unexpected input after value");
+
+        // truncated containers fail, and between tokens, as the end of input
+        if (doc.size() > 2 && (doc[0] == '[' || doc[0] == '{'))
+        {
+            size_t cut = 1 + rng() % (doc.size() - 1);
+            std::string truncated = doc.substr(0, cut);
+            std::string error = push(truncated, rng);
+            assert(error.starts_with("error: "));
+
+            bool threw = false;
+            try { Json::Parse(truncated); }
+            catch (const std::runtime_error&) { threw = true; }
+            assert(threw);
+
+            if (std::strchr("[{,:", truncated.back()))
+                assert(error == "error: unexpected end of input");
+        }
+
+        // a corrupted document fails where Json::Parse does, unless that's at the end
+        std::string corrupted = doc;
+        corrupted[rng() % doc.size()] = "x]}:,\"\n1"[rng() % 8];
+
+        JsonError serial;
+        try { Json::Parse(corrupted); }
+        catch (const JsonParseError& e) { serial = e.GetError(); }
+
+        if (serial && serial.offset < corrupted.size())
+        {
+            JsonError pushed;
+            JsonDomBuilder builder;
+            JsonPushParser parser(builder);
+
+            try
+            {
+                for (size_t i = 0; i < corrupted.size(); )
+                {
+                    size_t chunk = 1 + rng() % 17;
+                    parser.Feed(std::string_view(corrupted).substr(i, chunk));
+                    i += chunk;
+                }
+
+                parser.Finish();
+            }
+            catch (const JsonParseError& e) {
+                pushed = e.GetError();
+            }
+
+            assert(pushed.code == serial.code && pushed.offset == serial.offset);
+            assert(pushed.line == serial.line && pushed.column == serial.column);
+        }
+    }
+}
+
+void TestPrinter()
+{
+    Json value = Json::Parse(R"({"text":"tab\tquote\"","values":[1,-2,0.5,true,null]})");
+    std::string expected = R"({"text":"tab\tquote\"","values":[1,-2,0.5,true,null]})";
+    assert(value.Dump() == expected);
+
+    std::ostringstream stream;
+    JsonPrinter(-1).ToStream(stream, 0, value);
+    assert(stream.str() == expected);
+
+    char buffer[16];
+    JsonBufferSink sink(buffer, sizeof(buffer));
+    JsonPrinter(-1).Write(sink, 0, value);
+    assert(sink.IsTruncated() && sink.GetSize() == sizeof(buffer));
+    assert(std::string_view(buffer, sizeof(buffer)) == expected.substr(0, sizeof(buffer)));
+
+    assert(Json(1e20).Dump() == "1e+20");
+}
+
+void TestNumbers()
+{
+    Json values = Json::Parse("[0, -12, 1234567890123, 9223372036854775807, -9223372036854775808, 1e5, 2.5E-3, 0.1, 9223372036854775808]");
+    assert(values[(size_t)0].GetInteger() == 0);
+    assert(values[1].GetInteger() == -12);
+    assert(values[2].GetInteger() == 1234567890123);
+    assert(values[3].GetInteger() == INT64_MAX);
+    assert(values[4].GetInteger() == INT64_MIN);
+    assert(values[5].IsFloat() && values[5].GetFloat() == 1e5);
+    assert(values[6].GetFloat() == 2.5e-3);
+    assert(values[7].GetFloat() == 0.1);
+    assert(values[8].IsFloat());
+
+    for (const char* invalid : { "01", "-", "1.", "1e", "1e+", "-01", "+1" })
+    {
+        bool threw = false;
+        try { Json::Parse(invalid); }
+        catch (const std::runtime_error&) { threw = true; }
+        assert(threw);
+    }
+}
+
+void TestLazyValue()
+{
+    std::string text = ReadFile("test.json");
+    Json parsed = Json::Parse(text);
+    auto lazy = JsonLazyValue::Parse(text);
+
+    assert(lazy.IsObject());
+    assert(lazy.GetSize() == parsed.GetSize());
+
+    for (auto it = parsed.begin(); it != parsed.end(); ++it)
+        assert(lazy[std::string_view(it.key())].ToJson().Dump() == it->Dump());
+
+    auto records = JsonLazyValue::Parse(R"([{"id":1,"skip":{"a":[1,2,"]}"]}},{"id":2,"name":"two\n"}])");
+    assert(records[1]["id"].GetInteger() == 2);
+    assert(records[1]["name"].GetString() == "two\n");
+    assert(records[(size_t)0]["skip"].GetText() == R"({"a":[1,2,"]}"]})");
+
+    bool threw = false;
+    try { records[2]; }
+    catch (const std::out_of_range&) { threw = true; }
+    assert(threw);
+}
+
+void TestPointer()
+{
+    std::string text = R"({"orders":[{"items":[{"price":5}]},{"items":[{"price":7},{"price":9}]}],"a/b":{"m~n":true}})";
+    Json doc = Json::Parse(text);
+
+    JsonPointer price("/orders/1/items/0/price");
+    assert(&price.GetAt(doc) == &doc["orders"][1]["items"][(size_t)0]["price"]);
+    assert(price.GetAt(JsonLazyValue::Parse(text)).GetInteger() == 7);
+    assert(JsonPointer("/a~1b/m~0n").GetAt(doc).GetBoolean());
+    assert(JsonPointer("/orders/2").Find(doc) == nullptr);
+    assert(&JsonPointer("").GetAt(doc) == &doc);
+
+    // wildcards fan out, in document order
+    JsonPointer firstPrices("/orders/*/items/0/price");
+    std::vector<int64_t> prices;
+    firstPrices.ForEach(doc, [&](const Json& value) { prices.push_back(value.GetInteger()); });
+    assert((prices == std::vector<int64_t>{ 5, 7 }));
+
+    // and while streaming
+    struct PriceHandler : JsonHandlerBase {
+        std::vector<int64_t> prices;
+        void OnInteger(int64_t value) { prices.push_back(value); }
+    } handler;
+
+    JsonPointer allPrices("/orders/*/items/*/price");
+    JsonPointerFilter filter(allPrices, handler);
+    JsonParser(text).Parse(filter);
+    assert((handler.prices == std::vector<int64_t>{ 5, 7, 9 }));
 }
 
 void TestConversion()
@@ -124,10 +916,546 @@ void TestConversion()
     assert(result.children.size() == family.children.size());
 }
 
+void TestCbor()
+{
+    Json value = Json::Parse(ReadFile("test.json"));
+    assert(Json::FromCbor(value.ToCbor()).Dump() == value.Dump());
+
+    // integers and floats stay distinct, with the shortest exact encodings
+    assert(Json(500).ToCbor() == "\x19\x01\xF4");
+    assert(Json(-1).ToCbor() == "\x20");
+    assert(Json(1.0).ToCbor() == std::string("\xFA\x3F\x80\x00\x00", 5));
+    assert(Json(1.1).ToCbor() == "\xFB\x3F\xF1\x99\x99\x99\x99\x99\x9A");
+    assert(Json::Parse(R"({"a":[1,"b"]})").ToCbor() == "\xA1\x61\x61\x82\x01\x61\x62");
+
+    Json numbers = Json::Parse("[0, -9223372036854775808, 9223372036854775807, 1.0, 0.1, -1e300, 5e-324]");
+    assert(Json::FromCbor(numbers.ToCbor()).Dump() == numbers.Dump());
+    assert(Json::FromCbor(numbers.ToCbor())[3].IsFloat());
+
+    auto fails = [](std::string_view data) {
+        try { Json::FromCbor(data); return false; }
+        catch (std::runtime_error&) { return true; }
+    };
+
+    assert(fails(""));
+    assert(fails("\x82\x01"));
+    assert(fails("\x9B\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"));
+    assert(fails("\xA1\x01\x01"));
+    assert(fails("\x01\x01"));
+}
+
+void TestMoveConversions()
+{
+    // strings longer than the inline capacity are moved, not copied
+    Json arr = Json::Parse(R"(["a string too long to store inline", "another string too long to inline"])");
+    const char* data = arr[(size_t)0].GetString().data();
+
+    auto strings = arr.Take<std::vector<Json::StringType>>();
+    assert(strings.size() == 2 && strings[0].data() == data);
+
+    Json back = std::move(strings);
+    assert(back[(size_t)0].GetString().data() == data);
+    assert(back[1].GetString() == "another string too long to inline");
+
+    Json family = Json::Parse(R"({"address": "500 Ocean Avenue", "parents": [{"name": "Tom", "number": 1}], "children": []})");
+    Family result = family.Take<Family>();
+    assert(result.parents.size() == 1 && result.parents[0].name == "Tom");
+}
+
+void TestReflection()
+{
+    Family family;
+    family.address = "1 \"Main\" Street";
+    family.parents.push_back({ "Tom", 555'567'1234 });
+    family.children.push_back({ "Sally", 5 });
+    family.children.push_back({ "Randy", 12 });
+
+    assert(JsonFieldTable<Family>::Find("children") == 2);
+    assert(JsonFieldTable<Family>::Find("child") == JsonFieldTable<Family>::Count);
+
+    assert(JsonSerialize(family) == Json(family).Dump());
+    assert(JsonSerialize(family, 2) == Json(family).Dump(2));
+
+    auto text = R"({ "children": [{ "age": 7, "name": "Chucky" }], "pets": [1, {}],
+                     "address": "500 Ocean Avenue", "parents": [] })";
+
+    Family result = JsonDeserialize<Family>(text);
+    assert(result.address == "500 Ocean Avenue");
+    assert(result.parents.empty());
+    assert(result.children.size() == 1 && result.children[0].name == "Chucky" && result.children[0].age == 7);
+
+    result = JsonDeserialize<Family>(JsonSerialize(family));
+    assert(JsonSerialize(result) == JsonSerialize(family));
+
+    auto fails = [](std::string_view text) {
+        try { JsonDeserialize<Family>(text); return false; }
+        catch (std::exception&) { return true; }
+    };
+
+    assert(fails(R"({ "address": "x", "parents": [] })"));
+    assert(fails(R"({ "address": 5, "parents": [], "children": [] })"));
+    assert(fails(R"({ "address": "x", "parents": [], "children": [ })"));
+
+    auto numbers = JsonDeserialize<std::map<std::string, std::vector<double>>>(R"({"a": [1.5, 2.0], "b": []})");
+    assert(numbers["a"].size() == 2 && numbers["b"].empty());
+    assert(JsonSerialize(numbers) == R"({"a":[1.5,2.0],"b":[]})");
+}
+
+void TestTryParse()
+{
+    auto error = [](std::string_view text, JsonParseEngine engine = JsonParseEngine::Streaming) {
+        JsonParseOptions options;
+        options.engine = engine;
+        auto result = Json::TryParse(text, options);
+        assert(!result == (bool)result.error);
+        return result.error;
+    };
+
+    for (auto engine : { JsonParseEngine::Streaming, JsonParseEngine::Indexed })
+    {
+        assert(error("", engine).code == JsonErrorCode::EmptyInput);
+        assert(error("[1, 2,", engine).code == JsonErrorCode::UnexpectedEndOfInput);
+        assert(error("[1, 2", engine).code == JsonErrorCode::ExpectedArrayEnd);
+        assert(error("[1,]", engine).code == JsonErrorCode::ExpectedValue);
+        assert(error("{\"a\" 1}", engine).code == JsonErrorCode::ExpectedColon);
+        assert(error("{1:2}", engine).code == JsonErrorCode::ExpectedString);
+        assert(error("[1 2]", engine).code == JsonErrorCode::ExpectedArrayEnd);
+        assert(error("[01]", engine).code == JsonErrorCode::InvalidNumber);
+        assert(error("[nul]", engine).code == JsonErrorCode::ExpectedNull);
+        assert(error("\"\\uZZZZ\"", engine).code == JsonErrorCode::InvalidUnicodeEscape);
+        assert(error("\"\xFF\"", engine).code == JsonErrorCode::InvalidUtf8);
+        assert(error("1 x", engine).code == JsonErrorCode::UnexpectedInput);
+    }
+
+    // offsets count bytes, and columns count characters on the line
+    JsonError located = error("{\n  \"\xC3\xA9\": [1,\n   x]}");
+    assert(located.code == JsonErrorCode::UnexpectedInput);
+    assert(located.offset == 17 && located.line == 3 && located.column == 4);
+
+    JsonParseOptions shallow;
+    shallow.maxDepth = 2;
+    assert(Json::TryParse("[[[1]]]", shallow).error.code == JsonErrorCode::DepthExceeded);
+
+    // the throwing functions report the same details
+    try {
+        Json::Parse("{\"a\":\n  tru}");
+        assert(false);
+    }
+    catch (const JsonParseError& e) {
+        assert(e.GetError().code == JsonErrorCode::ExpectedBoolean);
+        assert(e.GetError().line == 2 && e.GetError().column == 3);
+        assert(std::string(e.what()) == "expected boolean literal");
+    }
+
+    std::string text = ReadFile("test.json");
+    auto result = Json::TryParse(text);
+    assert(result && result.value.Dump() == Json::Parse(text).Dump());
+
+    // a document and its parser are still reusable after a failure
+    JsonDocument doc;
+    assert(doc.TryParse("[1, {\"a\": [2,").code == JsonErrorCode::UnexpectedEndOfInput);
+    assert(!doc.TryParse(text));
+    assert(doc.GetRoot().Dump() == result.value.Dump());
+}
+
+void TestInSitu()
+{
+    std::string text = R"({"message": "a string long enough to be stored on the heap",
+        "escaped": "tab\there, \u00e9, \"quotes\" and a slash \/ then \\",
+        "a key long enough to be stored on the heap": ["short", "", 1.5],
+        "nested": [{"name": "another string that is too long to inline"}]})";
+
+    Json expected = Json::Parse(text);
+
+    for (auto engine : { JsonParseEngine::Streaming, JsonParseEngine::Indexed })
+    {
+        JsonParseOptions options;
+        options.engine = engine;
+
+        std::vector<char> buffer(text.begin(), text.end());
+        auto inBuffer = [&](const char* p) { return p >= buffer.data() && p < buffer.data() + buffer.size(); };
+
+        Json value = Json::ParseInSitu(buffer.data(), buffer.size(), options);
+        assert(value.Dump() == expected.Dump());
+
+        const Json& root = value;
+        assert(inBuffer(root["message"].GetString().data()));
+        assert(inBuffer(root["escaped"].GetString().data()));
+        assert(inBuffer(root["nested"][(size_t)0]["name"].GetString().data()));
+        assert(inBuffer(root.GetObject().begin()[2].first.data()));
+        assert(!inBuffer(root["a key long enough to be stored on the heap"][(size_t)0].GetString().data()));
+
+        // copies and modified strings get their own storage
+        Json copy = value;
+        assert(!inBuffer(std::as_const(copy)["message"].GetString().data()));
+
+        value["message"].GetString() += "!";
+        assert(!inBuffer(root["message"].GetString().data()));
+
+        std::fill(buffer.begin(), buffer.end(), 'x');
+        assert(copy.Dump() == expected.Dump());
+    }
+
+    // elements parsed on several threads decode into their own part of the buffer
+    std::string records = "[";
+    for (int i = 0; i != 1000; ++i)
+        records += std::string(i ? "," : "") + R"({"name":"record number )" + std::to_string(i) + R"( with an\nescape"})";
+    records += "]";
+
+    std::vector<char> buffer(records.begin(), records.end());
+    JsonParseOptions parallel;
+    parallel.threadCount = 4;
+    assert(Json::ParseInSitu(buffer.data(), buffer.size(), parallel).Dump() == Json::Parse(records).Dump());
+
+    // long strings don't allocate
+    buffer.assign(records.begin(), records.end());
+    size_t before = allocationCount;
+    Json copied = Json::Parse(records);
+    size_t copiedAllocations = allocationCount - before;
+
+    before = allocationCount;
+    Json shared = Json::ParseInSitu(buffer.data(), buffer.size());
+    size_t sharedAllocations = allocationCount - before;
+    assert(sharedAllocations + 1000 <= copiedAllocations);
+
+    JsonDocument doc;
+    buffer.assign(records.begin(), records.end());
+    doc.ParseInSitu(buffer.data(), buffer.size());
+    assert(doc.GetRoot().Dump() == copied.Dump());
+}
+
+void TestStats()
+{
+    std::string text = R"({"a":[1,"x\n",true],"b":null})";
+
+    JsonParseStats stats;
+    JsonParseOptions options;
+    options.stats = &stats;
+    Json value = Json::Parse(text, options);
+
+    assert(stats.bytes == text.size());
+    assert(stats.GetTokenCount(JsonTokenType::ObjectStart) == 1 && stats.GetTokenCount(JsonTokenType::ObjectEnd) == 1);
+    assert(stats.GetTokenCount(JsonTokenType::ArrayStart) == 1 && stats.GetTokenCount(JsonTokenType::ArrayEnd) == 1);
+    assert(stats.GetTokenCount(JsonTokenType::String) == 3 && stats.GetTokenCount(JsonTokenType::Colon) == 2);
+    assert(stats.GetTokenCount(JsonTokenType::Comma) == 3 && stats.GetTokenCount(JsonTokenType::EndOfFile) == 1);
+    assert(stats.GetTokenCount(JsonTokenType::Integer) == 1 && stats.GetTokenCount(JsonTokenType::Null) == 1);
+    assert(stats.strings == 3 && stats.escapes == 1 && stats.maxDepth == 2);
+
+    // counts add up over parses
+    Json::Parse(text, options);
+    assert(stats.bytes == text.size() * 2 && stats.strings == 6 && stats.maxDepth == 2);
+
+    // the engines, and parsing on several threads, see the same tokens
+    std::string records = "[";
+    for (int i = 0; i != 5000; ++i)
+        records += std::string(i ? "," : "") + R"({"id":)" + std::to_string(i) + R"(,"tags":["a\tb",[]],"ok":false})";
+    records += "]";
+
+    auto count = [&](JsonParseEngine engine, unsigned threadCount) {
+        JsonParseStats stats;
+        JsonParseOptions options;
+        options.engine = engine;
+        options.threadCount = threadCount;
+        options.stats = &stats;
+        Json::Parse(records, options);
+        assert(stats.bytes == records.size() && stats.parseTime.count() > 0);
+        return stats;
+    };
+
+    auto streaming = count(JsonParseEngine::Streaming, 1);
+    assert(streaming.maxDepth == 4 && streaming.strings == 20000 && streaming.escapes == 5000);
+    assert(streaming.indexTime.count() == 0);
+
+    for (auto other : { count(JsonParseEngine::Indexed, 1), count(JsonParseEngine::Streaming, 4) })
+    {
+        assert(other.tokens == streaming.tokens);
+        assert(other.strings == streaming.strings && other.escapes == streaming.escapes);
+        assert(other.maxDepth == streaming.maxDepth && other.indexTime.count() > 0);
+    }
+
+    // allocations are counted when they go through a JsonCountingResource
+    JsonCountingResource counter;
+    stats = {};
+    options.resource = &counter;
+    Json::Parse(records, options);
+    assert(stats.allocations > 0 && stats.allocations == counter.GetAllocationCount());
+    assert(stats.allocatedBytes == counter.GetAllocatedBytes());
+
+    // a document's arena stops allocating once it's large enough
+    JsonDocument doc;
+    JsonParseOptions docOptions;
+    docOptions.stats = &stats;
+
+    for (int round = 0; round != 3; ++round)
+    {
+        stats = {};
+        doc.Parse(records, docOptions);
+        assert(round != 0 || stats.allocations > 0);
+        assert(round != 2 || stats.allocations == 0);
+    }
+
+    JsonDumpStats dumpStats;
+    JsonPrinter printer(-1);
+    printer.SetStats(&dumpStats);
+    std::string out = printer.ToString(value);
+
+    assert(dumpStats.bytes == out.size());
+    assert(dumpStats.GetValueCount(JsonDataType::Object) == 1 && dumpStats.GetValueCount(JsonDataType::Array) == 1);
+    assert(dumpStats.GetValueCount(JsonDataType::String) == 1 && dumpStats.GetValueCount(JsonDataType::Boolean) == 1);
+    assert(dumpStats.strings == 3 && dumpStats.escapes == 1);
+
+    // printing on several threads counts the same, large arrays included
+    Json parsed = Json::Parse(records);
+    JsonDumpStats single, parallel;
+    JsonPrinter singlePrinter(2);
+    JsonPrinter parallelPrinter(2, 4);
+    singlePrinter.SetStats(&single);
+    parallelPrinter.SetStats(&parallel);
+
+    std::ostringstream stream;
+    parallelPrinter.ToStream(stream, 0, parsed);
+    assert(stream.str() == singlePrinter.ToString(parsed));
+    assert(parallel.bytes == single.bytes && parallel.bytes == stream.str().size());
+    assert(parallel.values == single.values && parallel.strings == single.strings && parallel.escapes == single.escapes);
+}
+
+void TestSchema()
+{
+    JsonSchema schema(Json::Parse(R"({
+        "title": "record",
+        "type": "object",
+        "required": ["id", "name"],
+        "properties": {
+            "id": { "type": "integer", "minimum": 1 },
+            "name": { "type": "string", "minLength": 1, "maxLength": 5 },
+            "score": { "type": "number", "exclusiveMaximum": 100 },
+            "tags": { "type": "array", "items": { "type": "string" }, "maxItems": 2 },
+            "parent": { "type": ["object", "null"], "minProperties": 1 },
+            "a/b": false
+        },
+        "additionalProperties": false
+    })"));
+
+    // returns the path of the error, or "ok"
+    auto check = [&](std::string_view text) -> std::string
+    {
+        try {
+            schema.Validate(text);
+            return "ok";
+        }
+        catch (const JsonSchemaError& e) {
+            return e.GetPath();
+        }
+    };
+
+    std::string valid = R"({"id":7,"name":"ab","score":99.5,"tags":["x","y"],"parent":{"id":1},"name":"abcde"})";
+    assert(check(valid) == "ok");
+    assert(schema.Parse(valid).Dump() == Json::Parse(valid).Dump());
+
+    assert(check(R"({"id":1.0,"name":"ééééé","parent":null})") == "ok");
+    assert(check(R"({"id":1.5,"name":"a"})") == "/id");
+    assert(check(R"({"id":0,"name":"a"})") == "/id");
+    assert(check(R"({"id":"1","name":"a"})") == "/id");
+    assert(check(R"({"id":1,"name":""})") == "/name");
+    assert(check(R"({"id":1,"name":"éééééé"})") == "/name");
+    assert(check(R"({"id":1,"name":"a","score":100})") == "/score");
+    assert(check(R"({"id":1,"name":"a","tags":["x",2]})") == "/tags/1");
+    assert(check(R"({"id":1,"name":"a","tags":["x","y","z"]})") == "/tags");
+    assert(check(R"({"id":1,"name":"a","parent":{}})") == "/parent");
+    assert(check(R"({"id":1,"name":"a","parent":1})") == "/parent");
+    assert(check(R"({"id":1,"name":"a","a/b":1})") == "/a~1b");
+    assert(check(R"({"id":1,"name":"a","extra":1})") == "/extra");
+    assert(check(R"({"id":1})") == "");
+    assert(check(R"([])") == "");
+
+    try {
+        schema.Validate(R"({"id":1})");
+        assert(false);
+    }
+    catch (const JsonSchemaError& e) {
+        assert(std::string(e.what()) == "missing required property \"name\"");
+    }
+
+    // the first mismatch stops the parse, before the rest is read
+    CountingHandler counter;
+    JsonSchemaValidator validator(schema, counter);
+    JsonParser parser(R"({"id":1,"name":"a","tags":[1, this isn't read)");
+
+    try {
+        parser.Parse(validator);
+        assert(false);
+    }
+    catch (const JsonSchemaError& e) {
+        assert(e.GetPath() == "/tags/0");
+    }
+
+    assert(counter.keys.size() == 3 && counter.scalars == 2 && counter.arrays == 1);
+
+    // additionalProperties can be a schema, and unlisted keys are anything
+    JsonSchema map(Json::Parse(R"({"additionalProperties": {"type": "integer", "maximum": 9}})"));
+    map.Validate(R"({"a":1,"b":9})");
+    assert(map.Parse(R"({"a":1})")["a"].GetInteger() == 1);
+
+    try {
+        map.Validate(R"({"a":1,"x~y":10})");
+        assert(false);
+    }
+    catch (const JsonSchemaError& e) {
+        assert(e.GetPath() == "/x~0y");
+    }
+
+    JsonSchema any(Json::Parse("true"));
+    JsonSchema nothing(Json::Parse("false"));
+    any.Validate(valid);
+
+    bool threw = false;
+    try { nothing.Validate("null"); } catch (const JsonSchemaError&) { threw = true; }
+    assert(threw);
+
+    // keywords that aren't checked are rejected, not ignored
+    threw = false;
+    try { JsonSchema(Json::Parse(R"({"pattern": "^a"})")); } catch (const std::runtime_error&) { threw = true; }
+    assert(threw);
+}
+
+void TestPatch()
+{
+    auto patched = [](std::string_view doc, std::string_view patch) {
+        Json value = Json::Parse(doc);
+        value.ApplyPatch(Json::Parse(patch));
+        return value.Dump();
+    };
+
+    // examples from RFC 6902
+    assert(patched(R"({"foo":"bar"})", R"([{"op":"add","path":"/baz","value":"qux"}])") == R"({"foo":"bar","baz":"qux"})");
+    assert(patched(R"({"foo":["bar","baz"]})", R"([{"op":"add","path":"/foo/1","value":"qux"}])") == R"({"foo":["bar","qux","baz"]})");
+    assert(patched(R"({"baz":"qux","foo":"bar"})", R"([{"op":"remove","path":"/baz"}])") == R"({"foo":"bar"})");
+    assert(patched(R"({"foo":["bar","qux","baz"]})", R"([{"op":"remove","path":"/foo/1"}])") == R"({"foo":["bar","baz"]})");
+    assert(patched(R"({"baz":"qux","foo":"bar"})", R"([{"op":"replace","path":"/baz","value":"boo"}])") == R"({"baz":"boo","foo":"bar"})");
+    assert(patched(R"({"foo":{"bar":"baz","waldo":"fred"},"qux":{"corge":"grault"}})",
+        R"([{"op":"move","from":"/foo/waldo","path":"/qux/thud"}])") == R"({"foo":{"bar":"baz"},"qux":{"corge":"grault","thud":"fred"}})");
+    assert(patched(R"({"foo":["all","grass","cows","eat"]})", R"([{"op":"move","from":"/foo/1","path":"/foo/3"}])") == R"({"foo":["all","cows","eat","grass"]})");
+    assert(patched(R"({"foo":["bar"]})", R"([{"op":"add","path":"/foo/-","value":["abc","def"]}])") == R"({"foo":["bar",["abc","def"]]})");
+    assert(patched(R"({"a/b":1,"m~n":2,"*":3})", R"([{"op":"copy","from":"/a~1b","path":"/m~0n"},{"op":"remove","path":"/*"}])") == R"({"a/b":1,"m~n":1})");
+    assert(patched(R"({"a":1})", R"([{"op":"replace","path":"","value":[1]}])") == "[1]");
+    assert(patched(R"({"baz":"qux","foo":["a",2,"c"]})",
+        R"([{"op":"test","path":"/baz","value":"qux"},{"op":"test","path":"/foo/1","value":2.0}])") == R"({"baz":"qux","foo":["a",2,"c"]})");
+
+    auto fails = [](std::string_view doc, std::string_view patch) {
+        Json value = Json::Parse(doc);
+        try { value.ApplyPatch(Json::Parse(patch)); }
+        catch (const std::runtime_error&) { return true; }
+        return false;
+    };
+
+    assert(fails(R"({"baz":"qux"})", R"([{"op":"test","path":"/baz","value":"bar"}])"));
+    assert(fails(R"({"foo":"bar"})", R"([{"op":"add","path":"/baz/bat","value":"qux"}])"));
+    assert(fails(R"({"foo":[1]})", R"([{"op":"add","path":"/foo/2","value":2}])"));
+    assert(fails(R"({"foo":[1]})", R"([{"op":"remove","path":"/foo/01"}])"));
+    assert(fails(R"({"foo":{}})", R"([{"op":"move","from":"/foo","path":"/foo/bar"}])"));
+    assert(fails(R"({"foo":1})", R"([{"op":"frobnicate","path":"/foo"}])"));
+    assert(fails(R"({"foo":1})", R"([{"op":"replace","path":"/foo"}])"));
+
+    // a failed patch leaves the value unchanged, including the containers earlier operations wrote to
+    Json partial = Json::Parse(R"({"a":1,"b":{"c":[1,2]}})");
+    try {
+        partial.ApplyPatch(Json::Parse(R"([{"op":"add","path":"/b/c/-","value":3},{"op":"remove","path":"/a"},{"op":"remove","path":"/a"}])"));
+        assert(false);
+    }
+    catch (const std::runtime_error& e) {
+        assert(std::string(e.what()).find("operation 2") != std::string::npos);
+    }
+    assert(partial.Dump() == R"({"a":1,"b":{"c":[1,2]}})");
+
+    partial.ApplyPatch(Json::Parse(R"([{"op":"add","path":"/b/c/-","value":3},{"op":"remove","path":"/a"}])"));
+    assert(partial.Dump() == R"({"b":{"c":[1,2,3]}})");
+
+    // diffs apply back to the target
+    auto roundTrip = [](std::string_view from, std::string_view to) {
+        Json a = Json::Parse(from);
+        Json b = Json::Parse(to);
+        Json patch = Json::Diff(a, b);
+        a.ApplyPatch(patch);
+        assert(a.Equals(b));
+        return patch.Dump();
+    };
+
+    assert(roundTrip(R"({"a":[1,2,3],"b":{"c":true}})", R"({"b":{"c":true},"a":[1,2,3]})") == "[]");
+    assert(roundTrip(R"({"a":1,"b":2})", R"({"a":1,"c":2})") == R"([{"op":"remove","path":"/b"},{"op":"add","path":"/c","value":2}])");
+    assert(roundTrip(R"([1,2,3,4])", R"([0,1,2,3,4])") == R"([{"op":"add","path":"/0","value":0}])");
+    assert(roundTrip(R"([1,2,3,4])", R"([1,2,4])") == R"([{"op":"remove","path":"/2"}])");
+    assert(roundTrip(R"([1,{"x":1},3])", R"([1,{"x":2},3])") == R"([{"op":"replace","path":"/1/x","value":2}])");
+    assert(roundTrip(R"({"a/b":{"m~n":1}})", R"({"a/b":{"m~n":"1"}})") == R"([{"op":"replace","path":"/a~1b/m~0n","value":"1"}])");
+    assert(roundTrip(R"([1,2,3])", R"([4,5])").size() > 2);
+    assert(roundTrip(R"([1,2])", R"([3,4,5,6])").size() > 2);
+    assert(roundTrip(R"({"a":[]})", R"({"a":{}})") == R"([{"op":"replace","path":"/a","value":{}}])");
+    assert(roundTrip(R"({"x":1})", R"({"x":1.0})") == R"([{"op":"replace","path":"/x","value":1.0}])");
+    assert(roundTrip(R"([1,2.0,3])", R"([1,2,3])") == R"([{"op":"replace","path":"/1","value":2}])");
+
+    Json number = Json::Parse(R"({"x":1})");
+    number.ApplyPatch(Json::Diff(number, Json::Parse(R"({"x":1.0})")));
+    assert(number["x"].IsFloat() && number.Dump() == R"({"x":1.0})");
+    assert(roundTrip(ReadFile("test.json"), R"({"children":[]})").size() > 2);
+
+    // unchanged shared subtrees are skipped, however large they are
+    std::string records = "[";
+    for (int i = 0; i != 1000; ++i)
+        records += std::string(i ? "," : "") + R"({"id":)" + std::to_string(i) + R"(,"tags":["a","b"]})";
+    records += "]";
+
+    Json base = Json::Parse(records);
+    base.Share();
+    Json next = base;
+    next[500]["id"] = -1;
+    assert(std::as_const(next).GetAt(0).IsShared() && !std::as_const(next).GetAt(500).IsShared());
+
+    Json delta = Json::Diff(base, next);
+    assert(delta.Dump() == R"([{"op":"replace","path":"/500/id","value":-1}])");
+    base.ApplyPatch(delta);
+    assert(base.Equals(next) && base.Dump() == next.Dump());
+
+    // examples from RFC 7386
+    Json doc = Json::Parse(R"({"title":"Goodbye!","author":{"givenName":"John","familyName":"Doe"},"tags":["example","sample"],"content":"This will be unchanged"})");
+    doc.MergePatch(Json::Parse(R"({"title":"Hello!","phoneNumber":"+01-123-456-7890","author":{"familyName":null},"tags":["example"]})"));
+    assert(doc.Dump() == R"({"title":"Hello!","author":{"givenName":"John"},"tags":["example"],"content":"This will be unchanged","phoneNumber":"+01-123-456-7890"})");
+
+    Json merged = Json::Parse(R"({"a":"b"})");
+    merged.MergePatch(Json::Parse(R"({"a":{"bb":{"ccc":null}}})"));
+    assert(merged.Dump() == R"({"a":{"bb":{}}})");
+    merged.MergePatch(Json::Parse(R"(["c"])"));
+    assert(merged.Dump() == R"(["c"])");
+}
+
 int main(int argc, char** argv)
 {
     TestParsing();
+    TestIndexedEngine();
+    TestDocument();
+    TestMappedFile();
+    TestJsonLines();
+    TestParallelArray();
+    TestCompactNodes();
+    TestObjectOrder();
+    TestHandler();
+    TestPushParser();
+    TestPrinter();
+    TestParallelDump();
+    TestKeyInterning();
+    TestSharedValues();
+    TestReuse();
+    TestDepthLimit();
+    TestTryParse();
+    TestInSitu();
+    TestStats();
+    TestSchema();
+    TestPatch();
+    TestNumbers();
+    TestLazyValue();
+    TestPointer();
+    TestCbor();
     TestConversion();
+    TestMoveConversions();
+    TestReflection();
 
     return 0;
 }